@@ -1,9 +1,13 @@
 TEMPLATE = subdirs
 
-SUBDIRS = wpchanger_app wpchanger image qtutils cpputils cpp-template-utils
+SUBDIRS = wpchanger_app wpchanger image qtutils cpputils cpp-template-utils tests benchmarks
 
 qtutils.depends = cpputils
 
 wpchanger.depends = image qtutils
 
 wpchanger_app.depends = image wpchanger qtutils
+
+tests.depends = image wpchanger qtutils
+
+benchmarks.depends = image wpchanger qtutils
@@ -0,0 +1,93 @@
+#include "hashingbenchmark.h"
+#include "image.h"
+#include "xxhash64.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QtTest>
+RESTORE_COMPILER_WARNINGS
+
+#include <algorithm>
+#include <string.h>
+
+#define HASHED_DATA_SIZE (128 * 1024 * 1024)
+// Every measurement hashes the data at least this many times, and for at least this long
+#define MIN_PASSES 3
+#define MIN_DURATION_MS 1000
+
+Q_DECLARE_METATYPE(HASHALGORITHM)
+
+// The same value Image::contentsHash() produces for a file with these contents
+static quint64 hashBuffer(const std::vector<char>& data, HASHALGORITHM algorithm)
+{
+	if (algorithm == HASH_MD5)
+	{
+		const QByteArray hash = QCryptographicHash::hash(QByteArray::fromRawData(data.data(), (int)data.size()), QCryptographicHash::Md5);
+		quint64 halves[2];
+		memcpy(halves, hash.constData(), sizeof(halves));
+		return halves[0] ^ halves[1];
+	}
+
+	XxHash64 hash;
+	hash.update(data.data(), data.size());
+	return hash.digest();
+}
+
+void HashingBenchmark::initTestCase()
+{
+	QVERIFY(_dir.isValid());
+
+	// Incompressible, like the image files
+	_data.resize(HASHED_DATA_SIZE);
+	quint64 state = 0x9E3779B97F4A7C15ull;
+	for (size_t i = 0; i < _data.size(); i += sizeof(state))
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		memcpy(_data.data() + i, &state, sizeof(state));
+	}
+
+	_filePath = _dir.filePath("data.bin");
+	QFile file(_filePath);
+	QVERIFY(file.open(QIODevice::WriteOnly));
+	QCOMPARE(file.write(_data.data(), (qint64)_data.size()), (qint64)_data.size());
+	file.close();
+
+	const Image image(_filePath, ImgParams(), 1);
+	QCOMPARE(image.contentsHash(HASH_XXH64), hashBuffer(_data, HASH_XXH64));
+	QCOMPARE(image.contentsHash(HASH_MD5), hashBuffer(_data, HASH_MD5));
+}
+
+void HashingBenchmark::throughput_data()
+{
+	QTest::addColumn<HASHALGORITHM>("algorithm");
+	QTest::addColumn<bool>("fromFile");
+
+	QTest::newRow("XXH64, memory") << HASH_XXH64 << false;
+	QTest::newRow("MD5, memory") << HASH_MD5 << false;
+	QTest::newRow("XXH64, contentsHash") << HASH_XXH64 << true;
+	QTest::newRow("MD5, contentsHash") << HASH_MD5 << true;
+}
+
+void HashingBenchmark::throughput()
+{
+	QFETCH(HASHALGORITHM, algorithm);
+	QFETCH(bool, fromFile);
+
+	const Image image(_filePath, ImgParams(), 1);
+	const quint64 expectedHash = hashBuffer(_data, algorithm);
+
+	qint64 bytesHashed = 0;
+	QElapsedTimer timer;
+	timer.start();
+	for (int pass = 0; pass < MIN_PASSES || timer.elapsed() < MIN_DURATION_MS; ++pass)
+	{
+		QCOMPARE(fromFile ? image.contentsHash(algorithm) : hashBuffer(_data, algorithm), expectedHash);
+		bytesHashed += (qint64)_data.size();
+	}
+
+	QTest::setBenchmarkResult((qreal)bytesHashed * 1000 / std::max<qint64>(timer.elapsed(), 1), QTest::BytesPerSecond);
+}
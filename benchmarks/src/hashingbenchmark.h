@@ -0,0 +1,28 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QObject>
+#include <QString>
+#include <QTemporaryDir>
+RESTORE_COMPILER_WARNINGS
+
+#include <vector>
+
+// Throughput of the contentsHash() algorithms, reported in bytes per second: the bare hash over a buffer in memory, and Image::contentsHash() streaming a file
+class HashingBenchmark : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+	void throughput_data();
+	void throughput();
+
+private:
+	std::vector<char> _data;
+	QTemporaryDir     _dir;
+	// _data written out, read through the page cache after the first pass
+	QString           _filePath;
+};
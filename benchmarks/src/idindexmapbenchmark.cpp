@@ -0,0 +1,97 @@
+#include "idindexmapbenchmark.h"
+#include "idindexmap.h"
+#include "imagelist.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QtTest>
+RESTORE_COMPILER_WARNINGS
+
+#include <algorithm>
+#include <map>
+#include <random>
+
+#define NUM_IDS 1000000
+
+void IdIndexMapBenchmark::initTestCase()
+{
+	// Path hashes in a real list, so just as random
+	std::mt19937_64 random(42);
+	_ids.reserve(NUM_IDS);
+	for (int i = 0; i < NUM_IDS; ++i)
+		_ids.push_back(random());
+
+	_lookupOrder = _ids;
+	std::shuffle(_lookupOrder.begin(), _lookupOrder.end(), random);
+}
+
+void IdIndexMapBenchmark::build_data()
+{
+	QTest::addColumn<bool>("stdMap");
+
+	QTest::newRow("IdIndexMap") << false;
+	QTest::newRow("std::map") << true;
+}
+
+void IdIndexMapBenchmark::build()
+{
+	QFETCH(bool, stdMap);
+
+	if (stdMap)
+	{
+		QBENCHMARK {
+			std::map<qulonglong, size_t> indexById;
+			for (size_t i = 0; i < _ids.size(); ++i)
+				indexById[_ids[i]] = i;
+
+			QCOMPARE(indexById.size(), _ids.size());
+		}
+	}
+	else
+	{
+		QBENCHMARK {
+			IdIndexMap indexById;
+			indexById.assign(_ids);
+			QCOMPARE(indexById.size(), _ids.size());
+		}
+	}
+}
+
+void IdIndexMapBenchmark::lookUpIndexes_data()
+{
+	build_data();
+}
+
+void IdIndexMapBenchmark::lookUpIndexes()
+{
+	QFETCH(bool, stdMap);
+
+	// Summing the indexes keeps the lookups from being optimized away, and checks them
+	const size_t expectedSum = _ids.size() * (_ids.size() - 1) / 2;
+	if (stdMap)
+	{
+		std::map<qulonglong, size_t> indexById;
+		for (size_t i = 0; i < _ids.size(); ++i)
+			indexById[_ids[i]] = i;
+
+		QBENCHMARK {
+			size_t sum = 0;
+			for (qulonglong id: _lookupOrder)
+				sum += indexById.find(id)->second;
+
+			QCOMPARE(sum, expectedSum);
+		}
+	}
+	else
+	{
+		IdIndexMap indexById;
+		indexById.assign(_ids);
+
+		QBENCHMARK {
+			size_t sum = 0;
+			for (qulonglong id: _lookupOrder)
+				sum += indexById.indexOf(id);
+
+			QCOMPARE(sum, expectedSum);
+		}
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QObject>
+RESTORE_COMPILER_WARNINGS
+
+#include <vector>
+
+// IdIndexMap at 1M entries against the std::map from ID to index that WallpaperChanger kept before
+class IdIndexMapBenchmark : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+
+	void build_data();
+	void build();
+	// Every ID looked up once, in an order unrelated to the indexes
+	void lookUpIndexes_data();
+	void lookUpIndexes();
+
+private:
+	std::vector<qulonglong> _ids;
+	std::vector<qulonglong> _lookupOrder;
+};
@@ -0,0 +1,186 @@
+#include "imagelistbenchmark.h"
+#include "imagelist.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QElapsedTimer>
+#include <QtTest>
+RESTORE_COMPILER_WARNINGS
+
+#include <algorithm>
+
+#define NUM_ENTRIES 200000
+// A couple of hundred wallpapers per folder
+#define ENTRIES_PER_FOLDER 200
+#define SMALL_LIST_ENTRIES (size_t)25000
+#define LARGE_LIST_ENTRIES (size_t)250000
+#define REMOVAL_LIST_ENTRIES (size_t)100000
+#define REMOVED_ENTRIES (size_t)10000
+#define REMOVAL_PASSES 5
+
+// The list entry as it used to be: the path, the file name and the folder each in a string of its own, next to the parameters
+struct LegacyEntry
+{
+	QString    filePath;
+	QString    fileName;
+	QString    folder;
+	qulonglong id;
+	ImgParams  params;
+};
+
+static size_t stringBytes(const QString& string)
+{
+	return string.isEmpty() ? 0 : sizeof(QArrayData) + ((size_t)string.capacity() + 1) * sizeof(QChar);
+}
+
+static QString listFileName(size_t numEntries)
+{
+	return QString("%1.wil").arg(numEntries);
+}
+
+void ImageListBenchmark::initTestCase()
+{
+	_paths.reserve(NUM_ENTRIES);
+	for (int i = 0; i < NUM_ENTRIES; ++i)
+		_paths.push_back(QString("/home/user/Pictures/Wallpapers/Collection %1/Wallpaper %2 - 1920x1080.jpg").arg(i / ENTRIES_PER_FOLDER).arg(i));
+
+	// The lists to load, a small one and one of a bigger collection than the rest of the benchmarks use
+	QVERIFY(_dir.isValid());
+	for (size_t numEntries: {SMALL_LIST_ENTRIES, LARGE_LIST_ENTRIES})
+	{
+		ImageList list;
+		for (size_t i = 0; i < numEntries; ++i)
+		{
+			const QString path = i < _paths.size() ? _paths[i] : QString("/home/user/Pictures/More wallpapers/Collection %1/Wallpaper %2.png").arg(i / ENTRIES_PER_FOLDER).arg(i);
+			list.addImage(Image(path, ImgParams(), Image::pathId(path)));
+		}
+
+		QVERIFY(list.saveList(_dir.filePath(listFileName(numEntries))));
+	}
+}
+
+void ImageListBenchmark::memoryPerEntry_data()
+{
+	QTest::addColumn<bool>("columns");
+
+	QTest::newRow("ImageList columns") << true;
+	QTest::newRow("Image per entry") << false;
+}
+
+void ImageListBenchmark::memoryPerEntry()
+{
+	QFETCH(bool, columns);
+
+	size_t bytes = 0;
+	if (columns)
+	{
+		ImageList list;
+		for (const QString& path: _paths)
+			list.addImage(Image(path, ImgParams(), Image::pathId(path)));
+
+		QCOMPARE(list.size(), _paths.size());
+		bytes = list.memoryUsage();
+	}
+	else
+	{
+		std::vector<LegacyEntry> entries(_paths.size());
+		for (size_t i = 0; i < _paths.size(); ++i)
+		{
+			entries[i].filePath = _paths[i];
+			Image::splitPath(_paths[i], entries[i].folder, entries[i].fileName);
+			entries[i].id = Image::pathId(_paths[i]);
+		}
+
+		bytes = entries.capacity() * sizeof(LegacyEntry);
+		for (const LegacyEntry& entry: entries)
+			bytes += stringBytes(entry.filePath) + stringBytes(entry.fileName) + stringBytes(entry.folder);
+	}
+
+	QTest::setBenchmarkResult((qreal)bytes / _paths.size(), QTest::BytesAllocated);
+}
+
+void ImageListBenchmark::load_data()
+{
+	QTest::addColumn<size_t>("numEntries");
+	QTest::addColumn<bool>("allPaths");
+
+	QTest::newRow("25k entries, usable") << SMALL_LIST_ENTRIES << false;
+	QTest::newRow("250k entries, usable") << LARGE_LIST_ENTRIES << false;
+	QTest::newRow("250k entries, all paths decoded") << LARGE_LIST_ENTRIES << true;
+}
+
+void ImageListBenchmark::load()
+{
+	QFETCH(size_t, numEntries);
+	QFETCH(bool, allPaths);
+
+	const QString listPath = _dir.filePath(listFileName(numEntries));
+	QBENCHMARK {
+		ImageList list;
+		QVERIFY(list.loadList(listPath));
+		QCOMPARE(list.size(), numEntries);
+		// Reading any path works from the start, straight from the file
+		QVERIFY(!list.filePath(numEntries / 2).isEmpty());
+		// Waits for the background decoding to finish
+		if (allPaths)
+			QVERIFY(list.memoryUsage() > 0);
+	}
+}
+
+void ImageListBenchmark::removal_data()
+{
+	QTest::addColumn<bool>("oldWay");
+	QTest::addColumn<bool>("scattered");
+
+	QTest::newRow("removeImages, every 10th entry") << false << true;
+	QTest::newRow("removeImages, a contiguous range") << false << false;
+	QTest::newRow("find per entry and copy, every 10th entry") << true << true;
+}
+
+void ImageListBenchmark::removal()
+{
+	QFETCH(bool, oldWay);
+	QFETCH(bool, scattered);
+
+	std::vector<size_t> indexes;
+	for (size_t i = 0; i < REMOVED_ENTRIES; ++i)
+		indexes.push_back(scattered ? i * (REMOVAL_LIST_ENTRIES / REMOVED_ENTRIES) : REMOVAL_LIST_ENTRIES / 2 + i);
+
+	// Only the removal itself is timed, the list is filled anew for every pass
+	qint64 elapsedMs = 0;
+	for (int pass = 0; pass < REMOVAL_PASSES; ++pass)
+	{
+		if (oldWay)
+		{
+			std::vector<Image> images;
+			for (size_t i = 0; i < REMOVAL_LIST_ENTRIES; ++i)
+				images.push_back(Image(_paths[i], ImgParams(), Image::pathId(_paths[i])));
+
+			QElapsedTimer timer;
+			timer.start();
+			std::vector<Image> newList;
+			for (size_t i = 0; i < images.size(); ++i)
+			{
+				if (std::find(indexes.begin(), indexes.end(), i) == indexes.end())
+					newList.push_back(images[i]);
+			}
+
+			images = newList;
+			elapsedMs += timer.elapsed();
+			QCOMPARE(images.size(), REMOVAL_LIST_ENTRIES - REMOVED_ENTRIES);
+		}
+		else
+		{
+			ImageList list;
+			for (size_t i = 0; i < REMOVAL_LIST_ENTRIES; ++i)
+				list.addImage(Image(_paths[i], ImgParams(), Image::pathId(_paths[i])));
+
+			QElapsedTimer timer;
+			timer.start();
+			list.removeImages(indexes);
+			elapsedMs += timer.elapsed();
+			QCOMPARE(list.size(), REMOVAL_LIST_ENTRIES - REMOVED_ENTRIES);
+		}
+	}
+
+	QTest::setBenchmarkResult((qreal)elapsedMs / REMOVAL_PASSES, QTest::WalltimeMilliseconds);
+}
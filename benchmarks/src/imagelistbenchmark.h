@@ -0,0 +1,36 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QObject>
+#include <QString>
+#include <QTemporaryDir>
+RESTORE_COMPILER_WARNINGS
+
+#include <vector>
+
+// ImageList at the size of a big wallpaper collection
+class ImageListBenchmark : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+
+	// Reported as bytes allocated per entry: the list's columns, and the Image per entry layout the list had before them
+	void memoryPerEntry_data();
+	void memoryPerEntry();
+
+	// loadList() of a saved list: until the entries are usable, which shouldn't depend on the list size, and until all the paths are decoded
+	void load_data();
+	void load();
+
+	// Removing 10k of 100k entries, in milliseconds: ImageList::removeImages, and the std::find per entry and copy it replaced
+	void removal_data();
+	void removal();
+
+private:
+	std::vector<QString> _paths;
+	QTemporaryDir        _dir;
+};
@@ -0,0 +1,74 @@
+#include "imageprobebenchmark.h"
+#include "imageprobe.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QImageReader>
+#include <QtTest>
+RESTORE_COMPILER_WARNINGS
+
+// The probe only reads the headers, so the image size hardly matters; wallpaper-sized BMPs would just fill the disk
+#define CORPUS_IMAGE_WIDTH 1280
+#define CORPUS_IMAGE_HEIGHT 720
+#define CORPUS_FILES_PER_FORMAT 20
+
+void ImageProbeBenchmark::initTestCase()
+{
+	QVERIFY(_corpusDir.isValid());
+
+	QImage image(CORPUS_IMAGE_WIDTH, CORPUS_IMAGE_HEIGHT, QImage::Format_RGB32);
+	for (int y = 0; y < image.height(); ++y)
+	{
+		QRgb* line = (QRgb*)image.scanLine(y);
+		for (int x = 0; x < image.width(); ++x)
+			line[x] = qRgb(x % 256, y % 256, (x + y) % 256);
+	}
+
+	for (const char* format: {"jpg", "png", "bmp"})
+	{
+		for (int i = 0; i < CORPUS_FILES_PER_FORMAT; ++i)
+		{
+			const QString path = _corpusDir.filePath(QString("%1.%2").arg(i).arg(format));
+			QVERIFY(image.save(path));
+			_corpus.push_back(path);
+		}
+	}
+
+	// Both ways must be reading the same thing
+	for (const ImgParams& params: probeImages(_corpus))
+	{
+		QCOMPARE(params._width, CORPUS_IMAGE_WIDTH);
+		QCOMPARE(params._height, CORPUS_IMAGE_HEIGHT);
+	}
+}
+
+void ImageProbeBenchmark::readDimensions_data()
+{
+	QTest::addColumn<bool>("probe");
+
+	QTest::newRow("probeImages") << true;
+	QTest::newRow("QImageReader") << false;
+}
+
+void ImageProbeBenchmark::readDimensions()
+{
+	QFETCH(bool, probe);
+
+	if (probe)
+	{
+		QBENCHMARK {
+			const std::vector<ImgParams> params = probeImages(_corpus);
+			QVERIFY(params.back()._fmt != UNKN);
+		}
+	}
+	else
+	{
+		QBENCHMARK {
+			for (const QString& path: _corpus)
+			{
+				QImageReader reader(path);
+				QVERIFY(reader.canRead());
+				QVERIFY(reader.size().isValid());
+			}
+		}
+	}
+}
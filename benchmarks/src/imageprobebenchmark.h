@@ -0,0 +1,24 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QObject>
+#include <QStringList>
+#include <QTemporaryDir>
+RESTORE_COMPILER_WARNINGS
+
+// probeImages() against the QImageReader path that Image::loadFromFile took for every file before, on a corpus of JPEG, PNG and BMP files written for the run
+class ImageProbeBenchmark : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+	void readDimensions_data();
+	void readDimensions();
+
+private:
+	QTemporaryDir _corpusDir;
+	QStringList   _corpus;
+};
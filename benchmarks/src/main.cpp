@@ -0,0 +1,40 @@
+#include "hashingbenchmark.h"
+#include "idindexmapbenchmark.h"
+#include "imagelistbenchmark.h"
+#include "imageprobebenchmark.h"
+#include "resamplerbenchmark.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QCoreApplication>
+#include <QtTest>
+RESTORE_COMPILER_WARNINGS
+
+// Runs the benchmarks of every module one after another; the usual Qt Test options apply (e.g. -iterations, -median, -csv)
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	int failures = 0;
+	{
+		ImageProbeBenchmark benchmark;
+		failures += QTest::qExec(&benchmark, argc, argv);
+	}
+	{
+		HashingBenchmark benchmark;
+		failures += QTest::qExec(&benchmark, argc, argv);
+	}
+	{
+		ImageListBenchmark benchmark;
+		failures += QTest::qExec(&benchmark, argc, argv);
+	}
+	{
+		IdIndexMapBenchmark benchmark;
+		failures += QTest::qExec(&benchmark, argc, argv);
+	}
+	{
+		ResamplerBenchmark benchmark;
+		failures += QTest::qExec(&benchmark, argc, argv);
+	}
+
+	return failures;
+}
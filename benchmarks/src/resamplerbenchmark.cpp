@@ -0,0 +1,92 @@
+#include "resamplerbenchmark.h"
+#include "resampler.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QtTest>
+RESTORE_COMPILER_WARNINGS
+
+#define PHOTO_WIDTH 6000
+#define PHOTO_HEIGHT 4000
+#define SCREENSHOT_WIDTH 3840
+#define SCREENSHOT_HEIGHT 2160
+
+enum ScalingMethod {QtSmoothScaling, ResampleOnOneThread, ResampleInRowBands};
+
+Q_DECLARE_METATYPE(ScalingMethod)
+
+// Gradients with noise on top, so that neither the filters nor the memory traffic have it any easier than with a real photo
+static QImage testImage(int width, int height)
+{
+	QImage image(width, height, QImage::Format_RGB32);
+	quint32 state = 0x9E3779B9u;
+	for (int y = 0; y < height; ++y)
+	{
+		QRgb* line = (QRgb*)image.scanLine(y);
+		for (int x = 0; x < width; ++x)
+		{
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			const int noise = (int)(state & 31) - 16;
+			line[x] = qRgb(qBound(0, 255 * x / width + noise, 255), qBound(0, 255 * y / height + noise, 255), qBound(0, 255 - 255 * x / width + noise, 255));
+		}
+	}
+
+	return image;
+}
+
+void ResamplerBenchmark::initTestCase()
+{
+	_photo = testImage(PHOTO_WIDTH, PHOTO_HEIGHT);
+	_screenshot = testImage(SCREENSHOT_WIDTH, SCREENSHOT_HEIGHT);
+}
+
+void ResamplerBenchmark::downscale_data()
+{
+	QTest::addColumn<QImage>("source");
+	QTest::addColumn<QSize>("targetSize");
+	QTest::addColumn<ScalingMethod>("method");
+
+	const struct {
+		const char* name;
+		QImage      source;
+		QSize       targetSize;
+	} scalings[] = {
+		{"24 MP to 1920x1280", _photo, QSize(1920, 1280)},
+		{"24 MP to 256x171", _photo, QSize(256, 171)},
+		{"4K to 1920x1080", _screenshot, QSize(1920, 1080)},
+		{"4K to 256x144", _screenshot, QSize(256, 144)},
+	};
+
+	for (const auto& scaling: scalings)
+	{
+		QTest::newRow(qPrintable(QString("%1, QImage::scaled").arg(scaling.name))) << scaling.source << scaling.targetSize << QtSmoothScaling;
+		QTest::newRow(qPrintable(QString("%1, resampleImage, 1 thread").arg(scaling.name))) << scaling.source << scaling.targetSize << ResampleOnOneThread;
+		QTest::newRow(qPrintable(QString("%1, resampleImage, row bands").arg(scaling.name))) << scaling.source << scaling.targetSize << ResampleInRowBands;
+	}
+}
+
+void ResamplerBenchmark::downscale()
+{
+	QFETCH(QImage, source);
+	QFETCH(QSize, targetSize);
+	QFETCH(ScalingMethod, method);
+
+	QImage scaled;
+	QBENCHMARK {
+		switch (method)
+		{
+		case QtSmoothScaling:
+			scaled = source.scaled(targetSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+			break;
+		case ResampleOnOneThread:
+			scaled = resampleImage(source, targetSize, 1);
+			break;
+		case ResampleInRowBands:
+			scaled = resampleImage(source, targetSize);
+			break;
+		}
+	}
+
+	QCOMPARE(scaled.size(), targetSize);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QImage>
+#include <QObject>
+RESTORE_COMPILER_WARNINGS
+
+// resampleImage() against QImage::scaled(..., Qt::SmoothTransformation), which it replaces, on the big downscales the wallpapers and the thumbnails take:
+// a photo and a 4K image down to a screen and to a thumbnail, resampled on one thread and in row bands on all the cores
+class ResamplerBenchmark : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+	void downscale_data();
+	void downscale();
+
+private:
+	QImage _photo;
+	QImage _screenshot;
+};
@@ -40,7 +40,19 @@ INCLUDEPATH += \
 	../cpputils
 
 HEADERS += \
-	src/image.h
+	src/image.h \
+	src/decodedimagecache.h \
+	src/imageprobe.h \
+	src/perceptualhash.h \
+	src/resampler.h \
+	src/wallpaperrenderer.h \
+	src/xxhash64.h
 
 SOURCES += \
-	src/image.cpp
+	src/image.cpp \
+	src/decodedimagecache.cpp \
+	src/imageprobe.cpp \
+	src/perceptualhash.cpp \
+	src/resampler.cpp \
+	src/wallpaperrenderer.cpp \
+	src/xxhash64.cpp
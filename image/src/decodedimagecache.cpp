@@ -0,0 +1,146 @@
+#include "decodedimagecache.h"
+
+// A single image bigger than this share of the budget is returned but not cached - it would flush everything else
+static const qint64 maxEntryShareOfBudget = 2;
+static const qint64 defaultBudget = 256 * 1024 * 1024;
+
+DecodedImageCache& DecodedImageCache::instance()
+{
+	static DecodedImageCache inst;
+	return inst;
+}
+
+DecodedImageCache::DecodedImageCache() :
+	_budget(defaultBudget),
+	_bytesUsed(0),
+	_hits(0),
+	_misses(0)
+{
+}
+
+QImage DecodedImageCache::image(const Image& image, const QSize& targetSize /* = QSize() */, int numThreads /* = 0 */)
+{
+	if (!image.isValidImage())
+		return QImage();
+
+	const bool fullSize = !targetSize.isValid() || targetSize.isEmpty();
+	const Key key = {image.id(), fullSize ? 0 : targetSize.width(), fullSize ? 0 : targetSize.height()};
+
+	QImage result;
+	if (lookup(key, result))
+		return result;
+
+	result = fullSize ? image.constructQImageObject() : image.constructQImageObject(targetSize, numThreads);
+	if (!result.isNull())
+		insert(key, result);
+
+	return result;
+}
+
+void DecodedImageCache::remove(qulonglong imageId)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	for (auto it = _entries.begin(); it != _entries.end(); )
+	{
+		if (it->key.id == imageId)
+		{
+			_bytesUsed -= it->cost;
+			_entryByKey.erase(it->key);
+			it = _entries.erase(it);
+		}
+		else
+			++it;
+	}
+}
+
+void DecodedImageCache::clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_entries.clear();
+	_entryByKey.clear();
+	_bytesUsed = 0;
+}
+
+void DecodedImageCache::setBudget(qint64 bytes)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_budget = bytes > 0 ? bytes : 0;
+	evict(_budget);
+}
+
+qint64 DecodedImageCache::budget() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _budget;
+}
+
+qint64 DecodedImageCache::bytesUsed() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _bytesUsed;
+}
+
+quint64 DecodedImageCache::hits() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _hits;
+}
+
+quint64 DecodedImageCache::misses() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _misses;
+}
+
+bool DecodedImageCache::lookup(const Key& key, QImage& image)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	const auto entry = _entryByKey.find(key);
+	if (entry == _entryByKey.end())
+	{
+		++_misses;
+		return false;
+	}
+
+	++_hits;
+	// Move to the front of the LRU list
+	_entries.splice(_entries.begin(), _entries, entry->second);
+	image = entry->second->image;
+	return true;
+}
+
+void DecodedImageCache::insert(const Key& key, const QImage& image)
+{
+	const qint64 cost = (qint64)image.bytesPerLine() * image.height();
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if (cost > _budget / maxEntryShareOfBudget)
+		return;
+
+	// Another thread may have decoded the same image in the meantime
+	if (_entryByKey.count(key) > 0)
+		return;
+
+	evict(_budget - cost);
+
+	const Entry entry = {key, image, cost};
+	_entries.push_front(entry);
+	_entryByKey[key] = _entries.begin();
+	_bytesUsed += cost;
+}
+
+void DecodedImageCache::evict(qint64 budget)
+{
+	while (_bytesUsed > budget && !_entries.empty())
+	{
+		const Entry& coldest = _entries.back();
+		_bytesUsed -= coldest.cost;
+		_entryByKey.erase(coldest.key);
+		_entries.pop_back();
+	}
+}
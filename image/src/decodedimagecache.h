@@ -0,0 +1,75 @@
+#pragma once
+
+#include "image.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QImage>
+#include <QSize>
+RESTORE_COMPILER_WARNINGS
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+// Process-wide cache of decoded images, keyed by image ID and the requested decode size.
+// The memory budget is a byte limit on the pixel data held; least recently used images are evicted first.
+// Thread-safe: the decoding itself happens outside of the lock, so concurrent misses don't serialize.
+class DecodedImageCache
+{
+public:
+	static DecodedImageCache& instance();
+
+	// Returns the cached image, or decodes it (see Image::constructQImageObject) and caches the result.
+	// An empty targetSize means the full-size image. numThreads is for the downscaling, see Image::constructQImageObject.
+	QImage image(const Image& image, const QSize& targetSize = QSize(), int numThreads = 0);
+
+	// Drops all the cached sizes of the image, e.g. when it's been removed from the list
+	void remove(qulonglong imageId);
+	void clear();
+
+	void setBudget(qint64 bytes);
+	qint64 budget() const;
+	qint64 bytesUsed() const;
+
+	quint64 hits() const;
+	quint64 misses() const;
+
+private:
+	DecodedImageCache();
+
+	struct Key {
+		qulonglong id;
+		int width, height;
+
+		bool operator==(const Key& other) const { return id == other.id && width == other.width && height == other.height; }
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key& key) const { return std::hash<qulonglong>()(key.id ^ ((qulonglong)key.width << 40) ^ ((qulonglong)key.height << 20)); }
+	};
+
+	struct Entry {
+		Key key;
+		QImage image;
+		qint64 cost;
+	};
+
+	typedef std::list<Entry> LruList;
+
+	bool lookup(const Key& key, QImage& image);
+	void insert(const Key& key, const QImage& image);
+	// Evicts from the cold end until the total fits into the budget. Must be called with the mutex held.
+	void evict(qint64 budget);
+
+private:
+	mutable std::mutex _mutex;
+
+	// Most recently used entries at the front
+	LruList _entries;
+	std::unordered_map<Key, LruList::iterator, KeyHash> _entryByKey;
+
+	qint64 _budget;
+	qint64 _bytesUsed;
+	quint64 _hits;
+	quint64 _misses;
+};
@@ -1,16 +1,20 @@
 #include "image.h"
+#include "imageprobe.h"
+#include "resampler.h"
+#include "xxhash64.h"
 
 DISABLE_COMPILER_WARNINGS
 #include <QDir>
 #include <QFileInfo>
 #include <QImageReader>
 #include <QCryptographicHash>
-#include <QUuid>
 #include <QFile>
 #include <QDebug>
 RESTORE_COMPILER_WARNINGS
 
+#include <algorithm>
 #include <assert.h>
+#include <vector>
 
 Image::Image() :_id(0u), _isValid(false)
 {
@@ -22,6 +26,14 @@ Image::Image( const QString& filename, ImgParams params /* = ImgParams() */) :
 	loadFromFile(filename);
 }
 
+Image::Image(const QString& filename, const ImgParams& params, qulonglong id) :
+	_filePath(filename),
+	_id(id),
+	_isValid(true),
+	_params(params)
+{
+}
+
 bool Image::isValidImage() const
 {
 	return _isValid;
@@ -30,16 +42,19 @@ bool Image::isValidImage() const
 bool Image::loadFromFile( const QString& filename )
 {
 	_filePath = filename;
-	QFileInfo info (filename);
-	_name = info.fileName();
-	_folder = info.dir().path();
 
 	if (_params != ImgParams())
 	{
 		_isValid = true;
 	}
+	else if (probeImage(filename, _params))
+	{
+		_isValid = true;
+	}
 	else
 	{
+		// The header couldn't be parsed by the probe, let the Qt image plugins have a go at it
+		const QFileInfo info (filename);
 		QImageReader reader (filename);
 		_isValid = reader.canRead();
 		if (_isValid)
@@ -66,15 +81,11 @@ bool Image::loadFromFile( const QString& filename )
 			else if (extension == "png")
 				_params._fmt = PNG;
 
-			_params._fileSize = (int)info.size();
+			_params._fileSize = info.size();
 		}
 	}
 
-	const QByteArray uniqueData = _filePath.toUtf8().append(QUuid::createUuid().toByteArray());
-	const QByteArray hash = QCryptographicHash::hash(uniqueData, QCryptographicHash::Md5);
-	assert(hash.size() == 16);
-
-	_id = *(qulonglong*)(hash.data()) ^ *(qulonglong*)(hash.data()+8);
+	_id = pathId(_filePath);
 	return _isValid;
 }
 
@@ -83,14 +94,18 @@ const QString& Image::imageFilePath() const
 	return _filePath;
 }
 
-const QString& Image::imageFileFolder() const
+QString Image::imageFileFolder() const
 {
-	return _folder;
+	QString folder, fileName;
+	splitPath(_filePath, folder, fileName);
+	return folder;
 }
 
-const QString& Image::imageFileName() const
+QString Image::imageFileName() const
 {
-	return _name;
+	QString folder, fileName;
+	splitPath(_filePath, folder, fileName);
+	return fileName;
 }
 
 QImage Image::constructQImageObject() const
@@ -104,6 +119,32 @@ QImage Image::constructQImageObject() const
 	return qImg;
 }
 
+QImage Image::constructQImageObject(const QSize& targetSize, int numThreads /* = 0 */) const
+{
+	if (!_isValid)
+		return QImage();
+
+	QImageReader reader(_filePath);
+	const QSize fullSize = _params._width > 0 && _params._height > 0 ? QSize(_params._width, _params._height) : reader.size();
+	if (!fullSize.isValid() || targetSize.isEmpty() || (fullSize.width() <= targetSize.width() && fullSize.height() <= targetSize.height()))
+		return reader.read();
+
+	const QSize scaledSize = fullSize.scaled(targetSize, Qt::KeepAspectRatio);
+	if (_params._fmt == JPG)
+	{
+		// The largest 1/2, 1/4 or 1/8 reduction that is still no smaller than needed; libjpeg produces exactly that size, so Qt doesn't rescale it afterwards
+		int denominator = 1;
+		while (denominator < 8 && fullSize.width() / (denominator * 2) >= scaledSize.width() && fullSize.height() / (denominator * 2) >= scaledSize.height())
+			denominator *= 2;
+
+		if (denominator > 1)
+			reader.setScaledSize(QSize((fullSize.width() + denominator - 1) / denominator, (fullSize.height() + denominator - 1) / denominator));
+	}
+
+	const QImage decoded = reader.read();
+	return decoded.size() == scaledSize ? decoded : resampleImage(decoded, scaledSize, numThreads);
+}
+
 const ImgParams& Image::params() const
 {
 	return _params;
@@ -114,18 +155,74 @@ WPOPTIONS Image::stretchMode () const
 	return _params._wpDisplayMode;
 }
 
-void Image::setStretchMode( WPOPTIONS mode ) const
+qulonglong Image::id() const
 {
-	_params._wpDisplayMode = mode;
+	return _id;
 }
 
-qulonglong Image::id() const
+void Image::setId(qulonglong id)
 {
-	return _id;
+	_id = id;
+}
+
+// FNV-1a over the UTF-16 code units of the normalized path, followed by the splitmix64 finalizer to spread the bits
+qulonglong Image::pathId(const QString& path, quint32 collisionIndex /* = 0 */)
+{
+#ifdef _WIN32
+	const QString normalizedPath = QDir::cleanPath(QDir::fromNativeSeparators(path)).toLower();
+#else
+	const QString normalizedPath = QDir::cleanPath(path);
+#endif
+
+	quint64 hash = 14695981039346656037ULL;
+	const ushort* characters = normalizedPath.utf16();
+	for (int i = 0, length = normalizedPath.length(); i < length; ++i)
+	{
+		hash ^= characters[i];
+		hash *= 1099511628211ULL;
+	}
+
+	hash ^= collisionIndex * 0x9E3779B97F4A7C15ULL;
+
+	hash ^= hash >> 30;
+	hash *= 0xBF58476D1CE4E5B9ULL;
+	hash ^= hash >> 27;
+	hash *= 0x94D049BB133111EBULL;
+	hash ^= hash >> 31;
+
+	// 0 is the ID of a null Image, all ones is reserved for 'invalid ID'
+	return (hash == 0 || hash == ~0ULL) ? 1 : hash;
+}
+
+void Image::splitPath(const QString& path, QString& folder, QString& fileName)
+{
+	const int separatorIndex = std::max(path.lastIndexOf('/'), path.lastIndexOf('\\'));
+	if (separatorIndex < 0)
+	{
+		folder = QString(".");
+		fileName = path;
+		return;
+	}
+
+	fileName = path.mid(separatorIndex + 1);
+	// The separator is kept for the root folder ("/", "C:/")
+	folder = path.left(separatorIndex == 0 || path.at(separatorIndex - 1) == ':' ? separatorIndex + 1 : separatorIndex);
+}
+
+QString Image::joinPath(const QString& folder, const QString& fileName)
+{
+	if (folder == ".")
+		return fileName;
+	else if (folder.endsWith('/') || folder.endsWith('\\'))
+		return folder + fileName;
+	else
+		return folder + '/' + fileName;
 }
 
-qulonglong Image::contentsHash() const
+qulonglong Image::contentsHash(HASHALGORITHM algorithm /* = HASH_XXH64 */) const
 {
+	static const qint64 chunkSize = 256 * 1024;
+
 	QFile imageFile(_filePath);
 	if (!imageFile.exists())
 		return 0;
@@ -136,8 +233,32 @@ qulonglong Image::contentsHash() const
 		return 0;
 	}
 
-	const QByteArray hash(QCryptographicHash::hash(imageFile.readAll(), QCryptographicHash::Md5));
-	assert(hash.size() == 16);
+	QCryptographicHash md5(QCryptographicHash::Md5);
+	XxHash64 xxHash;
 
-	return *(qulonglong*)(hash.data()) ^ *(qulonglong*)(hash.data()+8);
+	std::vector<char> buffer((size_t)chunkSize);
+	qint64 bytesRead = 0;
+	while ((bytesRead = imageFile.read(buffer.data(), chunkSize)) > 0)
+	{
+		if (algorithm == HASH_MD5)
+			md5.addData(buffer.data(), (int)bytesRead);
+		else
+			xxHash.update(buffer.data(), (size_t)bytesRead);
+	}
+
+	if (bytesRead < 0)
+	{
+		qDebug() << "Error reading file" << _filePath << ":" << imageFile.errorString();
+		return 0;
+	}
+
+	if (algorithm == HASH_MD5)
+	{
+		const QByteArray hash(md5.result());
+		assert(hash.size() == 16);
+
+		return *(qulonglong*)(hash.data()) ^ *(qulonglong*)(hash.data()+8);
+	}
+	else
+		return xxHash.digest();
 }
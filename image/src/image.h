@@ -11,19 +11,26 @@ RESTORE_COMPILER_WARNINGS
 class QWidget;
 
 enum IMGFORMAT {JPG, BMP, PNG, GIF, TIFF, XBM, XPM, UNKN};
-enum WPOPTIONS {CENTERED, STRETCHED, SYSTEM_DEFAULT};
+// The values are stored in list files, new modes go to the end
+enum WPOPTIONS {CENTERED, STRETCHED, SYSTEM_DEFAULT, FILL, FIT, TILE};
+enum HASHALGORITHM {HASH_XXH64, HASH_MD5};
 struct ImgParams
 {
-	ImgParams () : _width (0), _height(0), _fileSize(0), _fmt(UNKN), _wpDisplayMode(STRETCHED) {}
-	bool operator== (const ImgParams& other) const { return _width == other._width && _height == other._height && _fileSize == other._fileSize && _fmt == other._fmt && _wpDisplayMode == other._wpDisplayMode; }
+	ImgParams () : _width (0), _height(0), _fileSize(0), _fmt(UNKN), _wpDisplayMode(STRETCHED), _modificationTime(0), _inode(0), _device(0) {}
+	bool operator== (const ImgParams& other) const { return _width == other._width && _height == other._height && _fileSize == other._fileSize && _fmt == other._fmt && _wpDisplayMode == other._wpDisplayMode && _modificationTime == other._modificationTime && _inode == other._inode && _device == other._device; }
 	bool operator!= (const ImgParams& other) const { return !operator==(other); }
 	int _width, _height;
-	int _fileSize;
+	qint64 _fileSize;
 	IMGFORMAT _fmt;
 	WPOPTIONS _wpDisplayMode;
+	// Together with the file size, tell whether the file has changed since it was probed. Seconds since the epoch; 0 if unknown (and for the inode where the platform has none)
+	qint64 _modificationTime;
+	quint64 _inode;
+	// The file system the inode belongs to, see deviceId() in filestats.h; 0 if unknown
+	quint32 _device;
 } ;
 
-//Class for Image object
+//Class for Image object. A standalone value; list entries are stored by ImageList column-wise and materialized as Image on access
 class Image
 {
 public:
@@ -31,6 +38,8 @@ public:
 
 	//Creates Image object for the specified image file
 	Image(const QString& filename, ImgParams params = ImgParams());
+	//Creates Image object from already known properties, without accessing the file
+	Image(const QString& filename, const ImgParams& params, qulonglong id);
 
 	bool isValidImage () const;
 
@@ -39,25 +48,35 @@ public:
 
 	//
 	const QString& imageFilePath () const;
-	const QString& imageFileFolder () const;
-	const QString& imageFileName () const;
+	QString imageFileFolder () const;
+	QString imageFileName () const;
 	QImage constructQImageObject () const;
+	// Decodes the image at the size that fits into targetSize, keeping the aspect ratio.
+	// JPEG is first reduced by the decoder in the DCT domain, which is much cheaper than decoding at full size; the rest is done by resampleImage.
+	// numThreads goes to resampleImage; callers that decode many images in parallel pass 1, the threads are taken already.
+	QImage constructQImageObject (const QSize& targetSize, int numThreads = 0) const;
 	const ImgParams& params() const;
 
 	//
 	WPOPTIONS stretchMode () const;
-	void setStretchMode (WPOPTIONS mode) const;
 
+	// Deterministic ID derived from the file path, stable across list reloads (unless reassigned with setId to resolve a collision)
 	qulonglong id() const;
+	void setId(qulonglong id);
 
-	// Careful, expensive operation
-	qulonglong contentsHash() const;
+	// Hash of the normalized path; collisionIndex > 0 yields alternative IDs for the same path
+	static qulonglong pathId(const QString& path, quint32 collisionIndex = 0);
+
+	// Splits the path into the folder (as QFileInfo::path() would return it) and the file name; joinPath is the inverse
+	static void splitPath(const QString& path, QString& folder, QString& fileName);
+	static QString joinPath(const QString& folder, const QString& fileName);
+
+	// Careful, expensive operation. The file is streamed through a fixed-size buffer, memory use doesn't depend on the file size
+	qulonglong contentsHash(HASHALGORITHM algorithm = HASH_XXH64) const;
 
 private:
 	//The name of file this Image object is associated with
 	QString _filePath;
-	QString _name;
-	QString _folder;
 
 	qulonglong _id;
 
@@ -65,8 +84,7 @@ private:
 	bool _isValid;
 
 	//Properties of the image
-	mutable ImgParams _params;
-
+	ImgParams _params;
 };
 
 #endif // IMAGE_H
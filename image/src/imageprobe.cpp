@@ -0,0 +1,314 @@
+#include "imageprobe.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QFile>
+#include <QImageReader>
+RESTORE_COMPILER_WARNINGS
+
+#include <stdlib.h>
+#include <string.h>
+
+// Enough for the header of every supported format; JPEG segments that don't fit are reached by re-reading the window at a new offset
+static const size_t headerWindowSize = 4096;
+
+namespace {
+
+// Reads the file through a small window, going back to the disk (seek + read) only when the requested bytes fall outside of it
+class HeaderWindow
+{
+public:
+	explicit HeaderWindow(std::vector<uchar>& buffer) : _buffer(buffer), _fileSize(0), _windowOffset(0), _windowLength(0) {}
+
+	bool open(const QString& path)
+	{
+		_file.close();
+		_file.setFileName(path);
+		if (!_file.open(QIODevice::ReadOnly))
+			return false;
+
+		_fileSize = _file.size();
+		return load(0);
+	}
+
+	qint64 fileSize() const
+	{
+		return _fileSize;
+	}
+
+	// Returns the pointer to 'length' bytes starting at 'offset', or nullptr if they are past the end of file
+	const uchar* at(qint64 offset, qint64 length)
+	{
+		if (offset < 0 || length > (qint64)_buffer.size() || offset + length > _fileSize)
+			return nullptr;
+
+		if (offset < _windowOffset || offset + length > _windowOffset + _windowLength)
+		{
+			if (!load(offset) || length > _windowLength)
+				return nullptr;
+		}
+
+		return _buffer.data() + (offset - _windowOffset);
+	}
+
+private:
+	bool load(qint64 offset)
+	{
+		if (!_file.seek(offset))
+			return false;
+
+		const qint64 bytesRead = _file.read((char*)_buffer.data(), (qint64)_buffer.size());
+		if (bytesRead < 0)
+			return false;
+
+		_windowOffset = offset;
+		_windowLength = bytesRead;
+		return true;
+	}
+
+private:
+	QFile _file;
+	std::vector<uchar>& _buffer;
+	qint64 _fileSize;
+	qint64 _windowOffset;
+	qint64 _windowLength;
+};
+
+inline quint32 be16(const uchar* p) { return (quint32(p[0]) << 8) | p[1]; }
+inline quint32 be32(const uchar* p) { return (quint32(p[0]) << 24) | (quint32(p[1]) << 16) | (quint32(p[2]) << 8) | p[3]; }
+inline quint32 le16(const uchar* p) { return (quint32(p[1]) << 8) | p[0]; }
+inline quint32 le32(const uchar* p) { return (quint32(p[3]) << 24) | (quint32(p[2]) << 16) | (quint32(p[1]) << 8) | p[0]; }
+
+// Walks the marker segments up to the first SOFn
+bool probeJpeg(HeaderWindow& file, int& width, int& height)
+{
+	qint64 offset = 2; // Past SOI
+	for (;;)
+	{
+		const uchar* marker = file.at(offset, 2);
+		if (!marker || marker[0] != 0xFF)
+			return false;
+
+		const uchar code = marker[1];
+		if (code == 0xFF) // Fill byte
+		{
+			++offset;
+			continue;
+		}
+
+		// Standalone markers have no length field
+		if (code == 0x01 || code == 0xD8 || (code >= 0xD0 && code <= 0xD7))
+		{
+			offset += 2;
+			continue;
+		}
+
+		// EOI or start of scan before any frame header - broken file
+		if (code == 0xD9 || code == 0xDA)
+			return false;
+
+		const uchar* lengthField = file.at(offset + 2, 2);
+		if (!lengthField)
+			return false;
+
+		const quint32 segmentLength = be16(lengthField);
+		if (segmentLength < 2)
+			return false;
+
+		// SOF0..SOF15, except for DHT, JPG and DAC which share the range
+		if (code >= 0xC0 && code <= 0xCF && code != 0xC4 && code != 0xC8 && code != 0xCC)
+		{
+			const uchar* frameHeader = file.at(offset + 4, 5); // Precision, height, width
+			if (!frameHeader)
+				return false;
+
+			height = (int)be16(frameHeader + 1);
+			width = (int)be16(frameHeader + 3);
+			return width > 0 && height > 0; // Zero height means it's defined by a DNL segment, let Qt deal with that
+		}
+
+		offset += 2 + segmentLength;
+	}
+}
+
+bool probePng(HeaderWindow& file, int& width, int& height)
+{
+	const uchar* header = file.at(0, 24);
+	if (!header || memcmp(header + 12, "IHDR", 4) != 0)
+		return false;
+
+	width = (int)be32(header + 16);
+	height = (int)be32(header + 20);
+	return width > 0 && height > 0;
+}
+
+bool probeGif(HeaderWindow& file, int& width, int& height)
+{
+	const uchar* header = file.at(0, 10);
+	if (!header)
+		return false;
+
+	width = (int)le16(header + 6);
+	height = (int)le16(header + 8);
+	return width > 0 && height > 0;
+}
+
+bool probeBmp(HeaderWindow& file, int& width, int& height)
+{
+	const uchar* header = file.at(0, 26);
+	if (!header)
+		return false;
+
+	const quint32 dibHeaderSize = le32(header + 14);
+	if (dibHeaderSize == 12) // BITMAPCOREHEADER
+	{
+		width = (int)le16(header + 18);
+		height = (int)le16(header + 20);
+	}
+	else if (dibHeaderSize >= 40) // BITMAPINFOHEADER and its descendants
+	{
+		width = (qint32)le32(header + 18);
+		height = abs((qint32)le32(header + 22)); // Negative height denotes a top-down bitmap
+	}
+	else
+		return false;
+
+	return width > 0 && height > 0;
+}
+
+// Looks up ImageWidth and ImageLength in the first IFD
+bool probeTiff(HeaderWindow& file, int& width, int& height)
+{
+	const uchar* header = file.at(0, 8);
+	if (!header)
+		return false;
+
+	const bool littleEndian = header[0] == 'I';
+	quint32 (*u16)(const uchar*) = littleEndian ? le16 : be16;
+	quint32 (*u32)(const uchar*) = littleEndian ? le32 : be32;
+
+	const qint64 ifdOffset = u32(header + 4);
+	const uchar* entryCountField = file.at(ifdOffset, 2);
+	if (!entryCountField)
+		return false;
+
+	width = 0;
+	height = 0;
+	const quint32 numEntries = u16(entryCountField);
+	for (quint32 i = 0; i < numEntries && (width == 0 || height == 0); ++i)
+	{
+		const uchar* entry = file.at(ifdOffset + 2 + 12 * (qint64)i, 12);
+		if (!entry)
+			return false;
+
+		const quint32 tag = u16(entry), type = u16(entry + 2);
+		if (tag != 256 && tag != 257)
+			continue;
+
+		quint32 value = 0;
+		if (type == 3) // SHORT
+			value = u16(entry + 8);
+		else if (type == 4) // LONG
+			value = u32(entry + 8);
+		else
+			return false;
+
+		(tag == 256 ? width : height) = (int)value;
+	}
+
+	return width > 0 && height > 0;
+}
+
+// A header that parses is no good if the image can't be loaded later: TIFF, for one, needs a plugin that isn't always deployed
+bool canBeDecoded(IMGFORMAT format)
+{
+	static const QList<QByteArray> decodableFormats = QImageReader::supportedImageFormats();
+	switch (format)
+	{
+	case JPG:
+		return decodableFormats.contains("jpeg") || decodableFormats.contains("jpg");
+	case PNG:
+		return decodableFormats.contains("png");
+	case GIF:
+		return decodableFormats.contains("gif");
+	case BMP:
+		return decodableFormats.contains("bmp");
+	case TIFF:
+		return decodableFormats.contains("tiff") || decodableFormats.contains("tif");
+	default:
+		return false;
+	}
+}
+
+bool probeImage(HeaderWindow& file, const QString& filePath, ImgParams& params)
+{
+	if (!file.open(filePath))
+		return false;
+
+	static const uchar pngSignature[8] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+
+	const uchar* magic = file.at(0, 8);
+	if (!magic)
+		return false;
+
+	IMGFORMAT format = UNKN;
+	int width = 0, height = 0;
+	bool succeeded = false;
+	if (magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF)
+	{
+		format = JPG;
+		succeeded = probeJpeg(file, width, height);
+	}
+	else if (memcmp(magic, pngSignature, sizeof(pngSignature)) == 0)
+	{
+		format = PNG;
+		succeeded = probePng(file, width, height);
+	}
+	else if (memcmp(magic, "GIF87a", 6) == 0 || memcmp(magic, "GIF89a", 6) == 0)
+	{
+		format = GIF;
+		succeeded = probeGif(file, width, height);
+	}
+	else if (magic[0] == 'B' && magic[1] == 'M')
+	{
+		format = BMP;
+		succeeded = probeBmp(file, width, height);
+	}
+	else if (memcmp(magic, "II*\0", 4) == 0 || memcmp(magic, "MM\0*", 4) == 0)
+	{
+		format = TIFF;
+		succeeded = probeTiff(file, width, height);
+	}
+
+	if (!succeeded || !canBeDecoded(format))
+		return false;
+
+	params._width = width;
+	params._height = height;
+	params._fmt = format;
+	params._fileSize = file.fileSize();
+	return true;
+}
+
+}
+
+bool probeImage(const QString& filePath, ImgParams& params)
+{
+	std::vector<uchar> buffer(headerWindowSize);
+	HeaderWindow file(buffer);
+	return probeImage(file, filePath, params);
+}
+
+std::vector<ImgParams> probeImages(const QStringList& filePaths)
+{
+	std::vector<uchar> buffer(headerWindowSize);
+	HeaderWindow file(buffer);
+
+	std::vector<ImgParams> result(filePaths.size());
+	for (int i = 0; i < filePaths.size(); ++i)
+	{
+		if (!probeImage(file, filePaths[i], result[i]))
+			result[i] = ImgParams();
+	}
+
+	return result;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "image.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QString>
+#include <QStringList>
+RESTORE_COMPILER_WARNINGS
+
+#include <vector>
+
+// Lightweight image header probe. Detects the format by its magic bytes and reads the dimensions straight from the header
+// (JPEG SOFn, PNG IHDR, GIF logical screen descriptor, BMP DIB header, TIFF IFD) without going through the Qt image plugins.
+// Only a small window at the start of the file is read; JPEG segments are skipped by seeking.
+
+// Fills the format, dimensions and file size of params. Returns false (params untouched) if the file couldn't be probed,
+// or if it's of a format none of the Qt image plugins can decode - use QImageReader then.
+bool probeImage(const QString& filePath, ImgParams& params);
+
+// Batch version, reuses one header buffer for all the files. Files that couldn't be probed get default ImgParams (with _fmt == UNKN).
+std::vector<ImgParams> probeImages(const QStringList& filePaths);
@@ -0,0 +1,44 @@
+#include "perceptualhash.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QImageReader>
+RESTORE_COMPILER_WARNINGS
+
+// The image is decoded at cellSize times the grid resolution, each cell is then averaged down to a single value
+static const int gridWidth = 9, gridHeight = 8, cellSize = 4;
+static const int sampleWidth = gridWidth * cellSize, sampleHeight = gridHeight * cellSize;
+
+quint64 perceptualHash(const QString& filePath)
+{
+	QImageReader reader(filePath);
+	// Lets the JPEG decoder skip most of the work by scaling in the DCT domain; aspect ratio is irrelevant for the hash
+	reader.setScaledSize(QSize(sampleWidth, sampleHeight));
+	const QImage image = reader.read();
+	return image.isNull() ? 0 : perceptualHash(image);
+}
+
+quint64 perceptualHash(const QImage& image)
+{
+	if (image.isNull())
+		return 0;
+
+	const QImage sample = (image.width() == sampleWidth && image.height() == sampleHeight ? image : image.scaled(sampleWidth, sampleHeight, Qt::IgnoreAspectRatio, Qt::SmoothTransformation))
+		.convertToFormat(QImage::Format_RGB32);
+
+	// Luminance, summed over each cell (Rec. 601 weights in 8-bit fixed point)
+	unsigned int cells[gridHeight][gridWidth] = {{0}};
+	for (int y = 0; y < sampleHeight; ++y)
+	{
+		const QRgb* line = (const QRgb*)sample.constScanLine(y);
+		unsigned int* cellRow = cells[y / cellSize];
+		for (int x = 0; x < sampleWidth; ++x)
+			cellRow[x / cellSize] += 77 * qRed(line[x]) + 150 * qGreen(line[x]) + 29 * qBlue(line[x]);
+	}
+
+	quint64 hash = 0;
+	for (int y = 0; y < gridHeight; ++y)
+		for (int x = 0; x < gridWidth - 1; ++x)
+			hash = (hash << 1) | (cells[y][x] > cells[y][x + 1] ? 1u : 0u);
+
+	return hash;
+}
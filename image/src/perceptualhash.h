@@ -0,0 +1,22 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QImage>
+#include <QString>
+RESTORE_COMPILER_WARNINGS
+
+#include <bitset>
+
+// 64-bit difference hash (dHash): the image is reduced to a 9x8 luminance grid, each bit tells whether a cell is brighter than its right neighbour.
+// Survives rescaling and re-encoding, so the same picture at different resolutions / JPEG quality lands within a few bits.
+
+// Decodes the file at a reduced resolution and hashes it. Returns 0 if the file couldn't be read (a completely flat image hashes to 0 as well).
+quint64 perceptualHash(const QString& filePath);
+quint64 perceptualHash(const QImage& image);
+
+inline int hammingDistance(quint64 a, quint64 b)
+{
+	return (int)std::bitset<64>(a ^ b).count();
+}
@@ -0,0 +1,316 @@
+#include "resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+// RESAMPLER_NO_SSE2 leaves only the scalar code, which the SSE2 kernels are tested against
+#if !defined RESAMPLER_NO_SSE2 && (defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2))
+#define RESAMPLER_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+enum Filter {AreaFilter, Lanczos3Filter};
+
+const int weightPrecisionBits = 14;
+const int weightOne = 1 << weightPrecisionBits;
+// Smaller bands aren't worth a thread
+const int minRowsPerBand = 32;
+const double pi = 3.14159265358979323846;
+
+// For every output pixel along one axis: the first source pixel that contributes to it and the weights of 'taps' consecutive source pixels from there on.
+// The number of taps is the same for all the output pixels, which keeps the inner loops free of per-pixel bounds.
+struct Contributions
+{
+	int taps;
+	std::vector<int> starts;
+	std::vector<qint16> weights;
+};
+
+double lanczos3(double x)
+{
+	x = std::fabs(x);
+	if (x < 1e-8)
+		return 1.0;
+	else if (x >= 3.0)
+		return 0.0;
+
+	return 3.0 * std::sin(pi * x) * std::sin(pi * x / 3.0) / (pi * pi * x * x);
+}
+
+Contributions computeContributions(int srcSize, int dstSize, Filter filter)
+{
+	const double scale = (double)srcSize / dstSize;
+	const double filterScale = std::max(scale, 1.0);
+	const double support = (filter == AreaFilter ? 0.5 : 3.0) * filterScale;
+
+	Contributions contributions;
+	contributions.taps = std::min(srcSize, (int)std::ceil(2.0 * support) + 2);
+	contributions.starts.resize((size_t)dstSize);
+	contributions.weights.resize((size_t)dstSize * contributions.taps, 0);
+
+	std::vector<double> weights;
+	for (int i = 0; i < dstSize; ++i)
+	{
+		const double center = (i + 0.5) * scale;
+		const int first = std::max(0, (int)std::floor(center - support));
+		const int last = std::min(srcSize - 1, (int)std::ceil(center + support));
+
+		weights.assign((size_t)(last - first + 1), 0.0);
+		double sum = 0.0;
+		for (int j = first; j <= last; ++j)
+		{
+			double w;
+			if (filter == AreaFilter) // The share of the source pixel covered by the output pixel
+				w = std::max(0.0, std::min(j + 1.0, center + support) - std::max((double)j, center - support));
+			else
+				w = lanczos3((j + 0.5 - center) / filterScale);
+
+			weights[j - first] = w;
+			sum += w;
+		}
+
+		// The window is shifted back near the end so that it never reaches past the last source pixel
+		const int start = std::min(first, srcSize - contributions.taps);
+		contributions.starts[i] = start;
+
+		qint16* fixedWeights = contributions.weights.data() + (size_t)i * contributions.taps;
+		int fixedSum = 0, largest = first - start;
+		for (int j = first; j <= last && j - start < contributions.taps; ++j)
+		{
+			fixedWeights[j - start] = (qint16)std::lround(weights[j - first] / sum * weightOne);
+			fixedSum += fixedWeights[j - start];
+			if (fixedWeights[j - start] > fixedWeights[largest])
+				largest = j - start;
+		}
+
+		// Rounding errors go to the largest weight so that a flat area stays exactly flat
+		fixedWeights[largest] = (qint16)(fixedWeights[largest] + weightOne - fixedSum);
+	}
+
+	return contributions;
+}
+
+inline uchar clampToByte(int value)
+{
+	value = (value + (1 << (weightPrecisionBits - 1))) >> weightPrecisionBits;
+	return (uchar)(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+#ifdef RESAMPLER_SSE2
+// Two 16-bit weights in each 32-bit lane, the way _mm_madd_epi16 pairs them with interleaved pixel channels
+inline __m128i weightPair(qint16 first, qint16 second)
+{
+	return _mm_set1_epi32((int)((quint32)(quint16)first | ((quint32)(quint16)second << 16)));
+}
+
+inline __m128i roundAndShift(__m128i sum)
+{
+	return _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(1 << (weightPrecisionBits - 1))), weightPrecisionBits);
+}
+#endif
+
+void resampleRowsHorizontally(const uchar* src, int srcStride, uchar* dst, int dstStride, int dstWidth, const Contributions& contributions, int firstRow, int lastRow)
+{
+	const int taps = contributions.taps;
+	for (int y = firstRow; y < lastRow; ++y)
+	{
+		const quint32* srcRow = (const quint32*)(src + (size_t)y * srcStride);
+		quint32* dstRow = (quint32*)(dst + (size_t)y * dstStride);
+
+		for (int x = 0; x < dstWidth; ++x)
+		{
+			const quint32* pixels = srcRow + contributions.starts[x];
+			const qint16* weights = contributions.weights.data() + (size_t)x * taps;
+
+#ifdef RESAMPLER_SSE2
+			const __m128i zero = _mm_setzero_si128();
+			__m128i sum = zero;
+			int t = 0;
+			for (; t + 1 < taps; t += 2)
+			{
+				// Two pixels widened to 16 bits, then interleaved channel by channel: b0 b1 g0 g1 r0 r1 a0 a1
+				const __m128i pair = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pixels + t)), zero);
+				sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi16(pair, _mm_srli_si128(pair, 8)), weightPair(weights[t], weights[t + 1])));
+			}
+
+			if (t < taps)
+			{
+				const __m128i single = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)pixels[t]), zero);
+				sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi16(single, zero), weightPair(weights[t], 0)));
+			}
+
+			const __m128i packed = _mm_packs_epi32(roundAndShift(sum), zero);
+			dstRow[x] = (quint32)_mm_cvtsi128_si32(_mm_packus_epi16(packed, packed));
+#else
+			int sum[4] = {0, 0, 0, 0};
+			for (int t = 0; t < taps; ++t)
+			{
+				const uchar* channels = (const uchar*)(pixels + t);
+				for (int c = 0; c < 4; ++c)
+					sum[c] += channels[c] * weights[t];
+			}
+
+			uchar* out = (uchar*)(dstRow + x);
+			for (int c = 0; c < 4; ++c)
+				out[c] = clampToByte(sum[c]);
+#endif
+		}
+	}
+}
+
+void resampleRowsVertically(const uchar* src, int srcStride, uchar* dst, int dstStride, int width, const Contributions& contributions, int firstRow, int lastRow)
+{
+	const int taps = contributions.taps;
+	for (int y = firstRow; y < lastRow; ++y)
+	{
+		const uchar* srcRows = src + (size_t)contributions.starts[y] * srcStride;
+		const qint16* weights = contributions.weights.data() + (size_t)y * taps;
+		uchar* dstRow = dst + (size_t)y * dstStride;
+
+		int x = 0;
+#ifdef RESAMPLER_SSE2
+		// 4 pixels at a time; each pair of rows is interleaved channel by channel and multiplied by a pair of weights
+		const __m128i zero = _mm_setzero_si128();
+		for (; x + 4 <= width; x += 4)
+		{
+			__m128i sum0 = zero, sum1 = zero, sum2 = zero, sum3 = zero;
+			for (int t = 0; t < taps; t += 2)
+			{
+				const __m128i a = _mm_loadu_si128((const __m128i*)(srcRows + (size_t)t * srcStride + x * 4));
+				const __m128i b = t + 1 < taps ? _mm_loadu_si128((const __m128i*)(srcRows + (size_t)(t + 1) * srcStride + x * 4)) : zero;
+				const __m128i w = weightPair(weights[t], t + 1 < taps ? weights[t + 1] : 0);
+
+				const __m128i aLow = _mm_unpacklo_epi8(a, zero), aHigh = _mm_unpackhi_epi8(a, zero);
+				const __m128i bLow = _mm_unpacklo_epi8(b, zero), bHigh = _mm_unpackhi_epi8(b, zero);
+				sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_unpacklo_epi16(aLow, bLow), w));
+				sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_unpackhi_epi16(aLow, bLow), w));
+				sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_unpacklo_epi16(aHigh, bHigh), w));
+				sum3 = _mm_add_epi32(sum3, _mm_madd_epi16(_mm_unpackhi_epi16(aHigh, bHigh), w));
+			}
+
+			const __m128i low = _mm_packs_epi32(roundAndShift(sum0), roundAndShift(sum1));
+			const __m128i high = _mm_packs_epi32(roundAndShift(sum2), roundAndShift(sum3));
+			_mm_storeu_si128((__m128i*)(dstRow + x * 4), _mm_packus_epi16(low, high));
+		}
+#endif
+
+		for (; x < width; ++x)
+		{
+			int sum[4] = {0, 0, 0, 0};
+			for (int t = 0; t < taps; ++t)
+			{
+				const uchar* channels = srcRows + (size_t)t * srcStride + x * 4;
+				for (int c = 0; c < 4; ++c)
+					sum[c] += channels[c] * weights[t];
+			}
+
+			for (int c = 0; c < 4; ++c)
+				dstRow[x * 4 + c] = clampToByte(sum[c]);
+		}
+	}
+}
+
+// Negative Lanczos lobes can push a color channel above the alpha, which is not a valid premultiplied pixel
+void clampPremultiplied(QImage& image)
+{
+	for (int y = 0; y < image.height(); ++y)
+	{
+		quint32* row = (quint32*)image.scanLine(y);
+		for (int x = 0; x < image.width(); ++x)
+		{
+			const quint32 alpha = row[x] >> 24;
+			const quint32 r = std::min((row[x] >> 16) & 0xFF, alpha), g = std::min((row[x] >> 8) & 0xFF, alpha), b = std::min(row[x] & 0xFF, alpha);
+			row[x] = (alpha << 24) | (r << 16) | (g << 8) | b;
+		}
+	}
+}
+
+template <typename Function>
+void forEachRowBand(int numRows, int numThreads, Function processRows)
+{
+	const int numBands = std::max(1, std::min(numThreads, numRows / minRowsPerBand));
+	if (numBands == 1)
+	{
+		processRows(0, numRows);
+		return;
+	}
+
+	std::vector<std::thread> threads;
+	for (int band = 1; band < numBands; ++band)
+		threads.emplace_back(processRows, (int)((qint64)numRows * band / numBands), (int)((qint64)numRows * (band + 1) / numBands));
+
+	processRows(0, numRows / numBands);
+	for (std::thread& thread: threads)
+		thread.join();
+}
+
+QImage resample(const QImage& source, const QSize& targetSize, Filter filter, int numThreads)
+{
+	QImage current = source;
+
+	if (targetSize.width() != current.width())
+	{
+		const Contributions contributions = computeContributions(current.width(), targetSize.width(), filter);
+		QImage horizontal(targetSize.width(), current.height(), current.format());
+
+		const uchar* src = current.constBits();
+		uchar* dst = horizontal.bits();
+		const int srcStride = current.bytesPerLine(), dstStride = horizontal.bytesPerLine();
+		forEachRowBand(current.height(), numThreads, [&](int firstRow, int lastRow) {
+			resampleRowsHorizontally(src, srcStride, dst, dstStride, targetSize.width(), contributions, firstRow, lastRow);
+		});
+
+		current = horizontal;
+	}
+
+	if (targetSize.height() != current.height())
+	{
+		const Contributions contributions = computeContributions(current.height(), targetSize.height(), filter);
+		QImage vertical(targetSize, current.format());
+
+		const uchar* src = current.constBits();
+		uchar* dst = vertical.bits();
+		const int srcStride = current.bytesPerLine(), dstStride = vertical.bytesPerLine();
+		forEachRowBand(targetSize.height(), numThreads, [&](int firstRow, int lastRow) {
+			resampleRowsVertically(src, srcStride, dst, dstStride, targetSize.width(), contributions, firstRow, lastRow);
+		});
+
+		current = vertical;
+	}
+
+	return current;
+}
+
+}
+
+QImage resampleImage(const QImage& source, const QSize& targetSize, int numThreads /* = 0 */)
+{
+	if (source.isNull() || targetSize.isEmpty())
+		return QImage();
+
+	if (numThreads <= 0)
+		numThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+
+	const bool premultiplied = source.hasAlphaChannel();
+	QImage result = source.convertToFormat(premultiplied ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+
+	// The number of taps grows with the reduction ratio, six times faster for Lanczos than for the area filter, so the bulk of a big reduction is done by averaging areas
+	const QSize areaTarget(
+		result.width() > 3 * targetSize.width() ? 2 * targetSize.width() : result.width(),
+		result.height() > 3 * targetSize.height() ? 2 * targetSize.height() : result.height());
+	if (areaTarget != result.size())
+		result = resample(result, areaTarget, AreaFilter, numThreads);
+
+	if (targetSize != result.size())
+	{
+		result = resample(result, targetSize, Lanczos3Filter, numThreads);
+		if (premultiplied)
+			clampPremultiplied(result);
+	}
+
+	return result;
+}
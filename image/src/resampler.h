@@ -0,0 +1,15 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QImage>
+#include <QSize>
+RESTORE_COMPILER_WARNINGS
+
+// High quality image scaling, meant as a faster replacement for QImage::scaled(..., Qt::SmoothTransformation) on big downscale ratios.
+// Large reductions first go through an exact area (box) filter down to twice the target size, the final stage is a separable Lanczos3 filter.
+// Both stages use 14-bit fixed point weights, with an SSE2 kernel where available and a scalar fallback otherwise.
+// Each pass is split into row bands processed in parallel by numThreads threads (0 means one per CPU core).
+// The result is in RGB32, or in ARGB32_Premultiplied if the source has an alpha channel.
+QImage resampleImage(const QImage& source, const QSize& targetSize, int numThreads = 0);
@@ -0,0 +1,40 @@
+#include "wallpaperrenderer.h"
+#include "resampler.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QPainter>
+RESTORE_COMPILER_WARNINGS
+
+QImage renderWallpaper(const QImage& source, const QSize& screenSize, WPOPTIONS mode)
+{
+	if (source.isNull() || screenSize.isEmpty() || mode == SYSTEM_DEFAULT)
+		return source;
+
+	QImage canvas(screenSize, QImage::Format_RGB32);
+	canvas.fill(Qt::black);
+
+	QPainter painter(&canvas);
+	switch (mode)
+	{
+	case CENTERED:
+		painter.drawImage((screenSize.width() - source.width()) / 2, (screenSize.height() - source.height()) / 2, source);
+		break;
+	case STRETCHED: // Shown as Fit by Windows before the wallpapers were rendered, and it's what the lists have by default
+	case FILL:
+	case FIT:
+	{
+		const QImage scaled = resampleImage(source, source.size().scaled(screenSize, mode == FILL ? Qt::KeepAspectRatioByExpanding : Qt::KeepAspectRatio));
+		painter.drawImage((screenSize.width() - scaled.width()) / 2, (screenSize.height() - scaled.height()) / 2, scaled);
+		break;
+	}
+	case TILE:
+		for (int y = 0; y < screenSize.height(); y += source.height())
+			for (int x = 0; x < screenSize.width(); x += source.width())
+				painter.drawImage(x, y, source);
+		break;
+	default:
+		break;
+	}
+
+	return canvas;
+}
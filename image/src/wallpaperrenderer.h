@@ -0,0 +1,18 @@
+#pragma once
+
+#include "image.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QImage>
+#include <QSize>
+RESTORE_COMPILER_WARNINGS
+
+// Produces the exact screen-sized bitmap the desktop is going to show for the image in the given display mode, so the OS doesn't have to scale anything.
+// A pure function of its arguments (no screen, no files), which is what makes it possible to check the output against reference images headless.
+//   CENTERED  - the image at its own size in the middle of a black screen, cropped if larger than the screen
+//   STRETCHED - the same as FIT: the default mode, which the OS used to present as Fit (WallpaperStyle 6), so existing lists look the way they always have
+//   FILL      - scaled to cover the whole screen keeping the aspect ratio, the excess is cropped evenly from both sides
+//   FIT       - scaled to fit inside the screen keeping the aspect ratio, letterboxed with black
+//   TILE      - repeated at its own size starting from the top left corner
+// SYSTEM_DEFAULT leaves the presentation up to the OS and returns the source image as is.
+QImage renderWallpaper(const QImage& source, const QSize& screenSize, WPOPTIONS mode);
@@ -0,0 +1,138 @@
+#include "xxhash64.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QtEndian>
+RESTORE_COMPILER_WARNINGS
+
+#include <algorithm>
+#include <string.h>
+
+static const quint64 prime1 = 0x9E3779B185EBCA87ULL;
+static const quint64 prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const quint64 prime3 = 0x165667B19E3779F9ULL;
+static const quint64 prime4 = 0x85EBCA77C2B2AE63ULL;
+static const quint64 prime5 = 0x27D4EB2F165667C5ULL;
+
+static inline quint64 rotateLeft(quint64 value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+// The reference hash is defined over little-endian words
+static inline quint64 read64(const unsigned char* p)
+{
+	return qFromLittleEndian<quint64>(p);
+}
+
+static inline quint64 read32(const unsigned char* p)
+{
+	return qFromLittleEndian<quint32>(p);
+}
+
+static inline quint64 round(quint64 accumulator, quint64 input)
+{
+	accumulator += input * prime2;
+	accumulator = rotateLeft(accumulator, 31);
+	return accumulator * prime1;
+}
+
+static inline quint64 mergeRound(quint64 accumulator, quint64 lane)
+{
+	accumulator ^= round(0, lane);
+	return accumulator * prime1 + prime4;
+}
+
+XxHash64::XxHash64(quint64 seed)
+{
+	reset(seed);
+}
+
+void XxHash64::reset(quint64 seed)
+{
+	_seed = seed;
+	_lanes[0] = seed + prime1 + prime2;
+	_lanes[1] = seed + prime2;
+	_lanes[2] = seed;
+	_lanes[3] = seed - prime1;
+	_totalLength = 0;
+	_stripeSize = 0;
+}
+
+void XxHash64::update(const void* data, size_t length)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	const unsigned char* const end = p + length;
+	_totalLength += length;
+
+	// Complete the pending stripe first
+	if (_stripeSize > 0)
+	{
+		const size_t toCopy = std::min<size_t>(sizeof(_stripe) - _stripeSize, length);
+		memcpy(_stripe + _stripeSize, p, toCopy);
+		_stripeSize += toCopy;
+		p += toCopy;
+		if (_stripeSize < sizeof(_stripe))
+			return;
+
+		for (int lane = 0; lane < 4; ++lane)
+			_lanes[lane] = round(_lanes[lane], read64(_stripe + 8 * lane));
+		_stripeSize = 0;
+	}
+
+	// The four lanes are independent, which lets the CPU overlap the multiplications
+	quint64 v1 = _lanes[0], v2 = _lanes[1], v3 = _lanes[2], v4 = _lanes[3];
+	for (; end - p >= 32; p += 32)
+	{
+		v1 = round(v1, read64(p));
+		v2 = round(v2, read64(p + 8));
+		v3 = round(v3, read64(p + 16));
+		v4 = round(v4, read64(p + 24));
+	}
+	_lanes[0] = v1; _lanes[1] = v2; _lanes[2] = v3; _lanes[3] = v4;
+
+	memcpy(_stripe, p, (size_t)(end - p));
+	_stripeSize = (size_t)(end - p);
+}
+
+quint64 XxHash64::digest() const
+{
+	quint64 hash = 0;
+	if (_totalLength >= 32)
+	{
+		hash = rotateLeft(_lanes[0], 1) + rotateLeft(_lanes[1], 7) + rotateLeft(_lanes[2], 12) + rotateLeft(_lanes[3], 18);
+		for (int lane = 0; lane < 4; ++lane)
+			hash = mergeRound(hash, _lanes[lane]);
+	}
+	else
+		hash = _seed + prime5;
+
+	hash += _totalLength;
+
+	const unsigned char* p = _stripe;
+	const unsigned char* const end = _stripe + _stripeSize;
+	for (; end - p >= 8; p += 8)
+	{
+		hash ^= round(0, read64(p));
+		hash = rotateLeft(hash, 27) * prime1 + prime4;
+	}
+
+	if (end - p >= 4)
+	{
+		hash ^= read32(p) * prime1;
+		hash = rotateLeft(hash, 23) * prime2 + prime3;
+		p += 4;
+	}
+
+	for (; p < end; ++p)
+	{
+		hash ^= (*p) * prime5;
+		hash = rotateLeft(hash, 11) * prime1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= prime2;
+	hash ^= hash >> 29;
+	hash *= prime3;
+	hash ^= hash >> 32;
+	return hash;
+}
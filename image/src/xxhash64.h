@@ -0,0 +1,29 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QtGlobal>
+RESTORE_COMPILER_WARNINGS
+
+#include <stddef.h>
+
+// Streaming implementation of the XXH64 non-cryptographic hash (https://github.com/Cyan4973/xxHash).
+// Processes 32-byte stripes in 4 independent lanes; output matches the reference XXH64.
+class XxHash64
+{
+public:
+	explicit XxHash64(quint64 seed = 0);
+
+	void reset(quint64 seed = 0);
+	void update(const void* data, size_t length);
+	quint64 digest() const;
+
+private:
+	quint64 _lanes[4];
+	quint64 _seed;
+	quint64 _totalLength;
+	// Tail of the input that doesn't make up a full stripe yet
+	unsigned char _stripe[32];
+	size_t _stripeSize;
+};
@@ -0,0 +1,122 @@
+#include "imageimportertest.h"
+#include "filestats.h"
+#include "imageimporter.h"
+#include "testimages.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+RESTORE_COMPILER_WARNINGS
+
+#include <memory>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace {
+
+struct ImportResults : public ImageImporterListener
+{
+	ImportResults() : finished(false) {}
+
+	void imagesImported(std::vector<Image> newImages, std::vector<Image> newRenamedImages) override
+	{
+		images.insert(images.end(), newImages.begin(), newImages.end());
+		renamedImages.insert(renamedImages.end(), newRenamedImages.begin(), newRenamedImages.end());
+	}
+
+	void importProgress(size_t /*numFilesFound*/, size_t /*numFilesProcessed*/, size_t /*numFilesFailed*/, bool done) override
+	{
+		finished = done;
+	}
+
+	void knownFilesMissing(std::vector<QString> filePaths) override
+	{
+		missingFiles.insert(missingFiles.end(), filePaths.begin(), filePaths.end());
+	}
+
+	std::vector<Image>   images;
+	std::vector<Image>   renamedImages;
+	std::vector<QString> missingFiles;
+	bool                 finished;
+};
+
+// The file as the list would have it after importing it, with a display mode of its own to tell the entry's parameters from freshly probed ones
+ImageImporter::KnownFile importedFile(const QString& path)
+{
+	const Image image(path);
+	ImageImporter::KnownFile file = {path, image.params(), image.id()};
+	file.params._wpDisplayMode = TILE;
+
+	const FileStat stat = statFile(path);
+	file.params._modificationTime = stat.modificationTime;
+	file.params._inode = stat.inode;
+	file.params._device = stat.device;
+	return file;
+}
+
+// Rescans the folder the way WallpaperChanger::rescanSources does
+void rescan(const QString& folder, const ImageImporter::KnownFile& knownFile, ImportResults& results)
+{
+	ImageImporter importer;
+	importer.addSubscriber(&results);
+	importer.start(QStringList() << folder, std::make_shared<ImageImporter::KnownFiles>(1, knownFile), true);
+	QTRY_VERIFY(results.finished);
+}
+
+}
+
+void ImageImporterTest::renamedFileKeepsItsEntry()
+{
+#ifdef _WIN32
+	QSKIP("There are no inodes to recognize a renamed file by");
+#else
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+	const QString originalPath = dir.path() + "/wallpaper.png";
+	QVERIFY(testPattern(64, 48).save(originalPath));
+	const ImageImporter::KnownFile knownFile = importedFile(originalPath);
+	QVERIFY(knownFile.params._inode != 0);
+
+	QVERIFY(QDir(dir.path()).mkdir("moved"));
+	const QString newPath = dir.path() + "/moved/renamed wallpaper.png";
+	QVERIFY(QFile::rename(originalPath, newPath));
+
+	ImportResults results;
+	rescan(dir.path(), knownFile, results);
+
+	QVERIFY(results.images.empty());
+	QVERIFY(results.missingFiles.empty());
+	QCOMPARE(results.renamedImages.size(), (size_t)1);
+	QCOMPARE(results.renamedImages.front().imageFilePath(), newPath);
+	QCOMPARE(results.renamedImages.front().id(), knownFile.id);
+	QVERIFY(results.renamedImages.front().params() == knownFile.params);
+#endif
+}
+
+void ImageImporterTest::secondPathToKnownFile()
+{
+#ifdef _WIN32
+	QSKIP("There are no inodes to recognize a file under another path by");
+#else
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+	const QString path = dir.path() + "/wallpaper.png";
+	QVERIFY(testPattern(64, 48).save(path));
+	const ImageImporter::KnownFile knownFile = importedFile(path);
+
+	const QString linkPath = dir.path() + "/link to wallpaper.png";
+	QCOMPARE(::link(QFile::encodeName(path).constData(), QFile::encodeName(linkPath).constData()), 0);
+
+	ImportResults results;
+	rescan(dir.path(), knownFile, results);
+
+	// Skipped like the files of a folder reachable by more than one path
+	QVERIFY(results.images.empty());
+	QVERIFY(results.renamedImages.empty());
+	QVERIFY(results.missingFiles.empty());
+#endif
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QObject>
+RESTORE_COMPILER_WARNINGS
+
+// ImageImporter re-importing a folder whose files it has imported before
+class ImageImporterTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	// A file renamed and moved to a subfolder while nobody was watching: reported renamed, keeping its ID and parameters, rather than gone and new
+	void renamedFileKeepsItsEntry();
+	// The known file reachable under one more path (a hard link) stays where it is
+	void secondPathToKnownFile();
+};
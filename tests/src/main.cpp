@@ -0,0 +1,30 @@
+#include "imageimportertest.h"
+#include "resamplertest.h"
+#include "wallpaperrenderertest.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QCoreApplication>
+#include <QtTest>
+RESTORE_COMPILER_WARNINGS
+
+// Nothing here needs a screen: the images are rendered in memory, without a QGuiApplication. The event loop delivers the import results.
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	int failures = 0;
+	{
+		ResamplerTest test;
+		failures += QTest::qExec(&test, argc, argv);
+	}
+	{
+		WallpaperRendererTest test;
+		failures += QTest::qExec(&test, argc, argv);
+	}
+	{
+		ImageImporterTest test;
+		failures += QTest::qExec(&test, argc, argv);
+	}
+
+	return failures;
+}
@@ -0,0 +1,107 @@
+#include "resamplertest.h"
+#include "resampler.h"
+#include "scalarresampler.h"
+#include "testimages.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QtTest>
+RESTORE_COMPILER_WARNINGS
+
+void ResamplerTest::downscale()
+{
+	const QImage result = resampleImage(testPattern(300, 200), QSize(97, 61));
+	QCOMPARE(result.format(), QImage::Format_RGB32);
+
+	const QString difference = compareWithReference(result, "resampled_down.png");
+	QVERIFY2(difference.isEmpty(), qPrintable(difference));
+}
+
+void ResamplerTest::upscale()
+{
+	const QString difference = compareWithReference(resampleImage(testPattern(40, 30), QSize(125, 90)), "resampled_up.png");
+	QVERIFY2(difference.isEmpty(), qPrintable(difference));
+}
+
+void ResamplerTest::flatAreaStaysFlat()
+{
+	const QRgb color = qRgb(0x33, 0x66, 0x99);
+	QImage source(513, 287, QImage::Format_RGB32);
+	source.fill(color);
+
+	for (const QSize& targetSize: {QSize(100, 57), QSize(171, 287), QSize(1000, 600)})
+	{
+		const QImage result = resampleImage(source, targetSize);
+		QCOMPARE(result.size(), targetSize);
+		for (int y = 0; y < result.height(); ++y)
+		{
+			const QRgb* line = (const QRgb*)result.constScanLine(y);
+			for (int x = 0; x < result.width(); ++x)
+				QCOMPARE(line[x], color);
+		}
+	}
+}
+
+void ResamplerTest::premultipliedStaysValid()
+{
+	QImage source(90, 60, QImage::Format_ARGB32);
+	for (int y = 0; y < source.height(); ++y)
+	{
+		QRgb* line = (QRgb*)source.scanLine(y);
+		for (int x = 0; x < source.width(); ++x)
+			line[x] = qRgba(255, 255 * y / 59, 0, (x / 5 + y / 5) % 2 ? 255 : 20);
+	}
+
+	for (const QSize& targetSize: {QSize(31, 17), QSize(200, 150)})
+	{
+		const QImage result = resampleImage(source, targetSize);
+		QCOMPARE(result.format(), QImage::Format_ARGB32_Premultiplied);
+		for (int y = 0; y < result.height(); ++y)
+		{
+			const QRgb* line = (const QRgb*)result.constScanLine(y);
+			for (int x = 0; x < result.width(); ++x)
+				QVERIFY(qRed(line[x]) <= qAlpha(line[x]) && qGreen(line[x]) <= qAlpha(line[x]) && qBlue(line[x]) <= qAlpha(line[x]));
+		}
+	}
+}
+
+void ResamplerTest::sameResultOnAnyNumberOfThreads()
+{
+	const QImage source = testPattern(640, 480);
+	const QImage singleThreaded = resampleImage(source, QSize(211, 157), 1);
+	QCOMPARE(resampleImage(source, QSize(211, 157), 3), singleThreaded);
+	QCOMPARE(resampleImage(source, QSize(211, 157), 8), singleThreaded);
+}
+
+void ResamplerTest::sse2MatchesScalar_data()
+{
+	QTest::addColumn<QImage>("source");
+	QTest::addColumn<QSize>("targetSize");
+
+	QImage translucent = testPattern(77, 53).convertToFormat(QImage::Format_ARGB32);
+	for (int y = 0; y < translucent.height(); ++y)
+	{
+		QRgb* line = (QRgb*)translucent.scanLine(y);
+		for (int x = 0; x < translucent.width(); ++x)
+			line[x] = (line[x] & 0x00FFFFFFu) | ((quint32)(x * 7 + y * 3) % 256u << 24);
+	}
+
+	// Widths that aren't a multiple of 4 leave a tail for the scalar loop after the 4-pixel SSE2 one; odd tap counts end the horizontal kernel on a single pixel
+	QTest::newRow("reduction") << testPattern(1000, 700) << QSize(193, 131);
+	QTest::newRow("slight reduction") << testPattern(301, 203) << QSize(250, 170);
+	QTest::newRow("enlargement") << testPattern(37, 29) << QSize(150, 101);
+	QTest::newRow("one axis only") << testPattern(123, 45) << QSize(123, 17);
+	QTest::newRow("narrow") << testPattern(64, 64) << QSize(3, 5);
+	QTest::newRow("translucent") << translucent << QSize(41, 97);
+}
+
+void ResamplerTest::sse2MatchesScalar()
+{
+#if !(defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2))
+	QSKIP("The resampler is built without the SSE2 kernels on this platform");
+#endif
+
+	QFETCH(QImage, source);
+	QFETCH(QSize, targetSize);
+
+	QCOMPARE(resampleImage(source, targetSize), resampleImageScalar(source, targetSize));
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QObject>
+RESTORE_COMPILER_WARNINGS
+
+// resampleImage() against reference images, and the properties that hold for any input
+class ResamplerTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	// A big reduction, which goes through the area filter before Lanczos
+	void downscale();
+	void upscale();
+	// The fixed point weights of every output pixel add up to exactly one
+	void flatAreaStaysFlat();
+	// Lanczos overshoots at sharp alpha edges, the color channels must still not exceed the alpha
+	void premultipliedStaysValid();
+	void sameResultOnAnyNumberOfThreads();
+	void sse2MatchesScalar_data();
+	// The SSE2 kernels do the same fixed point arithmetic as the scalar code, the results must be identical
+	void sse2MatchesScalar();
+};
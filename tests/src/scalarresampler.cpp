@@ -0,0 +1,9 @@
+// The resampler compiled once more with the scalar code only, as the reference for its SSE2 kernels.
+// All of its internals are in an anonymous namespace, so only the entry point needs a name of its own.
+#include "resampler.h"
+#include "scalarresampler.h"
+
+#define RESAMPLER_NO_SSE2
+#define resampleImage resampleImageScalar
+#include "resampler.cpp"
+#undef resampleImage
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QImage>
+#include <QSize>
+RESTORE_COMPILER_WARNINGS
+
+// resampleImage() without the SSE2 kernels, see scalarresampler.cpp
+QImage resampleImageScalar(const QImage& source, const QSize& targetSize, int numThreads = 0);
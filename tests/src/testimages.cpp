@@ -0,0 +1,56 @@
+#include "testimages.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QtTest>
+RESTORE_COMPILER_WARNINGS
+
+#include <algorithm>
+#include <stdlib.h>
+
+QImage testPattern(int width, int height)
+{
+	QImage image(width, height, QImage::Format_RGB32);
+	for (int y = 0; y < height; ++y)
+	{
+		QRgb* line = (QRgb*)image.scanLine(y);
+		for (int x = 0; x < width; ++x)
+			line[x] = qRgb(255 * x / std::max(width - 1, 1), 255 * y / std::max(height - 1, 1), (x / 8 + y / 8) % 2 ? 230 : 25);
+	}
+
+	return image;
+}
+
+static QString firstDifference(const QImage& image, const QImage& reference)
+{
+	if (image.size() != reference.size())
+		return QString("the size is %1x%2 instead of %3x%4").arg(image.width()).arg(image.height()).arg(reference.width()).arg(reference.height());
+
+	for (int y = 0; y < image.height(); ++y)
+	{
+		const QRgb* line = (const QRgb*)image.constScanLine(y);
+		const QRgb* referenceLine = (const QRgb*)reference.constScanLine(y);
+		for (int x = 0; x < image.width(); ++x)
+		{
+			const QRgb pixel = line[x], expected = referenceLine[x];
+			if (abs(qRed(pixel) - qRed(expected)) > 1 || abs(qGreen(pixel) - qGreen(expected)) > 1 || abs(qBlue(pixel) - qBlue(expected)) > 1)
+				return QString("the pixel at (%1, %2) is %3 instead of %4").arg(x).arg(y).arg(pixel, 8, 16, QChar('0')).arg(expected, 8, 16, QChar('0'));
+		}
+	}
+
+	return QString();
+}
+
+QString compareWithReference(const QImage& image, const QString& referenceName)
+{
+	const QString referencePath = QFINDTESTDATA("../data/" + referenceName);
+	QImage reference;
+	if (referencePath.isEmpty() || !reference.load(referencePath))
+		return "Couldn't load the reference image " + referenceName;
+
+	const QString difference = firstDifference(image.convertToFormat(QImage::Format_RGB32), reference.convertToFormat(QImage::Format_RGB32));
+	if (difference.isEmpty())
+		return difference;
+
+	image.save(referenceName);
+	return QString("%1 doesn't match the reference: %2 (saved to the working directory)").arg(referenceName, difference);
+}
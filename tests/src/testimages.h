@@ -0,0 +1,16 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QImage>
+#include <QString>
+RESTORE_COMPILER_WARNINGS
+
+// A synthetic RGB32 image, the same on every run: a red/green gradient under an 8 pixel blue checkerboard,
+// so that a filter gets both the smooth areas and the sharp edges (where Lanczos rings) to deal with
+QImage testPattern(int width, int height);
+
+// Compares the image with the reference of that name in tests/data; each channel may be off by one, the filter weights are computed in floating point.
+// Returns the description of the first difference, or an empty string if there's none. A mismatching image is saved to the working directory to be looked at.
+QString compareWithReference(const QImage& image, const QString& referenceName);
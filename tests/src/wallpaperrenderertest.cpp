@@ -0,0 +1,40 @@
+#include "wallpaperrenderertest.h"
+#include "testimages.h"
+#include "wallpaperrenderer.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QtTest>
+RESTORE_COMPILER_WARNINGS
+
+Q_DECLARE_METATYPE(WPOPTIONS)
+
+void WallpaperRendererTest::displayModes_data()
+{
+	QTest::addColumn<WPOPTIONS>("mode");
+	QTest::addColumn<QString>("reference");
+
+	QTest::newRow("centered") << CENTERED << QString("wallpaper_centered.png");
+	QTest::newRow("stretched") << STRETCHED << QString("wallpaper_stretched.png");
+	QTest::newRow("fill") << FILL << QString("wallpaper_fill.png");
+	QTest::newRow("fit") << FIT << QString("wallpaper_fit.png");
+	QTest::newRow("tile") << TILE << QString("wallpaper_tile.png");
+}
+
+void WallpaperRendererTest::displayModes()
+{
+	QFETCH(WPOPTIONS, mode);
+	QFETCH(QString, reference);
+
+	const QImage wallpaper = renderWallpaper(testPattern(120, 80), QSize(100, 100), mode);
+	QCOMPARE(wallpaper.size(), QSize(100, 100));
+	QCOMPARE(wallpaper.format(), QImage::Format_RGB32);
+
+	const QString difference = compareWithReference(wallpaper, reference);
+	QVERIFY2(difference.isEmpty(), qPrintable(difference));
+}
+
+void WallpaperRendererTest::systemDefaultLeavesImageAsIs()
+{
+	const QImage source = testPattern(120, 80);
+	QCOMPARE(renderWallpaper(source, QSize(100, 100), SYSTEM_DEFAULT), source);
+}
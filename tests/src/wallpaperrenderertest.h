@@ -0,0 +1,19 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QObject>
+RESTORE_COMPILER_WARNINGS
+
+// renderWallpaper() in every display mode against reference images
+class WallpaperRendererTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void displayModes_data();
+	// A 120x80 image on a 100x100 screen: cropped one way and letterboxed the other when centered, scaled by a fractional ratio otherwise
+	void displayModes();
+	void systemDefaultLeavesImageAsIs();
+};
@@ -0,0 +1,62 @@
+TARGET = imagetests
+TEMPLATE = app
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+QT = gui core testlib
+
+mac* | linux*{
+	CONFIG(release, debug|release):CONFIG += Release
+	CONFIG(debug, debug|release):CONFIG += Debug
+}
+
+Release:OUTPUT_DIR=release
+Debug:OUTPUT_DIR=debug
+
+win*{
+	QMAKE_CXXFLAGS += /MP /wd4251
+	QMAKE_CXXFLAGS_WARN_ON = -W4
+	DEFINES += WIN32_LEAN_AND_MEAN NOMINMAX _SCL_SECURE_NO_WARNINGS
+
+	Debug:QMAKE_LFLAGS += /INCREMENTAL
+	Release:QMAKE_LFLAGS += /OPT:REF /OPT:ICF
+}
+
+mac* | linux* {
+	QMAKE_CFLAGS   += -pedantic-errors -std=c99
+	QMAKE_CXXFLAGS += -pedantic-errors
+	QMAKE_CXXFLAGS_WARN_ON = -Wall -Wno-c++11-extensions -Wno-local-type-template-args -Wno-deprecated-register
+
+	Release:DEFINES += NDEBUG=1
+	Debug:DEFINES += _DEBUG
+}
+
+DESTDIR  = ../bin/$${OUTPUT_DIR}
+OBJECTS_DIR = ../build/$${OUTPUT_DIR}/$${TARGET}
+MOC_DIR     = ../build/$${OUTPUT_DIR}/$${TARGET}
+UI_DIR      = ../build/$${OUTPUT_DIR}/$${TARGET}
+RCC_DIR     = ../build/$${OUTPUT_DIR}/$${TARGET}
+
+LIBS += -L$${DESTDIR} -lwpchanger -limage -lqtutils -lcpputils
+
+INCLUDEPATH += \
+	../image/src \
+	../wpchanger/src \
+	../cpp-template-utils \
+	../qtutils \
+	../cpputils
+
+HEADERS += \
+	src/imageimportertest.h \
+	src/resamplertest.h \
+	src/scalarresampler.h \
+	src/testimages.h \
+	src/wallpaperrenderertest.h
+
+SOURCES += \
+	src/main.cpp \
+	src/imageimportertest.cpp \
+	src/resamplertest.cpp \
+	src/scalarresampler.cpp \
+	src/testimages.cpp \
+	src/wallpaperrenderertest.cpp
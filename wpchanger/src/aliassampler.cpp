@@ -0,0 +1,189 @@
+#include "aliassampler.h"
+#include "imagelist.h"
+#include "shufflebag.h"
+
+namespace {
+
+// The longest the side list of changed IDs gets before the table is rebuilt. Scanned linearly when a draw falls into it.
+const size_t maxChangedIds = 1024;
+
+}
+
+AliasSampler::AliasSampler() :
+	_tableTotal(0.0),
+	_changedTotal(0.0),
+	_staleTotal(0.0),
+	_rebuildNeeded(false)
+{
+}
+
+size_t AliasSampler::size() const
+{
+	return _weights.size();
+}
+
+void AliasSampler::setWeight(qulonglong id, double weight)
+{
+	const Weight newWeight = {weight, 0.0};
+	Weight& entry = _weights.emplace(id, newWeight).first->second;
+	entry.current = weight;
+	// Once the table is going to be rebuilt anyway, there's no point in tracking the changes
+	if (!_rebuildNeeded)
+		markChanged(id, weight, entry.inTable);
+}
+
+void AliasSampler::remove(qulonglong id)
+{
+	const auto entry = _weights.find(id);
+	if (entry == _weights.end())
+		return;
+
+	if (!_rebuildNeeded)
+		markChanged(id, 0.0, entry->second.inTable);
+	_weights.erase(entry);
+}
+
+void AliasSampler::clear()
+{
+	_weights.clear();
+	_tableIds.clear();
+	_threshold.clear();
+	_alias.clear();
+	_tableTotal = 0.0;
+	_changed.clear();
+	_changedPositions.clear();
+	_changedTotal = 0.0;
+	_staleTotal = 0.0;
+	_rebuildNeeded = false;
+}
+
+void AliasSampler::assign(const std::vector<std::pair<qulonglong, double>>& weights)
+{
+	_weights.clear();
+	_weights.reserve(weights.size());
+	for (const auto& weight: weights)
+	{
+		const Weight entry = {weight.second, 0.0};
+		_weights[weight.first] = entry;
+	}
+
+	_rebuildNeeded = true;
+}
+
+qulonglong AliasSampler::sample(Xoshiro256& random)
+{
+	if (_rebuildNeeded)
+		rebuild();
+
+	// The table part includes the discarded weight of the changed IDs, which a draw that lands there is retried for.
+	// The rebuild rule keeps that under half of the table, so it takes less than two tries on average.
+	const double total = _tableTotal + _changedTotal;
+	if (total <= 0.0)
+		return invalid_id;
+
+	for (;;)
+	{
+		const double point = random.real() * total;
+		if (point < _changedTotal || _tableIds.empty())
+		{
+			double sum = 0.0;
+			for (const auto& changed: _changed)
+			{
+				sum += changed.second;
+				if (point < sum)
+					return changed.first;
+			}
+
+			// Rounding
+			for (auto changed = _changed.rbegin(); changed != _changed.rend(); ++changed)
+			{
+				if (changed->second > 0.0)
+					return changed->first;
+			}
+
+			continue;
+		}
+
+		const size_t slot = (size_t)random.bounded(_tableIds.size());
+		const qulonglong id = _tableIds[random.real() < _threshold[slot] ? slot : _alias[slot]];
+		if (_changedPositions.count(id) == 0)
+			return id;
+	}
+}
+
+void AliasSampler::markChanged(qulonglong id, double weight, double tableWeight)
+{
+	const auto changed = _changedPositions.find(id);
+	if (changed != _changedPositions.end())
+	{
+		_changedTotal += weight - _changed[changed->second].second;
+		_changed[changed->second].second = weight;
+		return;
+	}
+
+	if (weight == tableWeight)
+		return;
+
+	_changedPositions.emplace(id, _changed.size());
+	_changed.emplace_back(id, weight);
+	_changedTotal += weight;
+	_staleTotal += tableWeight;
+
+	if (_changed.size() > maxChangedIds || _staleTotal > _tableTotal / 2)
+		_rebuildNeeded = true;
+}
+
+void AliasSampler::rebuild()
+{
+	_tableIds.clear();
+	_threshold.clear();
+	_tableIds.reserve(_weights.size());
+	_threshold.reserve(_weights.size());
+	_tableTotal = 0.0;
+	for (auto& weight: _weights)
+	{
+		weight.second.inTable = weight.second.current > 0.0 ? weight.second.current : 0.0;
+		if (weight.second.inTable == 0.0)
+			continue;
+
+		_tableIds.push_back(weight.first);
+		_threshold.push_back(weight.second.inTable);
+		_tableTotal += weight.second.inTable;
+	}
+
+	// Vose: every slot holds probability 1/n, made up of its own ID's share and the top-up from a single ID that has more than 1/n (its alias)
+	const size_t n = _tableIds.size();
+	_alias.resize(n);
+	std::vector<quint32> small, large;
+	for (size_t i = 0; i < n; ++i)
+	{
+		_threshold[i] *= (double)n / _tableTotal;
+		_alias[i] = (quint32)i;
+		(_threshold[i] < 1.0 ? small : large).push_back((quint32)i);
+	}
+
+	while (!small.empty() && !large.empty())
+	{
+		const quint32 less = small.back(), more = large.back();
+		small.pop_back();
+		_alias[less] = more;
+		_threshold[more] -= 1.0 - _threshold[less];
+		if (_threshold[more] < 1.0)
+		{
+			large.pop_back();
+			small.push_back(more);
+		}
+	}
+
+	// Whatever is left is 1 up to rounding
+	for (quint32 i: small)
+		_threshold[i] = 1.0;
+	for (quint32 i: large)
+		_threshold[i] = 1.0;
+
+	_changed.clear();
+	_changedPositions.clear();
+	_changedTotal = 0.0;
+	_staleTotal = 0.0;
+	_rebuildNeeded = false;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QtGlobal>
+RESTORE_COMPILER_WARNINGS
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class Xoshiro256;
+
+// Draws IDs with probabilities proportional to their weights in O(1), with Vose's alias table.
+// The table isn't rebuilt on every change. The IDs whose weight has changed since the last build go to a short side list that's sampled separately,
+// and a table draw landing on one of them is thrown away and retried, so every draw follows the current weights exactly.
+// The table is rebuilt (O(n), on the next draw) once the side list grows past a fixed length or the discarded part of the table gets large,
+// which keeps a draw O(1) and the rebuilds infrequent: with a change or two per wallpaper switch, a rebuild every few hundred switches at most.
+class AliasSampler
+{
+public:
+	AliasSampler();
+
+	size_t size() const;
+	// Adds the ID if it's new. A weight of 0 keeps the ID from being drawn.
+	void setWeight(qulonglong id, double weight);
+	void remove(qulonglong id);
+	void clear();
+	// Replaces all the IDs and weights at once
+	void assign(const std::vector<std::pair<qulonglong, double>>& weights);
+
+	// invalid_id if there's nothing with a non-zero weight
+	qulonglong sample(Xoshiro256& random);
+
+private:
+	void markChanged(qulonglong id, double weight, double tableWeight);
+	void rebuild();
+
+private:
+	struct Weight
+	{
+		double current;
+		// As of the last rebuild, 0 if the ID isn't in the table
+		double inTable;
+	};
+
+	std::unordered_map<qulonglong, Weight>  _weights;
+
+	// The table, as of the last rebuild. Slot i yields _tableIds[i] with probability _threshold[i], _tableIds[_alias[i]] otherwise.
+	std::vector<qulonglong>                 _tableIds;
+	std::vector<double>                     _threshold;
+	std::vector<quint32>                    _alias;
+	double                                  _tableTotal;
+
+	// The IDs changed since the rebuild, with their current weights
+	std::vector<std::pair<qulonglong, double>> _changed;
+	std::unordered_map<qulonglong, size_t>  _changedPositions;
+	double                                  _changedTotal;
+	// The table weight of the changed IDs, the part of the table that's discarded
+	double                                  _staleTotal;
+	bool                                    _rebuildNeeded;
+};
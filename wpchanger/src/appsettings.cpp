@@ -0,0 +1,174 @@
+#include "appsettings.h"
+#include "settings.h"
+#include "settings/csettings.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QCoreApplication>
+RESTORE_COMPILER_WARNINGS
+
+#include <limits>
+
+AppSettings& AppSettings::instance()
+{
+	static AppSettings inst;
+	return inst;
+}
+
+AppSettings::AppSettings() :
+	_writing(false),
+	_terminate(false)
+{
+	CSettings s;
+	_interval = s.value(SETTINGS_INTERVAL, SETTINGS_DEFAULT_INTERVAL).toInt();
+	_randomize = s.value(SETTINGS_RANDOMIZE, SETTINGS_DEFAULT_RANDOMIZE).toBool();
+	_weightedRandom = s.value(SETTINGS_WEIGHTED_RANDOM, SETTINGS_DEFAULT_WEIGHTED_RANDOM).toBool();
+	_startSwitchingOnStartup = s.value(SETTINGS_START_SWITCHING_ON_STARTUP, SETTINGS_DEFAULT_AUTOSTART).toBool();
+	_decodedImageCacheSizeMb = s.value(SETTINGS_DECODED_IMAGE_CACHE_SIZE, SETTINGS_DEFAULT_DECODED_IMAGE_CACHE_SIZE).toLongLong();
+	_watchFolders = s.value(SETTINGS_WATCH_FOLDERS, SETTINGS_DEFAULT_WATCH_FOLDERS).toBool();
+	_maxWatchedFolders = (size_t)s.value(SETTINGS_MAX_WATCHED_FOLDERS, SETTINGS_DEFAULT_MAX_WATCHED_FOLDERS).toULongLong();
+	_imageListFile = s.value(SETTINGS_IMAGE_LIST_FILE).toString();
+	_currentWallpaper = s.value(SETTINGS_CURRENT_WALLPAPER, std::numeric_limits<uint>::max()).toUInt();
+
+	_thread = std::thread(&AppSettings::writerThread, this);
+
+	// The instance outlives the application object, and the settings storage can't be relied on once that's gone
+	if (QCoreApplication::instance())
+		QObject::connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, [this]() {
+			flush();
+		});
+}
+
+AppSettings::~AppSettings()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_terminate = true;
+	}
+
+	_pendingChanged.notify_one();
+	_thread.join();
+}
+
+int AppSettings::interval() const
+{
+	return _interval;
+}
+
+void AppSettings::setInterval(int seconds)
+{
+	set(_interval, seconds, SETTINGS_INTERVAL);
+}
+
+bool AppSettings::randomize() const
+{
+	return _randomize;
+}
+
+void AppSettings::setRandomize(bool randomize)
+{
+	set(_randomize, randomize, SETTINGS_RANDOMIZE);
+}
+
+bool AppSettings::weightedRandom() const
+{
+	return _weightedRandom;
+}
+
+void AppSettings::setWeightedRandom(bool weighted)
+{
+	set(_weightedRandom, weighted, SETTINGS_WEIGHTED_RANDOM);
+}
+
+bool AppSettings::startSwitchingOnStartup() const
+{
+	return _startSwitchingOnStartup;
+}
+
+void AppSettings::setStartSwitchingOnStartup(bool start)
+{
+	set(_startSwitchingOnStartup, start, SETTINGS_START_SWITCHING_ON_STARTUP);
+}
+
+qint64 AppSettings::decodedImageCacheSizeMb() const
+{
+	return _decodedImageCacheSizeMb;
+}
+
+bool AppSettings::watchFolders() const
+{
+	return _watchFolders;
+}
+
+size_t AppSettings::maxWatchedFolders() const
+{
+	return _maxWatchedFolders;
+}
+
+QString AppSettings::imageListFile() const
+{
+	return _imageListFile;
+}
+
+void AppSettings::setImageListFile(const QString& filePath)
+{
+	set(_imageListFile, filePath, SETTINGS_IMAGE_LIST_FILE);
+}
+
+uint AppSettings::currentWallpaper() const
+{
+	return _currentWallpaper;
+}
+
+void AppSettings::setCurrentWallpaper(uint index)
+{
+	set(_currentWallpaper, index, SETTINGS_CURRENT_WALLPAPER);
+}
+
+void AppSettings::flush()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_writesDone.wait(lock, [this]() {return _pendingWrites.empty() && !_writing;});
+}
+
+template <typename T>
+void AppSettings::set(T& field, const T& value, const char* key)
+{
+	if (field == value)
+		return;
+
+	field = value;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_pendingWrites[key] = QVariant::fromValue(value);
+	}
+
+	_pendingChanged.notify_one();
+	invokeCallback(&SettingsWatcher::settingChanged, QString(key));
+}
+
+void AppSettings::writerThread()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	for (;;)
+	{
+		_pendingChanged.wait(lock, [this]() {return !_pendingWrites.empty() || _terminate;});
+		// Whatever has been set is written before the thread quits
+		if (_pendingWrites.empty())
+			return;
+
+		QMap<QString, QVariant> writes;
+		writes.swap(_pendingWrites);
+		_writing = true;
+		lock.unlock();
+
+		{
+			CSettings s;
+			for (auto write = writes.cbegin(); write != writes.cend(); ++write)
+				s.setValue(write.key(), write.value());
+		}
+
+		lock.lock();
+		_writing = false;
+		_writesDone.notify_all();
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+#include "utility/callback_caller.hpp"
+
+DISABLE_COMPILER_WARNINGS
+#include <QMap>
+#include <QString>
+#include <QVariant>
+RESTORE_COMPILER_WARNINGS
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+struct SettingsWatcher {
+	// key is one of the SETTINGS_ keys from settings.h
+	virtual void settingChanged(const QString& key) = 0;
+};
+
+// The application's preferences (the keys in settings.h), read from the settings storage once and kept in memory.
+// Reading is free; setting a value updates it at once, notifies the subscribers and queues the write, which a background thread carries out.
+// Writes to the same key that pile up while the thread is busy are coalesced. Only to be used from the main thread.
+// The window layout, which is only read and written once per run, still goes to CSettings directly.
+class AppSettings : public CallbackCaller<SettingsWatcher>
+{
+public:
+	static AppSettings& instance();
+	~AppSettings();
+
+	// Seconds between switching wallpapers
+	int  interval() const;
+	void setInterval(int seconds);
+
+	bool randomize() const;
+	void setRandomize(bool randomize);
+
+	bool weightedRandom() const;
+	void setWeightedRandom(bool weighted);
+
+	bool startSwitchingOnStartup() const;
+	void setStartSwitchingOnStartup(bool start);
+
+	qint64 decodedImageCacheSizeMb() const;
+	bool   watchFolders() const;
+	size_t maxWatchedFolders() const;
+
+	QString imageListFile() const;
+	void    setImageListFile(const QString& filePath);
+
+	// std::numeric_limits<uint>::max() if there's none
+	uint currentWallpaper() const;
+	void setCurrentWallpaper(uint index);
+
+	// Blocks until everything set so far has been written
+	void flush();
+
+private:
+	AppSettings();
+
+	template <typename T>
+	void set(T& field, const T& value, const char* key);
+
+	void writerThread();
+
+private:
+	int     _interval;
+	bool    _randomize;
+	bool    _weightedRandom;
+	bool    _startSwitchingOnStartup;
+	qint64  _decodedImageCacheSizeMb;
+	bool    _watchFolders;
+	size_t  _maxWatchedFolders;
+	QString _imageListFile;
+	uint    _currentWallpaper;
+
+	std::thread               _thread;
+	std::mutex                _mutex;
+	std::condition_variable   _pendingChanged;
+	std::condition_variable   _writesDone;
+	// The latest value of each key that has yet to be written
+	QMap<QString, QVariant>   _pendingWrites;
+	bool                      _writing;
+	bool                      _terminate;
+};
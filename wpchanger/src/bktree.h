@@ -0,0 +1,87 @@
+#pragma once
+
+#include "perceptualhash.h"
+
+#include <stdlib.h>
+#include <vector>
+
+// BK-tree over 64-bit hashes with the Hamming distance metric. Answers "all elements within distance k" by only descending
+// into the subtrees whose edge distance lies within [d - k, d + k] of the query's distance to the node.
+template <typename Value>
+class HammingBkTree
+{
+public:
+	void insert(quint64 hash, const Value& value)
+	{
+		if (_nodes.empty())
+		{
+			_nodes.push_back(Node(hash, value, 0));
+			return;
+		}
+
+		size_t nodeIndex = 0;
+		for (;;)
+		{
+			const int distance = hammingDistance(_nodes[nodeIndex].hash, hash);
+			size_t child = _nodes[nodeIndex].firstChild;
+			while (child != noNode && _nodes[child].distanceToParent != distance)
+				child = _nodes[child].nextSibling;
+
+			if (child == noNode)
+			{
+				// No subtree for this distance yet - the new node starts one
+				_nodes.push_back(Node(hash, value, distance));
+				_nodes.back().nextSibling = _nodes[nodeIndex].firstChild;
+				_nodes[nodeIndex].firstChild = _nodes.size() - 1;
+				return;
+			}
+
+			nodeIndex = child;
+		}
+	}
+
+	// Calls visitor(hash, value, distance) for every element within maxDistance of the hash
+	template <typename Visitor>
+	void findWithin(quint64 hash, int maxDistance, Visitor visitor) const
+	{
+		if (_nodes.empty())
+			return;
+
+		std::vector<size_t> pending(1, 0);
+		while (!pending.empty())
+		{
+			const Node& node = _nodes[pending.back()];
+			pending.pop_back();
+
+			const int distance = hammingDistance(node.hash, hash);
+			if (distance <= maxDistance)
+				visitor(node.hash, node.value, distance);
+
+			for (size_t child = node.firstChild; child != noNode; child = _nodes[child].nextSibling)
+			{
+				if (abs(_nodes[child].distanceToParent - distance) <= maxDistance)
+					pending.push_back(child);
+			}
+		}
+	}
+
+	size_t size() const { return _nodes.size(); }
+	bool empty() const { return _nodes.empty(); }
+	void clear() { _nodes.clear(); }
+
+private:
+	static const size_t noNode = size_t(-1);
+
+	// Children are kept as an intrusive singly-linked list to keep the nodes compact
+	struct Node {
+		Node(quint64 hash_, const Value& value_, int distanceToParent_) : hash(hash_), value(value_), distanceToParent(distanceToParent_), firstChild(noNode), nextSibling(noNode) {}
+
+		quint64 hash;
+		Value   value;
+		int     distanceToParent;
+		size_t  firstChild;
+		size_t  nextSibling;
+	};
+
+	std::vector<Node> _nodes;
+};
@@ -0,0 +1,224 @@
+#include "filestats.h"
+#include "image.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+RESTORE_COMPILER_WARNINGS
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Big folders are split into chunks of this many files so that they don't end up on a single thread
+const size_t filesPerChunk = 256;
+const unsigned maxThreads = 16;
+const int progressIntervalMs = 100;
+
+struct FolderFiles
+{
+	QString folder;
+	std::vector<std::pair<size_t /*index in the paths*/, QString /*file name*/>> files;
+};
+
+struct Chunk
+{
+	size_t folder;
+	size_t begin;
+	size_t end;
+};
+
+FileStat statWithQt(const QString& filePath)
+{
+	FileStat result;
+	const QFileInfo info(filePath);
+	result.exists = info.exists();
+	if (result.exists)
+	{
+		result.size = (quint64)info.size();
+		result.modificationTime = info.lastModified().toMSecsSinceEpoch() / 1000;
+	}
+
+	return result;
+}
+
+#ifndef _WIN32
+void fillStat(const struct stat& fileStat, FileStat& result)
+{
+	result.exists = true;
+	result.size = (quint64)fileStat.st_size;
+	result.modificationTime = (qint64)fileStat.st_mtime;
+	result.inode = (quint64)fileStat.st_ino;
+	result.device = deviceId((quint64)fileStat.st_dev);
+}
+#endif
+
+void statChunk(const FolderFiles& folder, size_t begin, size_t end, qint64 checkedAt, std::vector<FileStat>& results)
+{
+#ifndef _WIN32
+	const int folderFd = ::open(QFile::encodeName(folder.folder).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	for (size_t i = begin; i < end; ++i)
+	{
+		FileStat& result = results[folder.files[i].first];
+		struct stat fileStat;
+		// A folder that can't be opened has no files as far as the list is concerned
+		if (folderFd >= 0 && ::fstatat(folderFd, QFile::encodeName(folder.files[i].second).constData(), &fileStat, 0) == 0)
+			fillStat(fileStat, result);
+
+		result.checkedAt = checkedAt;
+	}
+
+	if (folderFd >= 0)
+		::close(folderFd);
+#else
+	for (size_t i = begin; i < end; ++i)
+	{
+		FileStat& result = results[folder.files[i].first];
+		result = statWithQt(Image::joinPath(folder.folder, folder.files[i].second));
+		result.checkedAt = checkedAt;
+	}
+#endif
+}
+
+}
+
+FileStat statFile(const QString& filePath)
+{
+	FileStat result;
+#ifndef _WIN32
+	struct stat fileStat;
+	if (::stat(QFile::encodeName(filePath).constData(), &fileStat) == 0)
+		fillStat(fileStat, result);
+#else
+	result = statWithQt(filePath);
+#endif
+
+	result.checkedAt = QDateTime::currentMSecsSinceEpoch();
+	return result;
+}
+
+std::vector<FileStat> statFiles(const std::vector<QString>& filePaths, const FileStatProgress& progress /* = FileStatProgress() */)
+{
+	std::vector<FileStat> results(filePaths.size());
+
+	std::vector<FolderFiles> folders;
+	QHash<QString, size_t> folderIndexByPath;
+	for (size_t i = 0; i < filePaths.size(); ++i)
+	{
+		QString folder, fileName;
+		Image::splitPath(filePaths[i], folder, fileName);
+		const auto existingFolder = folderIndexByPath.constFind(folder);
+		const size_t folderIndex = existingFolder != folderIndexByPath.constEnd() ? existingFolder.value() : folders.size();
+		if (folderIndex == folders.size())
+		{
+			folderIndexByPath.insert(folder, folderIndex);
+			folders.emplace_back();
+			folders.back().folder = folder;
+		}
+
+		folders[folderIndex].files.emplace_back(i, fileName);
+	}
+
+	std::vector<Chunk> chunks;
+	for (size_t folder = 0; folder < folders.size(); ++folder)
+	{
+		for (size_t begin = 0; begin < folders[folder].files.size(); begin += filesPerChunk)
+		{
+			const Chunk chunk = {folder, begin, std::min(begin + filesPerChunk, folders[folder].files.size())};
+			chunks.push_back(chunk);
+		}
+	}
+
+	const qint64 checkedAt = QDateTime::currentMSecsSinceEpoch();
+	std::atomic<size_t> nextChunk(0), numDone(0);
+	const auto statChunks = [&]() {
+		for (size_t chunk = nextChunk++; chunk < chunks.size(); chunk = nextChunk++)
+		{
+			statChunk(folders[chunks[chunk].folder], chunks[chunk].begin, chunks[chunk].end, checkedAt, results);
+			numDone += chunks[chunk].end - chunks[chunk].begin;
+		}
+	};
+
+	const size_t numThreads = std::min<size_t>(chunks.size(), std::min(maxThreads, std::max(2u, 2 * std::thread::hardware_concurrency())));
+	if (numThreads <= 1)
+		statChunks();
+	else
+	{
+		std::mutex mutex;
+		std::condition_variable finished;
+		size_t numFinished = 0;
+
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < numThreads; ++i)
+		{
+			threads.emplace_back([&]() {
+				statChunks();
+				std::lock_guard<std::mutex> lock(mutex);
+				++numFinished;
+				finished.notify_one();
+			});
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (!finished.wait_for(lock, std::chrono::milliseconds(progressIntervalMs), [&]() {return numFinished == numThreads;}))
+			{
+				if (progress)
+				{
+					lock.unlock();
+					progress(numDone, filePaths.size());
+					lock.lock();
+				}
+			}
+		}
+
+		for (std::thread& thread: threads)
+			thread.join();
+	}
+
+	if (progress)
+		progress(filePaths.size(), filePaths.size());
+
+	return results;
+}
+
+bool FileStatCache::find(qulonglong id, qint64 maxAgeMs, FileStat& stat) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	const auto entry = _stats.find(id);
+	if (entry == _stats.end() || QDateTime::currentMSecsSinceEpoch() - entry->second.checkedAt > maxAgeMs)
+		return false;
+
+	stat = entry->second;
+	return true;
+}
+
+void FileStatCache::insert(qulonglong id, const FileStat& stat)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_stats[id] = stat;
+}
+
+void FileStatCache::remove(qulonglong id)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_stats.erase(id);
+}
+
+void FileStatCache::clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_stats.clear();
+}
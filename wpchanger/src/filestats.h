@@ -0,0 +1,59 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QString>
+RESTORE_COMPILER_WARNINGS
+
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct FileStat
+{
+	FileStat() : exists(false), size(0), modificationTime(0), inode(0), device(0), checkedAt(0) {}
+
+	bool    exists;
+	quint64 size;
+	// Seconds since the epoch
+	qint64  modificationTime;
+	// 0 where the platform doesn't provide it
+	quint64 inode;
+	// See deviceId(), 0 where the platform doesn't provide the inode
+	quint32 device;
+	// When the file was looked at, milliseconds since the epoch
+	qint64  checkedAt;
+};
+
+// The device number of a file system folded to 32 bits, to fit in the list file record. Tells the file systems mounted at the same time apart, which is what
+// makes an inode unique; a clash would still take the size and the modification time to match for two files to be mistaken for each other.
+inline quint32 deviceId(quint64 device)
+{
+	return (quint32)(device ^ (device >> 32));
+}
+
+typedef std::function<void (size_t done, size_t total)> FileStatProgress;
+
+FileStat statFile(const QString& filePath);
+
+// Batch version for checking whole lists. The paths are grouped by folder, every folder is opened once and the files in it are looked up relative to it (fstatat),
+// sparing the (possibly networked) file system a full path walk per file. The folders are spread over a pool of threads - stat is latency-bound, not CPU-bound.
+// progress is called periodically on the calling thread. The results are in the order of the paths.
+std::vector<FileStat> statFiles(const std::vector<QString>& filePaths, const FileStatProgress& progress = FileStatProgress());
+
+// FileStat by image ID, safe to use from any thread
+class FileStatCache
+{
+public:
+	// Returns false if there's no entry or it's more than maxAgeMs old
+	bool find(qulonglong id, qint64 maxAgeMs, FileStat& stat) const;
+	void insert(qulonglong id, const FileStat& stat);
+	void remove(qulonglong id);
+	void clear();
+
+private:
+	mutable std::mutex                       _mutex;
+	std::unordered_map<qulonglong, FileStat> _stats;
+};
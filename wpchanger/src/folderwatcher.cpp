@@ -0,0 +1,357 @@
+#include "folderwatcher.h"
+#include "image.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QDebug>
+#include <QFile>
+#ifdef __linux__
+#include <QSocketNotifier>
+#else
+#include <QFileSystemWatcher>
+#endif
+RESTORE_COMPILER_WARNINGS
+
+#ifdef __linux__
+#include <errno.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// The events are delivered once the folders have been quiet for this long...
+const int quietPeriodMs = 300;
+// ...or this long after the first of them, whichever comes first
+const qint64 maxEventDelayMs = 3000;
+// Past this many distinct paths a storm is reported per folder rather than per file
+const size_t maxPendingEvents = 4096;
+
+#ifdef __linux__
+
+class InotifyFolderWatcher : public FolderWatcher
+{
+public:
+	InotifyFolderWatcher() :
+		_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+		_outOfWatches(false),
+		_pendingMoveCookie(0)
+	{
+		if (_fd < 0)
+		{
+			qDebug() << "inotify is unavailable:" << strerror(errno);
+			return;
+		}
+
+		_notifier.reset(new QSocketNotifier(_fd, QSocketNotifier::Read));
+		QObject::connect(_notifier.get(), &QSocketNotifier::activated, [this](int) {
+			readEvents();
+		});
+	}
+
+	~InotifyFolderWatcher() override
+	{
+		_notifier.reset();
+		if (_fd >= 0)
+			::close(_fd);
+	}
+
+protected:
+	bool addWatch(const QString& folder) override
+	{
+		if (_fd < 0 || _outOfWatches)
+			return false;
+
+		const int watch = inotify_add_watch(_fd, QFile::encodeName(folder).constData(), IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+		if (watch < 0)
+		{
+			if (errno == ENOSPC)
+			{
+				// fs.inotify.max_user_watches is shared by all the processes of the user, leaving the rest of the folders unwatched
+				qDebug() << "Out of inotify watches after" << _watchByFolder.size() << "folders";
+				_outOfWatches = true;
+			}
+
+			return false;
+		}
+
+		_folderByWatch.insert(watch, folder);
+		_watchByFolder.insert(folder, watch);
+		return true;
+	}
+
+	void removeWatch(const QString& folder) override
+	{
+		const auto watch = _watchByFolder.find(folder);
+		if (watch == _watchByFolder.end())
+			return;
+
+		inotify_rm_watch(_fd, watch.value());
+		_folderByWatch.remove(watch.value());
+		_watchByFolder.erase(watch);
+		_outOfWatches = false;
+	}
+
+private:
+	void readEvents()
+	{
+		alignas(inotify_event) char buffer[16384];
+		for (;;)
+		{
+			const ssize_t length = ::read(_fd, buffer, sizeof(buffer));
+			if (length <= 0)
+				break; // EAGAIN - drained
+
+			for (const char* event = buffer; event < buffer + length; event += sizeof(inotify_event) + ((const inotify_event*)event)->len)
+				handleEvent(*(const inotify_event*)event);
+		}
+
+		// A file moved out of the watched folders has no IN_MOVED_TO to pair with
+		flushPendingMove();
+	}
+
+	void handleEvent(const inotify_event& event)
+	{
+		if (event.mask & IN_Q_OVERFLOW)
+		{
+			qDebug() << "inotify queue overflow, rechecking all the folders";
+			for (auto folder = _watchByFolder.constBegin(); folder != _watchByFolder.constEnd(); ++folder)
+				addEvent(FolderEvent::FolderChanged, folder.key());
+			return;
+		}
+
+		const auto folder = _folderByWatch.constFind(event.wd);
+		if (folder == _folderByWatch.constEnd())
+			return;
+
+		if (event.mask & IN_IGNORED)
+		{
+			// The watch has been removed by the kernel (the folder is gone)
+			_watchByFolder.remove(folder.value());
+			_folderByWatch.remove(event.wd);
+			return;
+		}
+
+		if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+		{
+			addEvent(FolderEvent::FolderChanged, folder.value());
+			return;
+		}
+
+		if ((event.mask & IN_ISDIR) || event.len == 0)
+			return; // Subfolders are watched on their own, if at all
+
+		const QString path = Image::joinPath(folder.value(), QFile::decodeName(event.name));
+		if (event.mask & IN_MOVED_TO)
+		{
+			// The two halves of a rename come one right after the other and share the cookie
+			if (!_pendingMovePath.isEmpty() && event.cookie == _pendingMoveCookie)
+			{
+				addEvent(FolderEvent::Created, path, _pendingMovePath);
+				addEvent(FolderEvent::Removed, _pendingMovePath);
+				_pendingMovePath.clear();
+			}
+			else
+				addEvent(FolderEvent::Created, path);
+
+			return;
+		}
+
+		flushPendingMove();
+		if (event.mask & IN_MOVED_FROM)
+		{
+			_pendingMovePath = path;
+			_pendingMoveCookie = event.cookie;
+		}
+		else if (event.mask & IN_CREATE)
+			addEvent(FolderEvent::Created, path);
+		else if (event.mask & IN_DELETE)
+			addEvent(FolderEvent::Removed, path);
+		else if (event.mask & IN_CLOSE_WRITE)
+			addEvent(FolderEvent::Modified, path);
+	}
+
+	void flushPendingMove()
+	{
+		if (_pendingMovePath.isEmpty())
+			return;
+
+		addEvent(FolderEvent::Removed, _pendingMovePath);
+		_pendingMovePath.clear();
+	}
+
+private:
+	const int                        _fd;
+	std::unique_ptr<QSocketNotifier> _notifier;
+	bool                             _outOfWatches;
+
+	QHash<int, QString>              _folderByWatch;
+	QHash<QString, int>              _watchByFolder;
+
+	// The first half of a rename, waiting for the second one
+	QString                          _pendingMovePath;
+	quint32                          _pendingMoveCookie;
+};
+
+#else
+
+class QtFolderWatcher : public FolderWatcher
+{
+public:
+	QtFolderWatcher()
+	{
+		QObject::connect(&_watcher, &QFileSystemWatcher::directoryChanged, [this](const QString& folder) {
+			addEvent(FolderEvent::FolderChanged, folder);
+		});
+	}
+
+protected:
+	bool addWatch(const QString& folder) override
+	{
+		return _watcher.addPath(folder);
+	}
+
+	void removeWatch(const QString& folder) override
+	{
+		_watcher.removePath(folder);
+	}
+
+private:
+	QFileSystemWatcher _watcher;
+};
+
+#endif
+
+}
+
+std::unique_ptr<FolderWatcher> FolderWatcher::create()
+{
+#ifdef __linux__
+	return std::unique_ptr<FolderWatcher>(new InotifyFolderWatcher);
+#else
+	return std::unique_ptr<FolderWatcher>(new QtFolderWatcher);
+#endif
+}
+
+FolderWatcher::FolderWatcher()
+{
+	_flushTimer.setSingleShot(true);
+	QObject::connect(&_flushTimer, &QTimer::timeout, [this]() {
+		flushEvents();
+	});
+}
+
+FolderWatcher::~FolderWatcher()
+{
+}
+
+void FolderWatcher::setFolders(const std::vector<QString>& folders, size_t maxFolders)
+{
+	QSet<QString> wantedFolders;
+	for (size_t i = 0; i < folders.size() && i < maxFolders; ++i)
+		wantedFolders.insert(folders[i]);
+
+	// Releasing the watches first makes them available for the new folders
+	for (auto folder = _watchedFolders.begin(); folder != _watchedFolders.end();)
+	{
+		if (!wantedFolders.contains(*folder))
+		{
+			removeWatch(*folder);
+			folder = _watchedFolders.erase(folder);
+		}
+		else
+			++folder;
+	}
+
+	for (size_t i = 0; i < folders.size() && i < maxFolders; ++i)
+	{
+		if (!_watchedFolders.contains(folders[i]) && addWatch(folders[i]))
+			_watchedFolders.insert(folders[i]);
+	}
+}
+
+size_t FolderWatcher::numWatchedFolders() const
+{
+	return (size_t)_watchedFolders.size();
+}
+
+void FolderWatcher::addEvent(FolderEvent::Type type, const QString& path, const QString& previousPath /* = QString() */)
+{
+	if (_pendingEvents.empty())
+		_pendingEventsAge.start();
+
+	if (type != FolderEvent::FolderChanged)
+	{
+		// Nothing to add if the whole folder is going to be checked anyway
+		QString folder, fileName;
+		Image::splitPath(path, folder, fileName);
+		const auto folderEvent = _pendingEventIndexByPath.constFind(folder);
+		if (folderEvent != _pendingEventIndexByPath.constEnd() && _pendingEvents[folderEvent.value()].type == FolderEvent::FolderChanged)
+			return;
+	}
+
+	// A file renamed more than once is reported as renamed from its original path
+	QString originalPath = previousPath;
+	const auto previousEvent = _pendingEventIndexByPath.constFind(previousPath);
+	if (!previousPath.isEmpty() && previousEvent != _pendingEventIndexByPath.constEnd() && _pendingEvents[previousEvent.value()].type == FolderEvent::Created)
+		originalPath = _pendingEvents[previousEvent.value()].previousPath;
+
+	const auto existing = _pendingEventIndexByPath.constFind(path);
+	if (existing == _pendingEventIndexByPath.constEnd())
+	{
+		FolderEvent event;
+		event.type = type;
+		event.path = path;
+		event.previousPath = originalPath;
+		_pendingEventIndexByPath.insert(path, _pendingEvents.size());
+		_pendingEvents.push_back(event);
+	}
+	else
+	{
+		FolderEvent& event = _pendingEvents[existing.value()];
+		// A file that has been created and then written to is still a new file; otherwise the latest state is what counts
+		if (type != FolderEvent::Modified || event.type != FolderEvent::Created)
+		{
+			event.type = type;
+			event.previousPath = originalPath;
+		}
+	}
+
+	if (_pendingEvents.size() > maxPendingEvents)
+	{
+		// Too many to go through one by one, the folders are going to be checked as a whole
+		std::vector<FolderEvent> events;
+		events.swap(_pendingEvents);
+		_pendingEventIndexByPath.clear();
+		for (const FolderEvent& event: events)
+		{
+			QString folder, fileName;
+			if (event.type == FolderEvent::FolderChanged)
+				folder = event.path;
+			else
+				Image::splitPath(event.path, folder, fileName);
+
+			if (!_pendingEventIndexByPath.contains(folder))
+			{
+				FolderEvent folderEvent;
+				folderEvent.type = FolderEvent::FolderChanged;
+				folderEvent.path = folder;
+				_pendingEventIndexByPath.insert(folder, _pendingEvents.size());
+				_pendingEvents.push_back(folderEvent);
+			}
+		}
+	}
+
+	if (_pendingEventsAge.elapsed() < maxEventDelayMs)
+		_flushTimer.start(quietPeriodMs);
+}
+
+void FolderWatcher::flushEvents()
+{
+	std::vector<FolderEvent> events;
+	events.swap(_pendingEvents);
+	_pendingEventIndexByPath.clear();
+
+	if (!events.empty())
+		invokeCallback(&FolderWatcherListener::folderEvents, events);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+#include "utility/callback_caller.hpp"
+
+DISABLE_COMPILER_WARNINGS
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QTimer>
+RESTORE_COMPILER_WARNINGS
+
+#include <memory>
+#include <vector>
+
+struct FolderEvent
+{
+	enum Type {
+		Created,
+		Removed,
+		Modified,
+		// Something in the folder has changed, but it's not known what (the event queue overflowed, the folder itself was moved or deleted,
+		// or the platform doesn't report individual files): everything in it has to be checked
+		FolderChanged
+	};
+
+	Type    type;
+	// File path, or the folder path for FolderChanged
+	QString path;
+	// For a file that has been renamed within the watched folders: the path it had before (the event type is Created)
+	QString previousPath;
+};
+
+struct FolderWatcherListener {
+	virtual void folderEvents(std::vector<FolderEvent> events) = 0;
+};
+
+// Reports the changes to the files in a set of folders (subfolders aren't watched, every folder of interest is listed explicitly).
+// Event storms are coalesced: the events are collected until the folders have been quiet for a moment (or for a few seconds at most while they keep changing),
+// then delivered in one folderEvents() call with at most one event per path. Everything happens on the thread that owns the watcher.
+class FolderWatcher : public CallbackCaller<FolderWatcherListener>
+{
+public:
+	// inotify on Linux, QFileSystemWatcher (which only tells which folder has changed) elsewhere
+	static std::unique_ptr<FolderWatcher> create();
+	virtual ~FolderWatcher();
+
+	// Replaces the set of watched folders. Only the first maxFolders of them are watched (fewer if the system runs out of watches), so the more important folders go first.
+	void setFolders(const std::vector<QString>& folders, size_t maxFolders);
+	size_t numWatchedFolders() const;
+
+protected:
+	FolderWatcher();
+
+	// Returns false if the folder can't be watched, e. g. there are no more watches available
+	virtual bool addWatch(const QString& folder) = 0;
+	virtual void removeWatch(const QString& folder) = 0;
+
+	// For the implementations to report the raw events
+	void addEvent(FolderEvent::Type type, const QString& path, const QString& previousPath = QString());
+
+private:
+	void flushEvents();
+
+private:
+	QSet<QString>            _watchedFolders;
+
+	std::vector<FolderEvent> _pendingEvents;
+	QHash<QString, size_t>   _pendingEventIndexByPath;
+	QTimer                   _flushTimer;
+	// Time since the oldest pending event
+	QElapsedTimer            _pendingEventsAge;
+};
@@ -0,0 +1,100 @@
+#include "idindexmap.h"
+#include "imagelist.h"
+
+#include <algorithm>
+
+namespace {
+
+const quint32 emptySlot = 0xFFFFFFFFu;
+const unsigned minSlotBits = 4;
+
+// Fibonacci hashing: the high bits of the product depend on all the bits of the ID
+inline size_t hashedSlot(qulonglong id, unsigned slotBits)
+{
+	return (size_t)((id * 0x9E3779B97F4A7C15ull) >> (64 - slotBits));
+}
+
+}
+
+IdIndexMap::IdIndexMap() :
+	_slots((size_t)1 << minSlotBits, emptySlot),
+	_slotBits(minSlotBits)
+{
+}
+
+size_t IdIndexMap::size() const
+{
+	return _ids.size();
+}
+
+size_t IdIndexMap::indexOf(qulonglong id) const
+{
+	const quint32 index = _slots[slotOf(id)];
+	return index != emptySlot ? (size_t)index : invalid_index;
+}
+
+qulonglong IdIndexMap::idAt(size_t index) const
+{
+	return index < _ids.size() ? _ids[index] : invalid_id;
+}
+
+bool IdIndexMap::contains(qulonglong id) const
+{
+	return _slots[slotOf(id)] != emptySlot;
+}
+
+const std::vector<qulonglong>& IdIndexMap::ids() const
+{
+	return _ids;
+}
+
+void IdIndexMap::append(qulonglong id)
+{
+	if (2 * (_ids.size() + 1) > _slots.size())
+		rehash(_ids.size() + 1);
+
+	_slots[slotOf(id)] = (quint32)_ids.size();
+	_ids.push_back(id);
+}
+
+void IdIndexMap::assign(const std::vector<qulonglong>& ids)
+{
+	_ids = ids;
+	rehash(_ids.size());
+}
+
+void IdIndexMap::clear()
+{
+	_ids.clear();
+	rehash(0);
+}
+
+size_t IdIndexMap::slotOf(qulonglong id) const
+{
+	// The table is never full, so the probing ends at the ID's slot or at an empty one
+	const size_t mask = _slots.size() - 1;
+	size_t slot = hashedSlot(id, _slotBits);
+	while (_slots[slot] != emptySlot && _ids[_slots[slot]] != id)
+		slot = (slot + 1) & mask;
+
+	return slot;
+}
+
+void IdIndexMap::rehash(size_t numEntries)
+{
+	unsigned slotBits = minSlotBits;
+	while (((size_t)1 << slotBits) < 2 * numEntries)
+		++slotBits;
+
+	// Shrinking only when the table has become much too big, so that a list that's cleared and loaded again doesn't reallocate
+	if (slotBits != _slotBits && (slotBits > _slotBits || slotBits + 2 < _slotBits))
+	{
+		_slotBits = slotBits;
+		_slots.assign((size_t)1 << slotBits, emptySlot);
+	}
+	else
+		std::fill(_slots.begin(), _slots.end(), emptySlot);
+
+	for (size_t index = 0; index < _ids.size(); ++index)
+		_slots[slotOf(_ids[index])] = (quint32)index;
+}
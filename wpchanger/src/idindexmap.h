@@ -0,0 +1,46 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QtGlobal>
+RESTORE_COMPILER_WARNINGS
+
+#include <vector>
+
+// Two-way mapping between the IDs of the list entries and their indexes, O(1) both ways.
+// Index to ID is a plain vector mirroring the list. ID to index is an open-addressing table (linear probing, at most half full) of indexes into that vector:
+// 4 bytes per slot, no per-entry allocations, and a lookup usually touches a single cache line of the table.
+// The IDs must be unique, as those of an ImageList are.
+class IdIndexMap
+{
+public:
+	IdIndexMap();
+
+	size_t size() const;
+	// invalid_index if there's no such ID
+	size_t indexOf(qulonglong id) const;
+	// invalid_id if the index is out of range
+	qulonglong idAt(size_t index) const;
+	bool contains(qulonglong id) const;
+	// All the IDs, in index order
+	const std::vector<qulonglong>& ids() const;
+
+	// Maps the ID to the next index, size()
+	void append(qulonglong id);
+	// Replaces the contents, ids[i] getting index i
+	void assign(const std::vector<qulonglong>& ids);
+	void clear();
+
+private:
+	size_t slotOf(qulonglong id) const;
+	// Rebuilds the table with room for at least the given number of entries
+	void rehash(size_t numEntries);
+
+private:
+	std::vector<qulonglong> _ids;
+	// Indexes into _ids, emptySlot where there's none
+	std::vector<quint32>    _slots;
+	// Number of the high bits of the hashed ID that select the slot
+	unsigned                _slotBits;
+};
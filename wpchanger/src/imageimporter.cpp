@@ -0,0 +1,557 @@
+#include "imageimporter.h"
+#include "filestats.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QPair>
+#ifdef _WIN32
+#include <QDateTime>
+#include <QSet>
+#endif
+RESTORE_COMPILER_WARNINGS
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <set>
+#include <string.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+// Lower case, sorted for the binary search
+const char* const supportedSuffixes[] = {"bmp", "gif", "jpeg", "jpg", "png", "tif", "tiff"};
+const size_t maxSuffixLength = 4;
+
+// Folder scanning and probing are I/O-bound, hence more threads than cores
+const unsigned maxThreads = 16;
+// Files taken off the probe queue at a time
+const size_t probeBatchSize = 16;
+const int pollIntervalMs = 100;
+
+inline ushort characterCode(char c)
+{
+	return (uchar)c;
+}
+
+inline ushort characterCode(QChar c)
+{
+	return c.unicode();
+}
+
+template <typename Char>
+bool hasSupportedSuffix(const Char* fileName, size_t length)
+{
+	for (size_t suffixLength = 1; suffixLength <= maxSuffixLength && suffixLength < length; ++suffixLength)
+	{
+		if (characterCode(fileName[length - suffixLength - 1]) != '.')
+			continue;
+
+		char suffix[maxSuffixLength + 1];
+		for (size_t i = 0; i < suffixLength; ++i)
+		{
+			const ushort c = characterCode(fileName[length - suffixLength + i]);
+			if (c >= 0x80)
+				return false;
+
+			suffix[i] = (char)(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+		}
+
+		suffix[suffixLength] = '\0';
+		return std::binary_search(std::begin(supportedSuffixes), std::end(supportedSuffixes), (const char*)suffix, [](const char* l, const char* r) {
+			return strcmp(l, r) < 0;
+		});
+	}
+
+	return false;
+}
+
+// Whether the path is the given file or folder, or lies within the folder
+bool isWithin(const QString& path, const QString& folder)
+{
+	return path.startsWith(folder) && (path.size() == folder.size() || folder.endsWith('/') || path[folder.size()] == '/');
+}
+
+}
+
+struct ImageImporter::FoundFile
+{
+	QString path;
+	qint64  size;
+	qint64  modificationTime;
+	quint64 inode;
+	// See deviceId()
+	quint32 device;
+};
+
+struct ImageImporter::Job
+{
+	struct FolderQueue
+	{
+		std::mutex          mutex;
+		std::deque<QString> folders;
+	};
+
+	Job(size_t numWorkers, const Import& import) :
+		folderQueues(numWorkers),
+		knownFiles(import.knownFiles),
+		reportMissingFiles(import.reportMissingFiles),
+		cancelled(false),
+		pendingWork(0),
+		numFilesFound(0),
+		numFilesProcessed(0),
+		numFilesFailed(0)
+	{
+		if (!knownFiles)
+			return;
+
+		knownFileIndexByPath.reserve((int)knownFiles->size());
+		knownFileFound.reset(new std::atomic<bool>[knownFiles->size()]);
+		for (size_t i = 0; i < knownFiles->size(); ++i)
+		{
+			const KnownFile& knownFile = (*knownFiles)[i];
+			if (!knownFileIndexByPath.contains(knownFile.path))
+				knownFileIndexByPath.insert(knownFile.path, i);
+			// Entries fingerprinted before the device was recorded are only recognized by their path
+			if (knownFile.params._inode != 0 && knownFile.params._device != 0)
+				knownFileIndexByInode.insert(qMakePair(knownFile.params._device, knownFile.params._inode), i);
+
+			knownFileFound[i] = false;
+		}
+	}
+
+	void addFolders(size_t worker, const std::vector<QString>& folders)
+	{
+		if (folders.empty())
+			return;
+
+		pendingWork += folders.size();
+		std::lock_guard<std::mutex> lock(folderQueues[worker].mutex);
+		folderQueues[worker].folders.insert(folderQueues[worker].folders.end(), folders.begin(), folders.end());
+	}
+
+	void addFiles(const std::vector<FoundFile>& newFiles)
+	{
+		if (newFiles.empty())
+			return;
+
+		pendingWork += newFiles.size();
+		std::lock_guard<std::mutex> lock(filesMutex);
+		files.insert(files.end(), newFiles.begin(), newFiles.end());
+	}
+
+	// The worker's own queue is used depth-first, for locality; the others are stolen from at the other end, where the biggest unexplored subtrees are
+	bool takeFolder(size_t worker, QString& folder)
+	{
+		for (size_t i = 0; i < folderQueues.size(); ++i)
+		{
+			FolderQueue& queue = folderQueues[(worker + i) % folderQueues.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.folders.empty())
+				continue;
+
+			if (i == 0)
+			{
+				folder = queue.folders.back();
+				queue.folders.pop_back();
+			}
+			else
+			{
+				folder = queue.folders.front();
+				queue.folders.pop_front();
+			}
+
+			return true;
+		}
+
+		return false;
+	}
+
+	bool takeFiles(std::vector<FoundFile>& batch)
+	{
+		std::lock_guard<std::mutex> lock(filesMutex);
+		const size_t batchSize = std::min(probeBatchSize, files.size());
+		batch.assign(files.begin(), files.begin() + (std::ptrdiff_t)batchSize);
+		files.erase(files.begin(), files.begin() + (std::ptrdiff_t)batchSize);
+		return batchSize > 0;
+	}
+
+	// Returns false if the folder has been visited already (via another path, or it's a symbolic link back up the tree)
+#ifndef _WIN32
+	bool markVisited(quint64 device, quint64 inode)
+	{
+		std::lock_guard<std::mutex> lock(visitedMutex);
+		return visitedFolders.insert(std::make_pair(device, inode)).second;
+	}
+#else
+	bool markVisited(const QString& canonicalPath)
+	{
+		std::lock_guard<std::mutex> lock(visitedMutex);
+		if (visitedFolders.contains(canonicalPath))
+			return false;
+
+		visitedFolders.insert(canonicalPath);
+		return true;
+	}
+#endif
+
+	std::vector<FolderQueue> folderQueues;
+
+	// Read-only while the job runs
+	const std::shared_ptr<const KnownFiles> knownFiles;
+	QHash<QString, size_t>                  knownFileIndexByPath;
+	// By (device, inode): a folder reachable by more than one path may be walked via a different one each time, and files get renamed and moved
+	QHash<QPair<quint32, quint64>, size_t>  knownFileIndexByInode;
+	// One flag per known file, set when the walk comes across it
+	std::unique_ptr<std::atomic<bool>[]>    knownFileFound;
+	const bool                              reportMissingFiles;
+	// The imported paths that exist; the missing known files are only looked for within these
+	std::vector<QString>                    roots;
+
+	std::mutex               filesMutex;
+	// Found, waiting to be probed
+	std::deque<FoundFile>    files;
+
+	std::mutex               visitedMutex;
+#ifndef _WIN32
+	std::set<std::pair<quint64 /*device*/, quint64 /*inode*/>> visitedFolders;
+#else
+	QSet<QString>            visitedFolders;
+#endif
+
+	std::mutex               resultsMutex;
+	std::vector<Image>       results;
+	std::vector<Image>       renamedImages;
+
+	std::atomic<bool>        cancelled;
+	// Folders and files queued or being worked on; the job is done when it drops to 0
+	std::atomic<size_t>      pendingWork;
+	std::atomic<size_t>      numFilesFound;
+	std::atomic<size_t>      numFilesProcessed;
+	std::atomic<size_t>      numFilesFailed;
+};
+
+ImageImporter::ImageImporter()
+{
+	_pollTimer.setInterval(pollIntervalMs);
+	QObject::connect(&_pollTimer, &QTimer::timeout, [this]() {
+		poll();
+	});
+}
+
+ImageImporter::~ImageImporter()
+{
+	if (_job)
+		_job->cancelled = true;
+
+	for (std::thread& thread: _threads)
+		thread.join();
+}
+
+void ImageImporter::start(const QStringList& paths, std::shared_ptr<const KnownFiles> knownFiles /* = nullptr */, bool reportMissingFiles /* = false */)
+{
+	Import import;
+	import.paths = paths;
+	import.knownFiles = knownFiles;
+	import.reportMissingFiles = reportMissingFiles;
+
+	if (_job)
+		_queuedImports.push_back(import);
+	else
+		startJob(import);
+}
+
+void ImageImporter::cancel()
+{
+	_queuedImports.clear();
+	if (_job)
+		_job->cancelled = true;
+}
+
+bool ImageImporter::running() const
+{
+	return _job != nullptr;
+}
+
+bool ImageImporter::hasSupportedSuffix(const QString& fileName)
+{
+	return ::hasSupportedSuffix(fileName.constData(), (size_t)fileName.size());
+}
+
+void ImageImporter::startJob(const Import& import)
+{
+	const size_t numWorkers = std::min(maxThreads, std::max(2u, 2 * std::thread::hardware_concurrency()));
+	_job.reset(new Job(numWorkers, import));
+
+	std::vector<FoundFile> files;
+	std::vector<std::vector<QString>> folders(numWorkers);
+	size_t numFolders = 0;
+	for (const QString& path: import.paths)
+	{
+		const QFileInfo info(path);
+		const QString absolutePath = QDir::cleanPath(info.absoluteFilePath());
+		if (info.isDir())
+		{
+			folders[numFolders++ % numWorkers].push_back(absolutePath); // Spread over the workers to get them all going right away
+			_job->roots.push_back(absolutePath);
+		}
+		else if (info.isFile() && hasSupportedSuffix(absolutePath))
+		{
+			const FileStat stat = statFile(absolutePath);
+			const FoundFile file = {absolutePath, (qint64)stat.size, stat.modificationTime, stat.inode, stat.device};
+			fileFound(*_job, file, files);
+			_job->roots.push_back(absolutePath);
+		}
+	}
+
+	for (size_t worker = 0; worker < numWorkers; ++worker)
+		_job->addFolders(worker, folders[worker]);
+
+	_job->addFiles(files);
+
+	for (size_t worker = 0; worker < numWorkers; ++worker)
+		_threads.emplace_back(&ImageImporter::workerThread, std::ref(*_job), worker);
+
+	_pollTimer.start();
+}
+
+void ImageImporter::poll()
+{
+	const bool done = _job->pendingWork == 0 || _job->cancelled;
+	if (done)
+	{
+		for (std::thread& thread: _threads)
+			thread.join();
+
+		_threads.clear();
+	}
+
+	std::vector<Image> images, renamedImages;
+	{
+		std::lock_guard<std::mutex> lock(_job->resultsMutex);
+		images.swap(_job->results);
+		renamedImages.swap(_job->renamedImages);
+	}
+
+	if (!images.empty() || !renamedImages.empty())
+		invokeCallback(&ImageImporterListener::imagesImported, images, renamedImages);
+
+	if (done && !_job->cancelled && _job->reportMissingFiles && _job->knownFiles)
+	{
+		std::vector<QString> missingFiles;
+		for (size_t i = 0; i < _job->knownFiles->size(); ++i)
+		{
+			// Entries listed more than once share the flag of the first one
+			const QString& filePath = (*_job->knownFiles)[i].path;
+			if (!_job->knownFileFound[_job->knownFileIndexByPath.value(filePath)] && std::any_of(_job->roots.begin(), _job->roots.end(), [&filePath](const QString& root) {return isWithin(filePath, root);}))
+				missingFiles.push_back(filePath);
+		}
+
+		if (!missingFiles.empty())
+			invokeCallback(&ImageImporterListener::knownFilesMissing, missingFiles);
+	}
+
+	invokeCallback(&ImageImporterListener::importProgress, (size_t)_job->numFilesFound, (size_t)_job->numFilesProcessed, (size_t)_job->numFilesFailed, done);
+
+	if (!done)
+		return;
+
+	_pollTimer.stop();
+	_job.reset();
+	if (!_queuedImports.empty())
+	{
+		const Import import = _queuedImports.front();
+		_queuedImports.erase(_queuedImports.begin());
+		startJob(import);
+	}
+}
+
+void ImageImporter::workerThread(Job& job, size_t worker)
+{
+	QString folder;
+	std::vector<FoundFile> files;
+	while (!job.cancelled && job.pendingWork > 0)
+	{
+		// Scanning takes priority, it's what keeps all the workers busy
+		if (job.takeFolder(worker, folder))
+		{
+			scanFolder(job, worker, folder);
+			--job.pendingWork;
+		}
+		else if (job.takeFiles(files))
+		{
+			for (const FoundFile& file: files)
+			{
+				if (!job.cancelled)
+					probeFile(job, file);
+
+				--job.pendingWork;
+			}
+		}
+		else // The others are still scanning, there may be more work shortly
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+void ImageImporter::scanFolder(Job& job, size_t worker, const QString& folder)
+{
+	std::vector<QString> subfolders;
+	std::vector<FoundFile> files;
+
+#ifndef _WIN32
+	DIR* dir = opendir(QFile::encodeName(folder).constData());
+	if (!dir)
+		return;
+
+	struct stat folderStat;
+	if (fstat(dirfd(dir), &folderStat) != 0 || !job.markVisited((quint64)folderStat.st_dev, (quint64)folderStat.st_ino))
+	{
+		closedir(dir);
+		return;
+	}
+
+	// d_type spares a stat per entry; it's only needed for the image files (their size and modification time), symbolic links (which are followed) and on file systems that don't report the type
+	while (const dirent* entry = readdir(dir))
+	{
+		if (job.cancelled)
+			break;
+
+		const char* name = entry->d_name;
+		if (name[0] == '.')
+			continue; // ".", ".." and hidden entries
+
+		unsigned char type = entry->d_type;
+		struct stat entryStat;
+		bool statDone = false;
+		if (type == DT_LNK || type == DT_UNKNOWN)
+		{
+			if (fstatat(dirfd(dir), name, &entryStat, 0) != 0)
+				continue; // Dangling link
+
+			type = S_ISDIR(entryStat.st_mode) ? DT_DIR : (S_ISREG(entryStat.st_mode) ? DT_REG : DT_UNKNOWN);
+			statDone = true;
+		}
+
+		if (type == DT_DIR)
+			subfolders.push_back(Image::joinPath(folder, QFile::decodeName(name)));
+		else if (type == DT_REG && ::hasSupportedSuffix(name, strlen(name)))
+		{
+			if (!statDone && fstatat(dirfd(dir), name, &entryStat, 0) != 0)
+				continue; // Gone already
+
+			const FoundFile file = {Image::joinPath(folder, QFile::decodeName(name)), (qint64)entryStat.st_size, (qint64)entryStat.st_mtime, (quint64)entryStat.st_ino, deviceId((quint64)entryStat.st_dev)};
+			fileFound(job, file, files);
+		}
+	}
+
+	closedir(dir);
+#else
+	const QString canonicalPath = QFileInfo(folder).canonicalFilePath();
+	if (canonicalPath.isEmpty() || !job.markVisited(canonicalPath))
+		return;
+
+	const QFileInfoList entries = QDir(folder).entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot);
+	for (const QFileInfo& entry: entries)
+	{
+		if (entry.isDir())
+			subfolders.push_back(entry.absoluteFilePath());
+		else if (hasSupportedSuffix(entry.fileName()))
+		{
+			const FoundFile file = {entry.absoluteFilePath(), entry.size(), entry.lastModified().toMSecsSinceEpoch() / 1000, 0, 0};
+			fileFound(job, file, files);
+		}
+	}
+#endif
+
+	job.addFolders(worker, subfolders);
+	job.addFiles(files);
+}
+
+void ImageImporter::fileFound(Job& job, const FoundFile& file, std::vector<FoundFile>& filesToProbe)
+{
+	++job.numFilesFound;
+
+	const auto knownFile = job.knownFileIndexByPath.constFind(file.path);
+	if (knownFile == job.knownFileIndexByPath.constEnd())
+	{
+		const auto sameInode = file.inode != 0 ? job.knownFileIndexByInode.constFind(qMakePair(file.device, file.inode)) : job.knownFileIndexByInode.constEnd();
+		if (sameInode != job.knownFileIndexByInode.constEnd())
+		{
+			const KnownFile& known = (*job.knownFiles)[sameInode.value()];
+			if (known.params._fileSize == file.size && known.params._modificationTime == file.modificationTime)
+			{
+				const FileStat knownPathStat = statFile(known.path);
+				if (knownPathStat.exists && knownPathStat.inode == file.inode && knownPathStat.device == file.device)
+				{
+					// The known file under another path
+					job.knownFileFound[sameInode.value()] = true;
+					++job.numFilesProcessed;
+					return;
+				}
+
+				// Renamed or moved since it was imported. Two new paths to the same file (hard links) only take the entry along once.
+				if (!job.knownFileFound[sameInode.value()].exchange(true))
+				{
+					std::lock_guard<std::mutex> lock(job.resultsMutex);
+					job.renamedImages.push_back(Image(file.path, known.params, known.id));
+					++job.numFilesProcessed;
+					return;
+				}
+			}
+		}
+
+		filesToProbe.push_back(file);
+		return;
+	}
+
+	job.knownFileFound[knownFile.value()] = true;
+	const ImgParams& params = (*job.knownFiles)[knownFile.value()].params;
+	if (params._fileSize != file.size || (params._modificationTime != 0 && (params._modificationTime != file.modificationTime || params._inode != file.inode)))
+	{
+		filesToProbe.push_back(file);
+		return;
+	}
+
+	if (params._modificationTime == 0 || params._device != file.device)
+	{
+		// Imported before the modification times (or the devices) were kept: the same size is taken for unchanged, and the fingerprint is filled in for the next time
+		ImgParams updatedParams = params;
+		updatedParams._modificationTime = file.modificationTime;
+		updatedParams._inode = file.inode;
+		updatedParams._device = file.device;
+
+		std::lock_guard<std::mutex> lock(job.resultsMutex);
+		job.results.push_back(Image(file.path, updatedParams, Image::pathId(file.path)));
+	}
+
+	++job.numFilesProcessed;
+}
+
+void ImageImporter::probeFile(Job& job, const FoundFile& file)
+{
+	const Image image(file.path);
+	if (image.isValidImage())
+	{
+		ImgParams params = image.params();
+		params._modificationTime = file.modificationTime;
+		params._inode = file.inode;
+		params._device = file.device;
+
+		std::lock_guard<std::mutex> lock(job.resultsMutex);
+		job.results.push_back(Image(file.path, params, image.id()));
+	}
+	else
+		++job.numFilesFailed;
+
+	++job.numFilesProcessed;
+}
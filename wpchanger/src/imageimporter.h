@@ -0,0 +1,86 @@
+#pragma once
+
+#include "image.h"
+#include "utility/callback_caller.hpp"
+
+DISABLE_COMPILER_WARNINGS
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+RESTORE_COMPILER_WARNINGS
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+struct ImageImporterListener {
+	// A batch of new images, and of known ones (see ImageImporter::start) whose files have changed.
+	// renamedImages are the known files that have been renamed or moved since they were imported: the new path, with the ID and the parameters of the known entry.
+	virtual void imagesImported(std::vector<Image> images, std::vector<Image> renamedImages) = 0;
+	// numFilesFound grows as the folders are scanned; numFilesProcessed counts the found files that have been dealt with, numFilesFailed of them couldn't be opened as images
+	virtual void importProgress(size_t numFilesFound, size_t numFilesProcessed, size_t numFilesFailed, bool finished) = 0;
+	// At the end of an import that has asked for it: the known files within the imported paths that the walk hasn't come across.
+	// They are most likely gone, but may as well be in a folder that couldn't be read.
+	virtual void knownFilesMissing(std::vector<QString> filePaths) = 0;
+};
+
+// Imports image files and whole folder trees in the background.
+// A pool of threads walks the folders, each thread working on its own queue of folders and stealing from the others when it runs out.
+// The image files found are probed by whichever threads have no folders to scan, so that probing starts long before the walk is over.
+// Symbolic links are followed, a folder reachable by more than one path is only scanned once.
+// The results are delivered in batches, together with the progress, on the thread that owns the importer (it needs an event loop).
+// Files that have been imported before are only probed again if their size, modification time or inode has changed, so re-importing a folder costs little more than walking it.
+// A known file found under a new path, with the same device, inode, size and modification time, is reported renamed if its known path no longer leads to it.
+class ImageImporter : public CallbackCaller<ImageImporterListener>
+{
+public:
+	// A file imported before, with its parameters at the time
+	struct KnownFile
+	{
+		QString    path;
+		ImgParams  params;
+		qulonglong id;
+	};
+	typedef std::vector<KnownFile> KnownFiles;
+
+	ImageImporter();
+	~ImageImporter();
+
+	// Imports the image files among the paths, and the image files in the folders among them (recursively).
+	// The known files that haven't changed are skipped; with reportMissingFiles, the ones that haven't been found are reported at the end.
+	// If an import is already running, this one starts once it's done.
+	void start(const QStringList& paths, std::shared_ptr<const KnownFiles> knownFiles = nullptr, bool reportMissingFiles = false);
+	// Stops the imports in progress and the queued ones; the images probed so far are still delivered
+	void cancel();
+	bool running() const;
+
+	// Whether the file name ends in one of the image formats the list takes
+	static bool hasSupportedSuffix(const QString& fileName);
+
+private:
+	struct Job;
+	struct FoundFile;
+
+	struct Import
+	{
+		QStringList                       paths;
+		std::shared_ptr<const KnownFiles> knownFiles;
+		bool                              reportMissingFiles;
+	};
+
+	void startJob(const Import& import);
+	// Delivers the results and the progress, finishes the job once its threads are done
+	void poll();
+	static void workerThread(Job& job, size_t worker);
+	static void scanFolder(Job& job, size_t worker, const QString& folder);
+	// Skips the file if it's known and unchanged, reports it renamed if it's a known one under a new path, queues it for probing otherwise
+	static void fileFound(Job& job, const FoundFile& file, std::vector<FoundFile>& filesToProbe);
+	static void probeFile(Job& job, const FoundFile& file);
+
+private:
+	std::unique_ptr<Job>     _job;
+	std::vector<std::thread> _threads;
+	// Imports waiting for the current one to finish
+	std::vector<Import>      _queuedImports;
+	QTimer                   _pollTimer;
+};
@@ -1,139 +1,1229 @@
 #include "imagelist.h"
+#include "idindexmap.h"
 
 DISABLE_COMPILER_WARNINGS
 #include <QDebug>
 #include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
 RESTORE_COMPILER_WARNINGS
 
 #include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <string>
+#include <string.h>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
-ImageList::ImageList()
+// Legacy list file layouts, still readable; lists are always saved in the current format (see listfileformat.h).
+// Version 0 (the original format) is a headerless sequence of [int32 path length][UTF-8 path][raw LegacyImgParams] records.
+// Version 1 starts with the signature and a uint32 version number, its records are
+// [int32 path length][UTF-8 path][int32 width][int32 height][int64 file size][int32 format][int32 display mode][uint64 ID].
+static const quint32 legacyListFileVersion = 1;
+static const qint32 maxPathLength = 32768;
+
+// ImgParams as it was laid out in memory (and thus in version 0 files): the file size used to be 32-bit
+struct LegacyImgParams {
+	qint32 width, height;
+	qint32 fileSize;
+	qint32 format;
+	qint32 displayMode;
+};
+
+template <typename T>
+static bool readValue(std::ifstream& file, T& value)
+{
+	return (bool)file.read((char*)&value, sizeof(value));
+}
+
+// A list file being decoded in the background; the file stays mapped until the decoding is finished
+struct ImageList::PendingPaths
+{
+	PendingPaths() : mappedData(nullptr), data(nullptr), done(false), cancelled(false) {}
+
+	~PendingPaths()
+	{
+		if (mappedData)
+			file.unmap(mappedData);
+	}
+
+	QFile             file;
+	uchar*            mappedData;
+	// The file contents for the file systems that can't be mapped
+	QByteArray        contents;
+	const uchar*      data;
+	ListFile::Header  header;
+
+	std::thread       thread;
+	std::atomic<bool> done;
+	std::atomic<bool> cancelled;
+};
+
+// Copy of all the columns, taken before a batch first removes anything so that it can be rolled back
+struct ImageList::Snapshot
+{
+	explicit Snapshot(const ImageList& list) :
+		ids(list._ids),
+		params(list._params),
+		folderIndexes(list._folderIndexes),
+		nameOffsets(list._nameOffsets),
+		nameLengths(list._nameLengths),
+		perceptualHashes(list._perceptualHashes),
+		nameArena(list._nameArena),
+		folders(list._folders),
+		folderUseCounts(list._folderUseCounts),
+		folderIndexByPath(list._folderIndexByPath),
+		idSet(list._idSet)
+	{
+	}
+
+	void restore(ImageList& list)
+	{
+		list._ids.swap(ids);
+		list._params.swap(params);
+		list._folderIndexes.swap(folderIndexes);
+		list._nameOffsets.swap(nameOffsets);
+		list._nameLengths.swap(nameLengths);
+		list._perceptualHashes.swap(perceptualHashes);
+		list._nameArena.swap(nameArena);
+		list._folders.swap(folders);
+		list._folderUseCounts.swap(folderUseCounts);
+		list._folderIndexByPath.swap(folderIndexByPath);
+		list._idSet.swap(idSet);
+	}
+
+	std::vector<qulonglong>         ids;
+	std::vector<ImgParams>          params;
+	std::vector<quint32>            folderIndexes;
+	std::vector<quint32>            nameOffsets;
+	std::vector<quint16>            nameLengths;
+	std::vector<quint64>            perceptualHashes;
+	std::vector<QChar>              nameArena;
+	std::vector<QString>            folders;
+	std::vector<quint32>            folderUseCounts;
+	QHash<QString, quint32>         folderIndexByPath;
+	std::unordered_set<qulonglong>  idSet;
+};
+
+struct ImageList::Batch
+{
+	Batch() : depth(1), rollbackRequested(false), startSize(0), updatedFields(0) {}
+
+	size_t depth;
+	bool   rollbackRequested;
+	size_t startSize;
+
+	// IDs of the entries added by the batch that are still in the list; those are always the last ones
+	std::unordered_set<qulonglong> insertedIds;
+	// IDs of the entries that had been in the list before the batch and have been removed
+	std::vector<qulonglong>        removedIds;
+	std::vector<qulonglong>        updatedIds;
+	unsigned                       updatedFields;
+
+	// Parameters as they were before each change, in the order of the changes
+	std::vector<std::pair<qulonglong, ImgParams>> paramsUndo;
+	std::unique_ptr<Snapshot>      snapshot;
+};
+
+static ImgParams recordParams(const ListFile::Record& record)
 {
+	ImgParams params;
+	params._width = record.width;
+	params._height = record.height;
+	params._fileSize = record.fileSize;
+	params._fmt = IMGFORMAT(record.format);
+	params._wpDisplayMode = WPOPTIONS(record.displayMode);
+	params._modificationTime = record.modificationTime;
+	params._inode = record.inode;
+	params._device = record.device;
+	return params;
+}
+
+// Headers and records only grow at the end: the fields a file doesn't have are left zeroed (see listfileformat.h)
+template <typename T>
+static void readGrowableStruct(const uchar* data, quint64 storedSize, T& value)
+{
+	memset(&value, 0, sizeof(value));
+	memcpy(&value, data, (size_t)std::min<quint64>(storedSize, sizeof(value)));
+}
+
+// The file must be at least ListFile::minHeaderSize long
+static ListFile::Header readHeader(const uchar* data, quint64 fileSize)
+{
+	ListFile::Header header;
+	readGrowableStruct(data, ListFile::minHeaderSize, header);
+	readGrowableStruct(data, std::min<quint64>(header.headerSize, fileSize), header);
+	return header;
+}
+
+// Whether the path is the given file or folder, or lies within the folder
+static bool isWithin(const QString& path, const QString& folder)
+{
+	return path.startsWith(folder) && (path.size() == folder.size() || folder.endsWith('/') || path[folder.size()] == '/');
+}
+
+static quint64 pathBlockOffset(const uchar* data, const ListFile::Header& header, quint64 entryIndex)
+{
+	quint64 blockOffset = 0;
+	memcpy(&blockOffset, data + header.indexOffset + entryIndex / ListFile::pathBlockSize * sizeof(quint64), sizeof(blockOffset));
+	return blockOffset;
+}
+
+ImageList::ImageList() :
+	_legacyFormatFile(false)
+{
+}
+
+ImageList::~ImageList()
+{
+	finishPathDecoding(true);
 }
 
 size_t ImageList::size() const
 {
-	return _list.size();
+	return _ids.size();
 }
 
 void ImageList::addImage(const Image &image)
 {
-	_list.push_back(image);
-	invokeCallback(&ImageListWatcher::listChanged, size() - 1);
+	appendEntry(image.imageFilePath(), image.params(), image.id());
+	_journal.appendAdd(fileRecord(size() - 1), image.imageFilePath());
+	notifyInserted(size() - 1, 1);
 }
 
-void ImageList::removeImages(const std::vector<size_t> &indexes)
+template <typename Predicate>
+void ImageList::retainEntries(Predicate keep)
 {
-	decltype(_list) newList;
+	finishPathDecoding();
+	if (_batch && !_batch->snapshot)
+		_batch->snapshot.reset(new Snapshot(*this));
 
-	for (size_t i = 0; i < _list.size(); ++i)
+	size_t writeIndex = 0;
+	quint32 nameWriteOffset = 0;
+	for (size_t readIndex = 0, numEntries = size(); readIndex < numEntries; ++readIndex)
 	{
-		if (std::find(indexes.begin(), indexes.end(), i) == indexes.end())
-			newList.push_back(_list[i]);
+		if (!keep(readIndex))
+		{
+			--_folderUseCounts[_folderIndexes[readIndex]];
+			_idSet.erase(_ids[readIndex]);
+			continue;
+		}
+
+		// Names only ever move towards the beginning of the arena, so the ones not yet visited are never overwritten
+		const QChar* name = _nameArena.data() + _nameOffsets[readIndex];
+		std::copy(name, name + _nameLengths[readIndex], _nameArena.begin() + nameWriteOffset);
+
+		_ids[writeIndex] = _ids[readIndex];
+		_params[writeIndex] = _params[readIndex];
+		_folderIndexes[writeIndex] = _folderIndexes[readIndex];
+		_nameLengths[writeIndex] = _nameLengths[readIndex];
+		_perceptualHashes[writeIndex] = _perceptualHashes[readIndex];
+		_nameOffsets[writeIndex] = nameWriteOffset;
+
+		nameWriteOffset += _nameLengths[writeIndex];
+		++writeIndex;
 	}
-	_list = newList;
 
-	invokeCallback(&ImageListWatcher::listChanged, invalid_index);
+	_ids.resize(writeIndex);
+	_params.resize(writeIndex);
+	_folderIndexes.resize(writeIndex);
+	_nameOffsets.resize(writeIndex);
+	_nameLengths.resize(writeIndex);
+	_perceptualHashes.resize(writeIndex);
+	_nameArena.resize(nameWriteOffset);
+}
+
+std::vector<bool> ImageList::markedEntries(const std::vector<size_t>& indexes) const
+{
+	std::vector<bool> marked(size(), false);
+	for (size_t index: indexes)
+	{
+		if (index < marked.size())
+			marked[index] = true;
+	}
+
+	return marked;
+}
+
+void ImageList::removeImages(const std::vector<size_t> &indexes)
+{
+	const std::vector<bool> marked = markedEntries(indexes);
+	std::vector<qulonglong> removedIds;
+	retainEntries([this, &marked, &removedIds](size_t index) {
+		if (!marked[index])
+			return true;
+
+		removedIds.push_back(_ids[index]);
+		return false;
+	});
+
+	if (!removedIds.empty())
+	{
+		_journal.appendRemove(removedIds);
+		notifyRemoved(removedIds);
+	}
 }
 
 void ImageList::clear()
 {
 	invokeCallback(&ImageListWatcher::listCleared);
-	_list.clear();
+
+	finishPathDecoding(true);
+	// Whatever a batch in progress did is gone along with the rest of the list
+	if (_batch)
+	{
+		_journal.endGroup(false);
+		_batch.reset();
+	}
+
+	_ids.clear();
+	_params.clear();
+	_folderIndexes.clear();
+	_nameOffsets.clear();
+	_nameLengths.clear();
+	_perceptualHashes.clear();
+	_nameArena.clear();
+	_folders.clear();
+	_folderUseCounts.clear();
+	_folderIndexByPath.clear();
+	_idSet.clear();
+	_sources.clear();
 }
 
 bool ImageList::empty() const
 {
-	return _list.empty();
+	return _ids.empty();
 }
 
-Image &ImageList::operator [](size_t index)
+Image ImageList::operator [](size_t index) const
 {
-	return _list[index];
+	return Image(filePath(index), _params[index], _ids[index]);
 }
 
-const Image &ImageList::operator [](size_t index) const
+qulonglong ImageList::id(size_t index) const
 {
-	return _list[index];
+	return _ids[index];
 }
 
-bool ImageList::saveList( const QString& filename ) const
+const ImgParams& ImageList::params(size_t index) const
 {
-	std::ofstream file(filename.toStdWString().c_str(), std::ios_base::binary);
-	if (!file.is_open())
-		return false;
+	return _params[index];
+}
+
+QString ImageList::filePath(size_t index) const
+{
+	QString path;
+	if (pendingFilePath(index, path))
+		return path;
+
+	return Image::joinPath(folder(index), fileName(index));
+}
 
-	for (size_t i = 0; i < _list.size(); ++i)
+QString ImageList::fileName(size_t index) const
+{
+	QString path;
+	if (pendingFilePath(index, path))
+	{
+		QString folder, fileName;
+		Image::splitPath(path, folder, fileName);
+		return fileName;
+	}
+
+	return QString(_nameArena.data() + _nameOffsets[index], _nameLengths[index]);
+}
+
+QString ImageList::folder(size_t index) const
+{
+	QString path;
+	if (pendingFilePath(index, path))
+	{
+		QString folder, fileName;
+		Image::splitPath(path, folder, fileName);
+		return folder;
+	}
+
+	return _folders[_folderIndexes[index]];
+}
+
+void ImageList::setStretchMode(size_t index, WPOPTIONS mode)
+{
+	const ImgParams previousParams = _params[index];
+	_params[index]._wpDisplayMode = mode;
+	_journal.appendSetDisplayMode(_ids[index], (quint8)mode);
+	notifyUpdated(_ids[index], previousParams, DisplayModeField);
+}
+
+void ImageList::updateFileParams(size_t index, const ImgParams& fileParams)
+{
+	const ImgParams previousParams = _params[index];
+	ImgParams& params = _params[index];
+	params._width = fileParams._width;
+	params._height = fileParams._height;
+	params._fileSize = fileParams._fileSize;
+	params._fmt = fileParams._fmt;
+	params._modificationTime = fileParams._modificationTime;
+	params._inode = fileParams._inode;
+	params._device = fileParams._device;
+	if (params == previousParams)
+		return;
+
+	// Different contents
+	_perceptualHashes[index] = 0;
+	_journal.appendSetParams(fileRecord(index));
+	notifyUpdated(_ids[index], previousParams, FileParamsField);
+}
+
+const std::vector<QString>& ImageList::sources() const
+{
+	return _sources;
+}
+
+void ImageList::addSources(const std::vector<QString>& paths)
+{
+	std::vector<QString> sources = _sources;
+	for (const QString& path: paths)
 	{
-		const QByteArray path = _list[i].imageFilePath().toUtf8();
-		const int pathSize = path.size();
-		file.write((const char*)&pathSize, sizeof (pathSize));
-		file.write(path.constData(), path.size());
-		file.write((const char*)&_list[i].params(), sizeof(ImgParams));
+		// Covered by one of the sources already
+		if (std::any_of(sources.begin(), sources.end(), [&path](const QString& source) {return isWithin(path, source);}))
+			continue;
+
+		// Covering some of them
+		sources.erase(std::remove_if(sources.begin(), sources.end(), [&path](const QString& source) {
+			return isWithin(source, path);
+		}), sources.end());
+		sources.push_back(path);
 	}
 
+	if (sources == _sources)
+		return;
+
+	_sources.swap(sources);
+	_journal.appendSetSources(_sources);
+}
+
+quint64 ImageList::perceptualHash(size_t index) const
+{
+	return _perceptualHashes[index];
+}
+
+void ImageList::setPerceptualHash(size_t index, quint64 hash)
+{
+	_perceptualHashes[index] = hash;
+}
+
+quint32 ImageList::serializeList(std::vector<char>& contents) const
+{
+	finishPathDecoding();
+
+	std::vector<ListFile::Record> records(size());
+	std::vector<char> pathTable;
+	std::vector<quint64> pathBlockOffsets;
+
+	std::string previousPath;
+	for (size_t i = 0; i < size(); ++i)
+	{
+		const QByteArray utf8Path = filePath(i).toUtf8();
+		const std::string path(utf8Path.constData(), (size_t)utf8Path.size());
+
+		size_t sharedLength = 0;
+		if (i % ListFile::pathBlockSize == 0)
+			pathBlockOffsets.push_back(pathTable.size());
+		else
+		{
+			while (sharedLength < path.size() && sharedLength < previousPath.size() && path[sharedLength] == previousPath[sharedLength])
+				++sharedLength;
+
+			ListFile::appendVarint(pathTable, sharedLength);
+		}
+
+		ListFile::appendVarint(pathTable, path.size() - sharedLength);
+		pathTable.insert(pathTable.end(), path.begin() + sharedLength, path.end());
+		previousPath = path;
+
+		records[i] = fileRecord(i);
+	}
+
+	std::vector<char> sources;
+	ListFile::appendVarint(sources, _sources.size());
+	for (const QString& source: _sources)
+	{
+		const QByteArray utf8Path = source.toUtf8();
+		ListFile::appendVarint(sources, (quint64)utf8Path.size());
+		sources.insert(sources.end(), utf8Path.constData(), utf8Path.constData() + utf8Path.size());
+	}
+
+	ListFile::Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.signature, ListFile::signature, sizeof(header.signature));
+	header.version = ListFile::version;
+	header.headerSize = sizeof(ListFile::Header);
+	header.recordSize = sizeof(ListFile::Record);
+	header.numEntries = records.size();
+	header.recordsOffset = header.headerSize;
+	header.stringTableOffset = header.recordsOffset + records.size() * sizeof(ListFile::Record);
+	header.stringTableSize = pathTable.size();
+	header.indexOffset = header.stringTableOffset + header.stringTableSize;
+	header.pathBlockSize = ListFile::pathBlockSize;
+	header.sourcesOffset = header.indexOffset + pathBlockOffsets.size() * sizeof(quint64);
+	header.sourcesSize = sources.size();
+
+	header.crc = ListFile::crc32(records.data(), records.size() * sizeof(ListFile::Record));
+	header.crc = ListFile::crc32(pathTable.data(), pathTable.size(), header.crc);
+	header.crc = ListFile::crc32(pathBlockOffsets.data(), pathBlockOffsets.size() * sizeof(quint64), header.crc);
+	header.crc = ListFile::crc32(sources.data(), sources.size(), header.crc);
+
+	contents.clear();
+	contents.reserve(sizeof(header) + records.size() * sizeof(ListFile::Record) + pathTable.size() + pathBlockOffsets.size() * sizeof(quint64) + sources.size());
+	contents.insert(contents.end(), (const char*)&header, (const char*)(&header + 1));
+	contents.insert(contents.end(), (const char*)records.data(), (const char*)(records.data() + records.size()));
+	contents.insert(contents.end(), pathTable.begin(), pathTable.end());
+	contents.insert(contents.end(), (const char*)pathBlockOffsets.data(), (const char*)(pathBlockOffsets.data() + pathBlockOffsets.size()));
+	contents.insert(contents.end(), sources.begin(), sources.end());
+	return header.crc;
+}
+
+ListFile::Record ImageList::fileRecord(size_t index) const
+{
+	const ImgParams& params = _params[index];
+
+	ListFile::Record record;
+	memset(&record, 0, sizeof(record));
+	record.id = _ids[index];
+	record.fileSize = params._fileSize;
+	record.perceptualHash = _perceptualHashes[index];
+	record.width = params._width;
+	record.height = params._height;
+	record.format = (quint8)params._fmt;
+	record.displayMode = (quint8)params._wpDisplayMode;
+	record.modificationTime = params._modificationTime;
+	record.inode = params._inode;
+	record.device = params._device;
+	return record;
+}
+
+bool ImageList::saveList( const QString& filename )
+{
+	// Saving to the file the journal belongs to: committing the journal is enough, the full list is only written by an occasional background compaction.
+	// A legacy format file is rewritten in full instead, there's no other point at which it would be upgraded.
+	if (_journal.isOpen() && _journal.listPath() == filename && !_legacyFormatFile)
+	{
+		if (!_journal.commit())
+			return false;
+
+		if (_journal.needsCompaction((quint64)QFileInfo(filename).size()))
+		{
+			std::vector<char> contents;
+			const quint32 checksum = serializeList(contents);
+			_journal.startCompaction(std::move(contents), checksum);
+		}
+
+		return true;
+	}
+
+	// A different file: the changes now belong to it and must not reappear in the previous file
+	_journal.discardUncommittedChanges();
+	_journal.close();
+
+	std::vector<char> contents;
+	const quint32 checksum = serializeList(contents);
+
+	// Written to a temporary file that replaces the old list only once complete
+	QSaveFile file(filename);
+	if (!file.open(QIODevice::WriteOnly) || file.write(contents.data(), (qint64)contents.size()) != (qint64)contents.size() || !file.commit())
+		return false;
+
+	// Any journal lying around belongs to whatever this file used to contain
+	QFile::remove(ListJournal::journalPath(filename));
+	std::vector<ListJournal::Entry> journalEntries;
+	_journal.open(filename, checksum, journalEntries);
+	_legacyFormatFile = false;
 	return true;
 }
 
 bool ImageList::loadList( const QString& filename )
 {
+	QFile file(filename);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	_journal.close();
+
+	ListFile::Header header;
+	const bool currentFormat = file.read((char*)&header, ListFile::minHeaderSize) == ListFile::minHeaderSize && memcmp(header.signature, ListFile::signature, sizeof(header.signature)) == 0 && header.version == ListFile::version;
+	file.close();
+
+	quint32 checksum = 0;
+	const bool loaded = currentFormat ? loadListV2(filename, checksum) : loadLegacyList(filename, checksum);
+
+	if (!loaded)
+		return false;
+
+	_legacyFormatFile = !currentFormat;
+
+	// Recovering the changes made after the file was last written
+	std::vector<ListJournal::Entry> journalEntries;
+	if (_journal.open(filename, checksum, journalEntries) && !journalEntries.empty())
+	{
+		qDebug() << "Replaying" << journalEntries.size() << "journaled changes for" << filename;
+		replayJournal(journalEntries);
+	}
+
+	// The list has been cleared on loading
+	if (!empty())
+		invokeCallback(&ImageListWatcher::imagesInserted, (size_t)0, size());
+
+	return true;
+}
+
+bool ImageList::hasUncommittedChanges() const
+{
+	return _journal.hasUncommittedChanges();
+}
+
+void ImageList::discardUncommittedChanges()
+{
+	_journal.discardUncommittedChanges();
+}
+
+bool ImageList::loadListV2(const QString& filename, quint32& checksum)
+{
+	std::unique_ptr<PendingPaths> pendingPaths(new PendingPaths);
+	pendingPaths->file.setFileName(filename);
+	if (!pendingPaths->file.open(QIODevice::ReadOnly))
+		return false;
+
+	// Reading the whole file is the fallback for the file systems that can't be mapped
+	const qint64 fileSize = pendingPaths->file.size();
+	pendingPaths->mappedData = pendingPaths->file.map(0, fileSize);
+	if (!pendingPaths->mappedData)
+	{
+		pendingPaths->contents = pendingPaths->file.readAll();
+		if (pendingPaths->contents.size() != fileSize)
+			return false;
+	}
+
+	pendingPaths->data = pendingPaths->mappedData ? pendingPaths->mappedData : (const uchar*)pendingPaths->contents.constData();
+	if (!parseListV2(pendingPaths->data, (quint64)fileSize))
+	{
+		qDebug() << "Corrupt list file" << filename;
+		clear();
+		return false;
+	}
+
+	pendingPaths->header = readHeader(pendingPaths->data, (quint64)fileSize);
+	checksum = pendingPaths->header.crc;
+
+	// The entries are usable right away, the paths are filled in behind the scenes
+	_pendingPaths = std::move(pendingPaths);
+	_pendingPaths->thread = std::thread(&ImageList::decodePaths, this);
+	return true;
+}
+
+bool ImageList::parseListV2(const uchar* data, quint64 fileSize)
+{
+	if (fileSize < ListFile::minHeaderSize)
+		return false;
+
+	const ListFile::Header header = readHeader(data, fileSize);
+
+	// Every section must lie within the file; the sizes are checked against the file size first so that the multiplications can't overflow
+	const quint64 numBlocks = (header.numEntries + ListFile::pathBlockSize - 1) / ListFile::pathBlockSize;
+	if (header.headerSize < ListFile::minHeaderSize || header.headerSize > fileSize || header.recordSize < ListFile::minRecordSize ||
+		header.pathBlockSize != ListFile::pathBlockSize || header.numEntries > fileSize / header.recordSize ||
+		header.recordsOffset < header.headerSize || header.recordsOffset > fileSize || header.numEntries * header.recordSize > fileSize - header.recordsOffset ||
+		header.stringTableOffset > fileSize || header.stringTableSize > fileSize - header.stringTableOffset ||
+		header.indexOffset > fileSize || numBlocks > (fileSize - header.indexOffset) / sizeof(quint64) ||
+		header.sourcesOffset > fileSize || header.sourcesSize > fileSize - header.sourcesOffset)
+		return false;
+
+	if (ListFile::crc32(data + header.headerSize, (size_t)(fileSize - header.headerSize)) != header.crc)
+		return false;
+
+	clear();
+	_ids.reserve((size_t)header.numEntries);
+	_params.reserve((size_t)header.numEntries);
+	_perceptualHashes.reserve((size_t)header.numEntries);
+
+	// Only the fixed-size records are read here, see decodePaths()
+	for (quint64 i = 0; i < header.numEntries; ++i)
+	{
+		ListFile::Record record;
+		readGrowableStruct(data + header.recordsOffset + i * header.recordSize, header.recordSize, record);
+
+		// The IDs of a saved list are unique already
+		_ids.push_back(record.id);
+		_params.push_back(recordParams(record));
+		_perceptualHashes.push_back(record.perceptualHash);
+	}
+
+	return parseSources(data + header.sourcesOffset, (size_t)header.sourcesSize);
+}
+
+bool ImageList::parseSources(const uchar* data, size_t size)
+{
+	// Files written before the sources were stored have none
+	if (size == 0)
+		return true;
+
+	quint64 numSources = 0;
+	size_t offset = ListFile::readVarint(data, size, numSources);
+	if (offset == 0 || numSources > size)
+		return false;
+
+	for (quint64 i = 0; i < numSources; ++i)
+	{
+		quint64 length = 0;
+		const size_t consumed = ListFile::readVarint(data + offset, size - offset, length);
+		if (consumed == 0 || length > size - offset - consumed)
+			return false;
+
+		offset += consumed;
+		_sources.push_back(QString::fromUtf8((const char*)data + offset, (int)length));
+		offset += (size_t)length;
+	}
+
+	return true;
+}
+
+void ImageList::decodePaths()
+{
+	const ListFile::Header& header = _pendingPaths->header;
+	const uchar* data = _pendingPaths->data;
+	const size_t numEntries = _ids.size();
+
+	_folderIndexes.reserve(numEntries);
+	_nameOffsets.reserve(numEntries);
+	_nameLengths.reserve(numEntries);
+	_idSet.reserve(numEntries);
+	_idSet.insert(_ids.begin(), _ids.end());
+
+	ListFile::PathReader pathReader(data + header.stringTableOffset, (size_t)header.stringTableSize);
+	for (size_t i = 0; i < numEntries && !_pendingPaths->cancelled; ++i)
+	{
+		const bool blockStart = i % ListFile::pathBlockSize == 0;
+		if (blockStart)
+			pathReader.seek((size_t)pathBlockOffset(data, header, i));
+
+		if (!pathReader.next(blockStart))
+		{
+			// Can only happen to a file written wrong in the first place, the checksum has been verified
+			qDebug() << "Corrupt path table in" << _pendingPaths->file.fileName() << "at entry" << i;
+			while (_folderIndexes.size() < numEntries)
+				appendPath(QString());
+			break;
+		}
+
+		const std::string& path = pathReader.path();
+		appendPath(QString::fromUtf8(path.data(), (int)path.size()));
+	}
+
+	_pendingPaths->done = true;
+}
+
+bool ImageList::pendingFilePath(size_t index, QString& path) const
+{
+	std::lock_guard<std::mutex> lock(_pendingPathsMutex);
+	if (!_pendingPaths)
+		return false;
+
+	if (_pendingPaths->done)
+	{
+		joinPathDecoding(false);
+		return false;
+	}
+
+	const ListFile::Header& header = _pendingPaths->header;
+	const uchar* data = _pendingPaths->data;
+
+	path.clear();
+	ListFile::PathReader pathReader(data + header.stringTableOffset, (size_t)header.stringTableSize);
+	pathReader.seek((size_t)pathBlockOffset(data, header, index));
+	const size_t blockStart = index - index % ListFile::pathBlockSize;
+	for (size_t i = blockStart; i <= index; ++i)
+	{
+		if (!pathReader.next(i == blockStart))
+			return true;
+	}
+
+	const std::string& pathUtf8 = pathReader.path();
+	path = QString::fromUtf8(pathUtf8.data(), (int)pathUtf8.size());
+	return true;
+}
+
+void ImageList::finishPathDecoding(bool cancel /* = false */) const
+{
+	std::lock_guard<std::mutex> lock(_pendingPathsMutex);
+	if (_pendingPaths)
+		joinPathDecoding(cancel);
+}
+
+void ImageList::joinPathDecoding(bool cancel) const
+{
+	// The decoding thread never takes the lock, so it can't be waiting for the caller
+	_pendingPaths->cancelled = cancel;
+	_pendingPaths->thread.join();
+	_pendingPaths.reset();
+}
+
+bool ImageList::loadLegacyList( const QString& filename, quint32& checksum )
+{
+	// Legacy files have no checksum of their own, the journal is tied to the checksum of the whole file instead
+	QFile checksumFile(filename);
+	if (!checksumFile.open(QIODevice::ReadOnly))
+		return false;
+
+	const QByteArray contents = checksumFile.readAll();
+	checksum = ListFile::crc32(contents.constData(), (size_t)contents.size());
+	checksumFile.close();
+
 	std::ifstream file(filename.toStdWString().c_str(), std::ios_base::binary);
 	if (!file.is_open())
 		return false;
 
 	clear();
 
-	char path[3000] = {0};
-	int pathLength = 0;
-	file.read((char*)&pathLength, sizeof (pathLength));
-	if (pathLength >= sizeof(path) / sizeof(char))
-		return false; // Path is too long
+	quint32 version = 0;
+	char signature[sizeof(ListFile::signature)] = {0};
+	if (file.read(signature, sizeof(signature)) && memcmp(signature, ListFile::signature, sizeof(signature)) == 0)
+	{
+		if (!readValue(file, version) || version > legacyListFileVersion)
+			return false;
+	}
+	else
+	{
+		// No signature - version 0 file, the data starts right away
+		file.clear();
+		file.seekg(0);
+	}
 
-	file.read(path, pathLength);
-	while (!file.eof())
+	std::vector<char> path;
+	qint32 pathLength = 0;
+	while (readValue(file, pathLength))
 	{
-		const QString imageFileName = QString::fromUtf8(path, pathLength);
+		if (pathLength < 0 || pathLength >= maxPathLength)
+			return false; // Corrupt file
+
+		path.resize((size_t)pathLength);
+		file.read(path.data(), pathLength);
+
 		ImgParams params;
-		file.read((char*)&params, sizeof(params));
-		_list.push_back(Image(imageFileName, params));
-		file.read((char*)&pathLength, sizeof (pathLength));
-		file.read(path, pathLength);
+		qulonglong id = 0;
+		if (version == 0)
+		{
+			LegacyImgParams legacyParams;
+			readValue(file, legacyParams);
+
+			params._width = legacyParams.width;
+			params._height = legacyParams.height;
+			params._fileSize = (quint32)legacyParams.fileSize; // Sizes above 2 GB had wrapped around
+			params._fmt = IMGFORMAT(legacyParams.format);
+			params._wpDisplayMode = WPOPTIONS(legacyParams.displayMode);
+		}
+		else
+		{
+			qint32 width = 0, height = 0, format = UNKN, displayMode = STRETCHED;
+			qint64 fileSize = 0;
+			readValue(file, width);
+			readValue(file, height);
+			readValue(file, fileSize);
+			readValue(file, format);
+			readValue(file, displayMode);
+			readValue(file, id);
+
+			params._width = width;
+			params._height = height;
+			params._fileSize = fileSize;
+			params._fmt = IMGFORMAT(format);
+			params._wpDisplayMode = WPOPTIONS(displayMode);
+		}
+
+		if (!file)
+			break; // Truncated record
+
+		const QString imagePath = QString::fromUtf8(path.data(), pathLength);
+		// Version 0 files don't store IDs, the path-derived ones are reproduced in the same order on every load
+		appendEntry(imagePath, params, id != 0 ? id : Image::pathId(imagePath));
 	}
 
-	invokeCallback(&ImageListWatcher::listChanged, invalid_index);
 	return true;
 }
 
-//Deletes corresponding files from disk and removes from the list if deletion successful
-bool ImageList::deleteFilesFromDisk(const std::vector<size_t> &indexes)
+void ImageList::replayJournal(const std::vector<ListJournal::Entry>& entries)
 {
-	decltype(_list) newList;
+	// Mapped on the first record that looks an entry up, and kept in step with the list until something is removed
+	IdIndexMap indexById;
+	bool indexUpToDate = false;
+	const auto indexOf = [this, &indexById, &indexUpToDate](qulonglong id) {
+		if (!indexUpToDate)
+		{
+			indexById.assign(_ids);
+			indexUpToDate = true;
+		}
 
-	for (size_t i = 0; i < _list.size(); ++i)
+		return indexById.indexOf(id);
+	};
+
+	for (const ListJournal::Entry& entry: entries)
 	{
-		if (std::find(indexes.begin(), indexes.end(), i) == indexes.end())
-			newList.push_back(_list[i]);
-		else 
+		switch (entry.type)
 		{
-			QFile file (_list[i].imageFilePath());
-			file.setPermissions(file.permissions() | QFile::WriteUser);
-			if (!file.remove())
-			{
-				qDebug() << "failed to remove: " << file.errorString();
-				newList.push_back(_list[i]);
-			}
-			else
+		case ListJournal::AddRecord:
+		{
+			appendEntry(entry.filePath, recordParams(entry.record), entry.record.id, entry.record.perceptualHash);
+			if (indexUpToDate)
+				indexById.append(entry.record.id);
+			break;
+		}
+		case ListJournal::RemoveRecord:
+		{
+			const std::unordered_set<qulonglong> removedIds(entry.ids.begin(), entry.ids.end());
+			retainEntries([this, &removedIds](size_t index) {
+				return removedIds.count(_ids[index]) == 0;
+			});
+			indexUpToDate = false;
+			break;
+		}
+		case ListJournal::SetDisplayModeRecord:
+		{
+			const size_t index = indexOf(entry.ids.front());
+			if (index != invalid_index)
+				_params[index]._wpDisplayMode = WPOPTIONS(entry.displayMode);
+			break;
+		}
+		case ListJournal::SetParamsRecord:
+		{
+			const size_t index = indexOf(entry.record.id);
+			if (index != invalid_index)
 			{
-				qDebug() << "Deleted: " << file.fileName();
+				_params[index] = recordParams(entry.record);
+				_perceptualHashes[index] = entry.record.perceptualHash;
 			}
+			break;
+		}
+		case ListJournal::SetSourcesRecord:
+			_sources = entry.sources;
+			break;
+		default:
+			break;
 		}
 	}
+}
+
+std::vector<QString> ImageList::foldersByImageCount() const
+{
+	finishPathDecoding();
+
+	std::vector<quint32> folderIndexes;
+	for (quint32 i = 0; i < (quint32)_folders.size(); ++i)
+	{
+		if (_folderUseCounts[i] > 0)
+			folderIndexes.push_back(i);
+	}
+
+	std::sort(folderIndexes.begin(), folderIndexes.end(), [this](quint32 l, quint32 r) {
+		return _folderUseCounts[l] > _folderUseCounts[r];
+	});
+
+	std::vector<QString> folders;
+	folders.reserve(folderIndexes.size());
+	for (quint32 folderIndex: folderIndexes)
+		folders.push_back(_folders[folderIndex]);
+
+	return folders;
+}
+
+std::vector<size_t> ImageList::indexesOf(const std::vector<QString>& filePaths) const
+{
+	finishPathDecoding();
+
+	// The paths are matched by the folder index first, so that the file names are only compared within the folders of interest
+	std::vector<size_t> indexes(filePaths.size(), invalid_index);
+	std::vector<QString> fileNames(filePaths.size());
+	std::unordered_map<quint32, std::vector<size_t>> pathsByFolder;
+	for (size_t i = 0; i < filePaths.size(); ++i)
+	{
+		QString folder;
+		Image::splitPath(filePaths[i], folder, fileNames[i]);
+		const auto folderIndex = _folderIndexByPath.constFind(folder);
+		if (folderIndex != _folderIndexByPath.constEnd())
+			pathsByFolder[folderIndex.value()].push_back(i);
+	}
+
+	for (size_t entry = 0, numEntries = size(); entry < numEntries && !pathsByFolder.empty(); ++entry)
+	{
+		const auto paths = pathsByFolder.find(_folderIndexes[entry]);
+		if (paths == pathsByFolder.end())
+			continue;
+
+		const QChar* name = _nameArena.data() + _nameOffsets[entry];
+		for (size_t path: paths->second)
+		{
+			if (fileNames[path].size() == _nameLengths[entry] && std::equal(name, name + _nameLengths[entry], fileNames[path].constData()))
+				indexes[path] = entry;
+		}
+	}
+
+	return indexes;
+}
+
+std::vector<size_t> ImageList::indexesInFolder(const QString& folder) const
+{
+	finishPathDecoding();
+
+	std::vector<size_t> indexes;
+	const auto folderIndex = _folderIndexByPath.constFind(folder);
+	if (folderIndex == _folderIndexByPath.constEnd())
+		return indexes;
+
+	for (size_t entry = 0, numEntries = size(); entry < numEntries; ++entry)
+	{
+		if (_folderIndexes[entry] == folderIndex.value())
+			indexes.push_back(entry);
+	}
 
-	_list = newList;
+	return indexes;
+}
 
-	invokeCallback(&ImageListWatcher::listChanged, invalid_index);
+//Deletes corresponding files from disk and removes from the list if deletion successful
+bool ImageList::deleteFilesFromDisk(const std::vector<size_t> &indexes)
+{
+	const std::vector<bool> marked = markedEntries(indexes);
+	std::vector<qulonglong> removedIds;
+	retainEntries([this, &marked, &removedIds](size_t index) {
+		if (!marked[index])
+			return true;
+
+		QFile file (filePath(index));
+		file.setPermissions(file.permissions() | QFile::WriteUser);
+		if (!file.remove())
+		{
+			qDebug() << "failed to remove: " << file.errorString();
+			return true;
+		}
+		else
+		{
+			qDebug() << "Deleted: " << file.fileName();
+			removedIds.push_back(_ids[index]);
+			return false;
+		}
+	});
+
+	if (!removedIds.empty())
+	{
+		_journal.appendRemove(removedIds);
+		notifyRemoved(removedIds);
+	}
 
 	return true;
 }
+
+void ImageList::beginBatch(size_t expectedInsertions /* = 0 */)
+{
+	if (_batch)
+	{
+		++_batch->depth;
+		return;
+	}
+
+	_batch.reset(new Batch);
+	_batch->startSize = size();
+	_journal.beginGroup();
+
+	if (expectedInsertions > 0)
+	{
+		finishPathDecoding();
+
+		const size_t capacity = size() + expectedInsertions;
+		_ids.reserve(capacity);
+		_params.reserve(capacity);
+		_folderIndexes.reserve(capacity);
+		_nameOffsets.reserve(capacity);
+		_nameLengths.reserve(capacity);
+		_perceptualHashes.reserve(capacity);
+		_idSet.reserve(capacity);
+	}
+}
+
+void ImageList::commitBatch()
+{
+	endBatch(true);
+}
+
+void ImageList::rollbackBatch()
+{
+	endBatch(false);
+}
+
+void ImageList::endBatch(bool commit)
+{
+	if (!_batch)
+		return;
+
+	_batch->rollbackRequested = _batch->rollbackRequested || !commit;
+	if (--_batch->depth > 0)
+		return;
+
+	const std::unique_ptr<Batch> batch(std::move(_batch));
+	if (batch->rollbackRequested)
+	{
+		_journal.endGroup(false);
+
+		if (batch->snapshot)
+			batch->snapshot->restore(*this);
+
+		if (size() > batch->startSize)
+		{
+			const size_t startSize = batch->startSize;
+			retainEntries([startSize](size_t index) {
+				return index < startSize;
+			});
+		}
+
+		// Going backwards, so that the parameters from before the first change are the ones that stick
+		std::unordered_map<qulonglong, ImgParams> previousParams;
+		for (auto undo = batch->paramsUndo.rbegin(); undo != batch->paramsUndo.rend(); ++undo)
+			previousParams[undo->first] = undo->second;
+
+		for (size_t i = 0; i < size() && !previousParams.empty(); ++i)
+		{
+			const auto params = previousParams.find(_ids[i]);
+			if (params != previousParams.end())
+				_params[i] = params->second;
+		}
+
+		return;
+	}
+
+	_journal.endGroup(true);
+
+	if (!batch->removedIds.empty())
+		invokeCallback(&ImageListWatcher::imagesRemoved, batch->removedIds);
+
+	if (!batch->insertedIds.empty())
+		invokeCallback(&ImageListWatcher::imagesInserted, size() - batch->insertedIds.size(), batch->insertedIds.size());
+
+	// The new entries are reported as they are now, and the removed ones are gone
+	if (!batch->updatedIds.empty())
+	{
+		const std::unordered_set<qulonglong> removedIds(batch->removedIds.begin(), batch->removedIds.end());
+		std::sort(batch->updatedIds.begin(), batch->updatedIds.end());
+		batch->updatedIds.erase(std::unique(batch->updatedIds.begin(), batch->updatedIds.end()), batch->updatedIds.end());
+		batch->updatedIds.erase(std::remove_if(batch->updatedIds.begin(), batch->updatedIds.end(), [&batch, &removedIds](qulonglong id) {
+			return batch->insertedIds.count(id) > 0 || removedIds.count(id) > 0;
+		}), batch->updatedIds.end());
+
+		if (!batch->updatedIds.empty())
+			invokeCallback(&ImageListWatcher::imagesUpdated, batch->updatedIds, batch->updatedFields);
+	}
+}
+
+void ImageList::notifyInserted(size_t first, size_t count)
+{
+	if (!_batch)
+	{
+		invokeCallback(&ImageListWatcher::imagesInserted, first, count);
+		return;
+	}
+
+	for (size_t index = first; index < first + count; ++index)
+		_batch->insertedIds.insert(_ids[index]);
+}
+
+void ImageList::notifyRemoved(const std::vector<qulonglong>& ids)
+{
+	if (!_batch)
+	{
+		invokeCallback(&ImageListWatcher::imagesRemoved, ids);
+		return;
+	}
+
+	// An entry both added and removed within the batch is of no interest to anyone
+	for (qulonglong id: ids)
+	{
+		if (_batch->insertedIds.erase(id) == 0)
+			_batch->removedIds.push_back(id);
+	}
+}
+
+void ImageList::notifyUpdated(qulonglong id, const ImgParams& previousParams, unsigned fields)
+{
+	if (!_batch)
+	{
+		invokeCallback(&ImageListWatcher::imagesUpdated, std::vector<qulonglong>(1, id), fields);
+		return;
+	}
+
+	_batch->updatedIds.push_back(id);
+	_batch->updatedFields |= fields;
+	_batch->paramsUndo.emplace_back(id, previousParams);
+}
+
+size_t ImageList::memoryUsage() const
+{
+	finishPathDecoding();
+
+	size_t bytes = _ids.capacity() * sizeof(qulonglong)
+		+ _params.capacity() * sizeof(ImgParams)
+		+ _folderIndexes.capacity() * sizeof(quint32)
+		+ _nameOffsets.capacity() * sizeof(quint32)
+		+ _nameLengths.capacity() * sizeof(quint16)
+		+ _perceptualHashes.capacity() * sizeof(quint64)
+		+ _nameArena.capacity() * sizeof(QChar)
+		+ _folderUseCounts.capacity() * sizeof(quint32)
+		// One node with the ID and the next pointer per entry, plus the bucket array
+		+ _idSet.size() * (sizeof(qulonglong) + sizeof(void*)) + _idSet.bucket_count() * sizeof(void*);
+
+	for (const QString& folder: _folders)
+		bytes += sizeof(QString) + (size_t)folder.capacity() * sizeof(QChar);
+
+	return bytes;
+}
+
+void ImageList::appendEntry(const QString& filePath, const ImgParams& params, qulonglong id, quint64 perceptualHash /* = 0 */)
+{
+	finishPathDecoding();
+
+	_ids.push_back(uniqueId(filePath, id));
+	_idSet.insert(_ids.back());
+	_params.push_back(params);
+	_perceptualHashes.push_back(perceptualHash);
+	appendPath(filePath);
+}
+
+void ImageList::appendPath(const QString& filePath)
+{
+	QString folder, fileName;
+	Image::splitPath(filePath, folder, fileName);
+
+	const quint32 folderIndex = internFolder(folder);
+	++_folderUseCounts[folderIndex];
+
+	_folderIndexes.push_back(folderIndex);
+	_nameOffsets.push_back((quint32)_nameArena.size());
+	_nameLengths.push_back((quint16)fileName.size());
+	_nameArena.insert(_nameArena.end(), fileName.constData(), fileName.constData() + fileName.size());
+}
+
+quint32 ImageList::internFolder(const QString& folder)
+{
+	const auto existing = _folderIndexByPath.constFind(folder);
+	if (existing != _folderIndexByPath.constEnd())
+		return existing.value();
+
+	const quint32 index = (quint32)_folders.size();
+	_folders.push_back(folder);
+	_folderUseCounts.push_back(0);
+	_folderIndexByPath.insert(folder, index);
+	return index;
+}
+
+qulonglong ImageList::uniqueId(const QString& filePath, qulonglong proposedId) const
+{
+	qulonglong id = proposedId;
+	for (quint32 collisionIndex = 1; _idSet.count(id) > 0 || id == invalid_id; ++collisionIndex)
+		id = Image::pathId(filePath, collisionIndex);
+
+	return id;
+}
@@ -1,38 +1,218 @@
 #pragma once
 
 #include "image.h"
+#include "listjournal.h"
 #include "utility/callback_caller.hpp"
 
+DISABLE_COMPILER_WARNINGS
+#include <QChar>
+#include <QHash>
+RESTORE_COMPILER_WARNINGS
+
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
 #include <vector>
 
 const size_t invalid_index = std::numeric_limits<size_t>().max();
 const qulonglong invalid_id = std::numeric_limits<qulonglong>().max();
 
+// Fields of a list entry that can change after it's been added
+enum ImageField {
+	DisplayModeField = 1 << 0,
+	// Dimensions, file size, format and the modification time / inode / device
+	FileParamsField  = 1 << 1
+};
+
+// Every change is reported as a delta, so that a subscriber can do work proportional to the change rather than to the list size
 struct ImageListWatcher {
 	virtual void listCleared() = 0;
-	virtual void listChanged(size_t index) = 0;
+	// Entries [first, first + count) have been appended; a loaded list is reported as cleared and then inserted in full
+	virtual void imagesInserted(size_t first, size_t count) = 0;
+	// The entries with these IDs are gone; the remaining ones kept their order, but their indexes past the first removed entry have shifted
+	virtual void imagesRemoved(std::vector<qulonglong> ids) = 0;
+	// The given fields (a combination of ImageField flags) of the entries with these IDs have changed
+	virtual void imagesUpdated(std::vector<qulonglong> ids, unsigned fields) = 0;
 };
 
+// The list is stored column-wise: IDs, image properties and path parts live in separate arrays.
+// Folders are interned (stored once no matter how many images they contain), file names are packed into a single character arena.
+// A list file is loaded lazily: only the fixed-size records are read up front, the paths are decoded from the still mapped file in the background.
+// Until that's done, a path requested by index is decoded on the spot, and anything that needs all the paths (or changes the list) waits for the decoding.
 class ImageList : public CallbackCaller<ImageListWatcher>
 {
 public:
 	ImageList();
+	~ImageList();
 
 	size_t size () const;
 	void addImage (const Image& image);
 	void removeImages (const std::vector<size_t>& indexes);
 	void clear ();
 	bool empty () const;
-	Image& operator[] (size_t index);
-	const Image& operator[] (size_t index) const;
+	// Materializes the entry as a standalone Image; prefer the per-field accessors below in loops
+	Image operator[] (size_t index) const;
+
+	qulonglong id (size_t index) const;
+	const ImgParams& params (size_t index) const;
+	QString filePath (size_t index) const;
+	QString fileName (size_t index) const;
+	QString folder (size_t index) const;
+
+	void setStretchMode (size_t index, WPOPTIONS mode);
+	// Takes the new dimensions, size, format, modification time, inode and device of a file that has changed on disk; the display mode is kept
+	void updateFileParams (size_t index, const ImgParams& fileParams);
+
+	// The files and folders the list has been imported from, so that it can be rescanned. Stored in the list file; not affected by batch rollbacks.
+	const std::vector<QString>& sources () const;
+	// Absolute paths. A path within one of the sources adds nothing, the sources within a new path are replaced by it.
+	void addSources (const std::vector<QString>& paths);
+
+	// Perceptual hash of the image (see perceptualhash.h), 0 until it's been computed. Kept for the lifetime of the entry, reset when its file changes.
+	quint64 perceptualHash (size_t index) const;
+	void setPerceptualHash (size_t index, quint64 hash);
+
+	// Folders that contain any of the entries, those with the most entries first
+	std::vector<QString> foldersByImageCount () const;
+	// Indexes of the entries with the given paths, invalid_index for the paths that aren't in the list. A single pass over the list.
+	std::vector<size_t> indexesOf (const std::vector<QString>& filePaths) const;
+	std::vector<size_t> indexesInFolder (const QString& folder) const;
 
 	// Deletes corresponding files from disk and removes from the list if deletion successful
 	bool deleteFilesFromDisk (const std::vector<size_t>& indexes);
 
-	bool saveList (const QString& filename) const;
+	// Always saves in the current format; loads the current and all the legacy formats.
+	// Once a list has been saved or loaded, its changes are recorded in a journal next to the file (see ListJournal), and saving it to the same file again only commits the journal.
+	bool saveList (const QString& filename);
 	bool loadList (const QString& filename);
 
+	// Whether there are journaled changes that haven't been saved (e.g. recovered after a crash)
+	bool hasUncommittedChanges () const;
+	// Drops the journaled changes made since the last save, so that they don't come back when the list is loaded next time
+	void discardUncommittedChanges ();
+
+	// Approximate heap memory occupied by the list, in bytes
+	size_t memoryUsage () const;
+
+	// Groups the following changes into a batch: storage for the expected number of new entries is reserved up front,
+	// the watchers get one notification of each kind on commit instead of one per change, and the journal records are written at once.
+	// rollbackBatch() reverts the list to its state at beginBatch() (files deleted from disk stay deleted, though) without notifying anyone.
+	// Nested batches join the outer one, which is committed only if none of them was rolled back. See also ImageListBatch.
+	void beginBatch (size_t expectedInsertions = 0);
+	void commitBatch ();
+	void rollbackBatch ();
+
+private:
+	struct PendingPaths;
+	struct Batch;
+	struct Snapshot;
+
+	// Report the changes to the watchers, or collect them into the current batch
+	void notifyInserted(size_t first, size_t count);
+	void notifyRemoved(const std::vector<qulonglong>& ids);
+	void notifyUpdated(qulonglong id, const ImgParams& previousParams, unsigned fields);
+	void endBatch(bool commit);
+
+	void appendEntry(const QString& filePath, const ImgParams& params, qulonglong id, quint64 perceptualHash = 0);
+	// Appends to the path columns only
+	void appendPath(const QString& filePath);
+	// Keeps the entries for which keep(index) returns true, compacting all the columns in place
+	template <typename Predicate>
+	void retainEntries(Predicate keep);
+	// One flag per entry, set for the given indexes; lets a batch operation test membership in constant time
+	std::vector<bool> markedEntries(const std::vector<size_t>& indexes) const;
+
+	quint32 internFolder(const QString& folder);
+
+	// Produces the current format file contents, returns the checksum from its header
+	quint32 serializeList(std::vector<char>& contents) const;
+	ListFile::Record fileRecord(size_t index) const;
+
+	bool loadListV2(const QString& filename, quint32& checksum);
+	bool parseListV2(const uchar* data, quint64 fileSize);
+	bool parseSources(const uchar* data, size_t size);
+	// Runs on the path decoding thread; fills the path columns and the ID set
+	void decodePaths();
+	// Decodes a single path straight from the list file while the background decoding is still in progress.
+	// Returns false if the path columns can be used instead, i. e. there is no decoding in progress; completes a decoding that has just finished.
+	bool pendingFilePath(size_t index, QString& path) const;
+	// Waits for the background path decoding (or stops it, with cancel = true) and releases the list file
+	void finishPathDecoding(bool cancel = false) const;
+	// The part of finishPathDecoding done under _pendingPathsMutex, with a decoding in progress
+	void joinPathDecoding(bool cancel) const;
+	bool loadLegacyList(const QString& filename, quint32& checksum);
+	void replayJournal(const std::vector<ListJournal::Entry>& entries);
+
+	// Returns the proposed ID if it's not yet taken, or the first free alternative ID for the path otherwise
+	qulonglong uniqueId(const QString& filePath, qulonglong proposedId) const;
+
+private:
+	std::vector<qulonglong>         _ids;
+	std::vector<ImgParams>          _params;
+	std::vector<quint32>            _folderIndexes;
+	std::vector<quint32>            _nameOffsets;
+	std::vector<quint16>            _nameLengths;
+	std::vector<quint64>            _perceptualHashes;
+
+	// File names of all the entries back to back
+	std::vector<QChar>              _nameArena;
+
+	std::vector<QString>            _folders;
+	std::vector<quint32>            _folderUseCounts;
+	QHash<QString, quint32>         _folderIndexByPath;
+
+	std::unordered_set<qulonglong>  _idSet;
+
+	std::vector<QString>            _sources;
+
+	// Set while the paths of a loaded list file are being decoded; the path columns and the ID set belong to the decoding thread until it's finished
+	mutable std::unique_ptr<PendingPaths> _pendingPaths;
+	// The paths are read from several threads at once (e. g. by the image browser), whichever gets to the finished decoding first completes it
+	mutable std::mutex              _pendingPathsMutex;
+
+	std::unique_ptr<Batch>          _batch;
+
+	ListJournal                     _journal;
+	// The journal's list file is in a legacy format, see saveList()
+	bool                            _legacyFormatFile;
+};
+
+// Runs a batch of changes to the list (see ImageList::beginBatch) for the lifetime of the object; the batch is rolled back unless it has been committed.
+// Works with anything providing the batch methods of ImageList, e. g. WallpaperChanger.
+template <class List>
+class ImageListBatch
+{
+public:
+	explicit ImageListBatch(List& list, size_t expectedInsertions = 0) : _list(list), _active(true)
+	{
+		_list.beginBatch(expectedInsertions);
+	}
+
+	~ImageListBatch()
+	{
+		rollback();
+	}
+
+	void commit()
+	{
+		if (_active)
+			_list.commitBatch();
+		_active = false;
+	}
+
+	void rollback()
+	{
+		if (_active)
+			_list.rollbackBatch();
+		_active = false;
+	}
+
+private:
+	ImageListBatch(const ImageListBatch&) = delete;
+	ImageListBatch& operator=(const ImageListBatch&) = delete;
+
 private:
-	std::vector<Image> _list;
+	List& _list;
+	bool  _active;
 };
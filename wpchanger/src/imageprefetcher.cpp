@@ -0,0 +1,58 @@
+#include "imageprefetcher.h"
+#include "wallpaperrendercache.h"
+
+ImagePrefetcher::ImagePrefetcher(WallpaperRenderCache& renderCache) : _renderCache(renderCache), _terminate(false)
+{
+	_thread = std::thread(&ImagePrefetcher::threadFunc, this);
+}
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_terminate = true;
+		_pending.clear();
+	}
+
+	_pendingChanged.notify_one();
+	_thread.join();
+}
+
+void ImagePrefetcher::prefetch(const std::vector<Image>& images, const QSize& screenSize)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_screenSize = screenSize;
+		_pending.assign(images.begin(), images.end());
+	}
+
+	_pendingChanged.notify_one();
+}
+
+void ImagePrefetcher::cancel()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_pending.clear();
+}
+
+void ImagePrefetcher::threadFunc()
+{
+	for (;;)
+	{
+		Image image;
+		QSize screenSize;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_pendingChanged.wait(lock, [this]() {return _terminate || !_pending.empty();});
+			if (_terminate)
+				return;
+
+			image = _pending.front();
+			_pending.pop_front();
+			screenSize = _screenSize;
+		}
+
+		// A no-op if the image has already been rendered
+		_renderCache.renderedWallpaperPath(image, screenSize);
+	}
+}
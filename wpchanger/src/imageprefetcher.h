@@ -0,0 +1,39 @@
+#pragma once
+
+#include "image.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QSize>
+RESTORE_COMPILER_WARNINGS
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WallpaperRenderCache;
+
+// Decodes and renders wallpapers on a background thread ahead of the time they're needed, filling DecodedImageCache and WallpaperRenderCache
+class ImagePrefetcher
+{
+public:
+	explicit ImagePrefetcher(WallpaperRenderCache& renderCache);
+	~ImagePrefetcher();
+
+	// Replaces whatever is still pending with the new set of images; the one being decoded at the moment is finished regardless
+	void prefetch(const std::vector<Image>& images, const QSize& screenSize);
+	void cancel();
+
+private:
+	void threadFunc();
+
+private:
+	WallpaperRenderCache&   _renderCache;
+	QSize                   _screenSize;
+	std::thread             _thread;
+	std::mutex              _mutex;
+	std::condition_variable _pendingChanged;
+	std::deque<Image>       _pending;
+	bool                    _terminate;
+};
@@ -0,0 +1,173 @@
+#include "imagestats.h"
+#include "listfileformat.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+RESTORE_COMPILER_WARNINGS
+
+#include <algorithm>
+#include <limits>
+#include <string.h>
+#include <vector>
+
+namespace {
+
+// The stats file: signature, version, the number of records, the records, and the CRC-32 of all that. Little-endian like the list file.
+const char statsSignature[4] = {'W', 'S', 'T', '\0'};
+const quint32 statsVersion = 1;
+const size_t statsHeaderSize = sizeof(statsSignature) + sizeof(quint32) + sizeof(quint64);
+
+const quint32 favouriteFlag = 1;
+
+struct StatsRecord
+{
+	quint64 id;
+	quint32 timesShown;
+	quint32 timesSkipped;
+	quint32 secondsShown;
+	quint32 flags;
+};
+
+static_assert(sizeof(StatsRecord) == 24, "The stats file record layout must not depend on the compiler");
+
+// Favourites come up this many times as often as the other images
+const double favouriteWeight = 4.0;
+// Even an image that's always skipped keeps coming up now and then
+const double minWeight = 0.05;
+
+}
+
+const ImageStats& ImageStatistics::stats(qulonglong id) const
+{
+	static const ImageStats none;
+	const auto stats = _stats.find(id);
+	return stats != _stats.end() ? stats->second : none;
+}
+
+void ImageStatistics::recordShown(qulonglong id)
+{
+	ImageStats& stats = _stats[id];
+	if (stats.timesShown < std::numeric_limits<quint32>::max())
+		++stats.timesShown;
+}
+
+void ImageStatistics::recordSkipped(qulonglong id)
+{
+	ImageStats& stats = _stats[id];
+	if (stats.timesSkipped < std::numeric_limits<quint32>::max())
+		++stats.timesSkipped;
+}
+
+void ImageStatistics::addSecondsShown(qulonglong id, quint32 seconds)
+{
+	ImageStats& stats = _stats[id];
+	stats.secondsShown = (quint32)std::min<quint64>((quint64)stats.secondsShown + seconds, std::numeric_limits<quint32>::max());
+}
+
+void ImageStatistics::setFavourite(qulonglong id, bool favourite)
+{
+	if (favourite || _stats.count(id) != 0)
+		_stats[id].favourite = favourite;
+}
+
+void ImageStatistics::remove(qulonglong id)
+{
+	_stats.erase(id);
+}
+
+void ImageStatistics::clear()
+{
+	_stats.clear();
+}
+
+double ImageStatistics::weight(const ImageStats& stats)
+{
+	// Demoted by the share of the showings that ended with a skip: an image skipped every time it comes up ends up at about a quarter
+	double weight = 1.0 / (1.0 + 3.0 * stats.timesSkipped / (stats.timesShown + 1.0));
+	if (stats.favourite)
+		weight *= favouriteWeight;
+
+	return std::max(weight, minWeight);
+}
+
+QString ImageStatistics::statsPath(const QString& listPath)
+{
+	return listPath + ".stats";
+}
+
+bool ImageStatistics::save(const QString& filePath) const
+{
+	std::vector<char> contents(statsHeaderSize + _stats.size() * sizeof(StatsRecord) + sizeof(quint32));
+	char* data = contents.data();
+	memcpy(data, statsSignature, sizeof(statsSignature));
+	memcpy(data + sizeof(statsSignature), &statsVersion, sizeof(statsVersion));
+	const quint64 numRecords = _stats.size();
+	memcpy(data + sizeof(statsSignature) + sizeof(quint32), &numRecords, sizeof(numRecords));
+
+	char* recordData = data + statsHeaderSize;
+	for (const auto& stats: _stats)
+	{
+		const StatsRecord record = {stats.first, stats.second.timesShown, stats.second.timesSkipped, stats.second.secondsShown, stats.second.favourite ? favouriteFlag : 0};
+		memcpy(recordData, &record, sizeof(record));
+		recordData += sizeof(record);
+	}
+
+	const quint32 crc = ListFile::crc32(data, contents.size() - sizeof(quint32));
+	memcpy(recordData, &crc, sizeof(crc));
+
+	QSaveFile file(filePath);
+	if (!file.open(QIODevice::WriteOnly) || file.write(contents.data(), (qint64)contents.size()) != (qint64)contents.size() || !file.commit())
+	{
+		qDebug() << "Failed to save the image statistics to" << filePath << ":" << file.errorString();
+		return false;
+	}
+
+	return true;
+}
+
+bool ImageStatistics::load(const QString& filePath, const std::function<bool (qulonglong)>& isValidId)
+{
+	QFile file(filePath);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	const QByteArray contents = file.readAll();
+	const char* data = contents.constData();
+	const size_t size = (size_t)contents.size();
+	quint32 version = 0;
+	if (size >= statsHeaderSize)
+		memcpy(&version, data + sizeof(statsSignature), sizeof(version));
+	if (size < statsHeaderSize + sizeof(quint32) || memcmp(data, statsSignature, sizeof(statsSignature)) != 0 || version != statsVersion)
+		return false;
+
+	quint64 numRecords = 0;
+	quint32 crc = 0;
+	memcpy(&numRecords, data + sizeof(statsSignature) + sizeof(quint32), sizeof(numRecords));
+	memcpy(&crc, data + size - sizeof(quint32), sizeof(crc));
+	if (numRecords != (size - statsHeaderSize - sizeof(quint32)) / sizeof(StatsRecord) || statsHeaderSize + numRecords * sizeof(StatsRecord) + sizeof(quint32) != size
+		|| ListFile::crc32(data, size - sizeof(quint32)) != crc)
+	{
+		qDebug() << "Discarding corrupt image statistics" << filePath;
+		return false;
+	}
+
+	_stats.clear();
+	_stats.reserve((size_t)numRecords);
+	for (size_t i = 0; i < numRecords; ++i)
+	{
+		StatsRecord record;
+		memcpy(&record, data + statsHeaderSize + i * sizeof(StatsRecord), sizeof(record));
+		if (!isValidId(record.id))
+			continue;
+
+		ImageStats& stats = _stats[record.id];
+		stats.timesShown = record.timesShown;
+		stats.timesSkipped = record.timesSkipped;
+		stats.secondsShown = record.secondsShown;
+		stats.favourite = (record.flags & favouriteFlag) != 0;
+	}
+
+	return true;
+}
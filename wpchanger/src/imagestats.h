@@ -0,0 +1,49 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QString>
+RESTORE_COMPILER_WARNINGS
+
+#include <functional>
+#include <unordered_map>
+
+struct ImageStats
+{
+	ImageStats() : timesShown(0), timesSkipped(0), secondsShown(0), favourite(false) {}
+
+	quint32 timesShown;
+	// Times the user moved on to the next wallpaper while this one was set
+	quint32 timesSkipped;
+	quint32 secondsShown;
+	bool    favourite;
+};
+
+// Usage statistics of the list's images by ID. Only the images that have any are stored, 24 bytes each in the file.
+class ImageStatistics
+{
+public:
+	// All zeros for an image that has none
+	const ImageStats& stats(qulonglong id) const;
+
+	void recordShown(qulonglong id);
+	void recordSkipped(qulonglong id);
+	void addSecondsShown(qulonglong id, quint32 seconds);
+	void setFavourite(qulonglong id, bool favourite);
+
+	void remove(qulonglong id);
+	void clear();
+
+	// How likely the image is to come up in weighted random order, relative to the others (an image without statistics has 1)
+	static double weight(const ImageStats& stats);
+
+	// <list>.stats
+	static QString statsPath(const QString& listPath);
+	bool save(const QString& filePath) const;
+	// Replaces the statistics with the saved ones, dropping the IDs that aren't valid any more. Leaves them as they were and returns false if there's no valid file.
+	bool load(const QString& filePath, const std::function<bool (qulonglong)>& isValidId);
+
+private:
+	std::unordered_map<qulonglong, ImageStats> _stats;
+};
@@ -0,0 +1,100 @@
+#include "listfileformat.h"
+
+namespace ListFile {
+
+namespace {
+
+// Reflected CRC-32 (IEEE 802.3, as in zlib)
+struct Crc32Table
+{
+	Crc32Table()
+	{
+		for (quint32 i = 0; i < 256; ++i)
+		{
+			quint32 value = i;
+			for (int bit = 0; bit < 8; ++bit)
+				value = (value & 1) ? (value >> 1) ^ 0xEDB88320u : value >> 1;
+
+			entries[i] = value;
+		}
+	}
+
+	quint32 entries[256];
+};
+
+}
+
+quint32 crc32(const void* data, size_t size, quint32 crc /* = 0 */)
+{
+	static const Crc32Table table;
+
+	const uchar* bytes = (const uchar*)data;
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i)
+		crc = table.entries[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+void appendVarint(std::vector<char>& buffer, quint64 value)
+{
+	while (value >= 0x80)
+	{
+		buffer.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+
+	buffer.push_back((char)value);
+}
+
+size_t readVarint(const uchar* data, size_t size, quint64& value)
+{
+	value = 0;
+	for (size_t i = 0; i < size && i < 10; ++i)
+	{
+		value |= (quint64)(data[i] & 0x7F) << (7 * i);
+		if ((data[i] & 0x80) == 0)
+			return i + 1;
+	}
+
+	return 0;
+}
+
+PathReader::PathReader(const uchar* table, size_t tableSize) :
+	_table(table),
+	_tableSize(tableSize),
+	_offset(0)
+{
+}
+
+bool PathReader::next(bool blockStart)
+{
+	quint64 sharedLength = 0, suffixLength = 0;
+	size_t consumed = 0;
+	if (!blockStart)
+	{
+		consumed = readVarint(_table + _offset, _tableSize - _offset, sharedLength);
+		if (consumed == 0 || sharedLength > _path.size())
+			return false;
+
+		_offset += consumed;
+	}
+
+	consumed = readVarint(_table + _offset, _tableSize - _offset, suffixLength);
+	if (consumed == 0 || suffixLength > _tableSize - _offset - consumed)
+		return false;
+
+	_offset += consumed;
+	_path.resize((size_t)sharedLength);
+	_path.append((const char*)_table + _offset, (size_t)suffixLength);
+	_offset += (size_t)suffixLength;
+	return true;
+}
+
+void PathReader::seek(size_t offset)
+{
+	_offset = offset < _tableSize ? offset : _tableSize;
+	_path.clear();
+}
+
+}
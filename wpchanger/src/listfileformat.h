@@ -0,0 +1,101 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QtGlobal>
+RESTORE_COMPILER_WARNINGS
+
+#include <string>
+#include <vector>
+
+// Image list file, version 2. Designed to be memory-mapped and read in place; all the numbers are little-endian (as all the supported platforms are).
+//
+//   ListFileHeader
+//   ListFileRecord x numEntries         fixed size, entry i is at recordsOffset + i * recordSize
+//   path string table                   front-coded UTF-8 paths, see below
+//   quint64 x numBlocks                 index: offset of every block of the string table, relative to the table start
+//   sources                             [varint count] then [varint length][UTF-8 path] per source: the files and folders the list has been imported from
+//
+// Paths are front-coded in blocks of pathBlockSize: the first path of a block is stored in full, every other one as
+// [varint length of the prefix shared with the previous path][varint suffix length][suffix bytes].
+// Entries of a list tend to come in runs from the same folder, so most of a path is usually shared with the previous one.
+// The CRC-32 covers everything after the header.
+//
+// The header and the record only ever grow at the end, and headerSize / recordSize tell how big they are in a given file:
+// a reader takes the fields the file has and leaves the newer ones zeroed, so files written before the fields were added remain readable, and vice versa.
+
+namespace ListFile {
+
+const char signature[4] = {'W', 'I', 'L', '\0'};
+const quint32 version = 2;
+const quint32 pathBlockSize = 16;
+
+struct Header
+{
+	char    signature[4];
+	quint32 version;
+	quint32 headerSize;
+	quint32 recordSize;
+	quint64 numEntries;
+	quint64 recordsOffset;
+	quint64 stringTableOffset;
+	quint64 stringTableSize;
+	quint64 indexOffset;
+	quint32 pathBlockSize;
+	quint32 crc;
+	// Added later, 0 in older files
+	quint64 sourcesOffset;
+	quint64 sourcesSize;
+};
+
+struct Record
+{
+	quint64 id;
+	qint64  fileSize;
+	quint64 perceptualHash;
+	qint32  width;
+	qint32  height;
+	quint8  format;
+	quint8  displayMode;
+	quint8  reserved[2];
+	// Taken from the reserved bytes later, 0 in older files
+	quint32 device;
+	// Added later, 0 in older files
+	qint64  modificationTime;
+	quint64 inode;
+};
+
+// The sizes of the original layouts, the smallest a file can have
+const quint32 minHeaderSize = 64;
+const quint32 minRecordSize = 40;
+
+static_assert(sizeof(Header) == 80, "The list file header layout must not depend on the compiler");
+static_assert(sizeof(Record) == 56, "The list file record layout must not depend on the compiler");
+
+quint32 crc32(const void* data, size_t size, quint32 crc = 0);
+
+void appendVarint(std::vector<char>& buffer, quint64 value);
+// Returns the number of bytes consumed, 0 if the varint is malformed or runs past the end
+size_t readVarint(const uchar* data, size_t size, quint64& value);
+
+// Sequential decoder of the front-coded path table
+class PathReader
+{
+public:
+	PathReader(const uchar* table, size_t tableSize);
+
+	// Decodes the next path into path(); returns false on corrupt data
+	bool next(bool blockStart);
+	// Restarts decoding from the given offset, which must be the start of a block
+	void seek(size_t offset);
+	const std::string& path() const { return _path; }
+
+private:
+	const uchar* _table;
+	size_t       _tableSize;
+	size_t       _offset;
+	std::string  _path;
+};
+
+}
@@ -0,0 +1,528 @@
+#include "listjournal.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QDebug>
+#include <QSaveFile>
+RESTORE_COMPILER_WARNINGS
+
+#include <algorithm>
+#include <string.h>
+
+namespace {
+
+const char journalSignature[4] = {'W', 'I', 'L', 'J'};
+const quint32 journalVersion = 2;
+// Version 1 records embed the list file record as it was originally (ListFile::minRecordSize bytes); such journals are upgraded on opening
+const quint32 legacyJournalVersion = 1;
+// Compaction isn't worth it before the journal reaches this size, no matter how small the list is
+const qint64 minCompactionJournalSize = 64 * 1024;
+
+struct JournalHeader
+{
+	char    signature[4];
+	quint32 version;
+	quint32 listChecksum;
+	quint32 reserved;
+};
+
+static_assert(sizeof(JournalHeader) == 16, "The journal header layout must not depend on the compiler");
+
+// Size, type and CRC around the payload
+const size_t recordOverhead = sizeof(quint32) + sizeof(quint8) + sizeof(quint32);
+
+template <typename T>
+void appendValue(std::vector<char>& buffer, const T& value)
+{
+	buffer.insert(buffer.end(), (const char*)&value, (const char*)&value + sizeof(value));
+}
+
+template <typename T>
+bool takeValue(const char*& data, const char* end, T& value)
+{
+	if ((size_t)(end - data) < sizeof(value))
+		return false;
+
+	memcpy(&value, data, sizeof(value));
+	data += sizeof(value);
+	return true;
+}
+
+// The fields missing from a shorter record are left zeroed
+bool takeRecord(const char*& data, const char* end, size_t recordSize, ListFile::Record& record)
+{
+	if ((size_t)(end - data) < recordSize)
+		return false;
+
+	memset(&record, 0, sizeof(record));
+	memcpy(&record, data, std::min(recordSize, sizeof(record)));
+	data += recordSize;
+	return true;
+}
+
+bool parseEntry(quint8 type, const char* payload, const char* end, size_t recordSize, ListJournal::Entry& entry)
+{
+	entry.type = ListJournal::RecordType(type);
+	switch (type)
+	{
+	case ListJournal::AddRecord:
+		if (!takeRecord(payload, end, recordSize, entry.record))
+			return false;
+
+		entry.filePath = QString::fromUtf8(payload, (int)(end - payload));
+		return true;
+	case ListJournal::RemoveRecord:
+	{
+		quint32 count = 0;
+		if (!takeValue(payload, end, count) || (size_t)(end - payload) != count * sizeof(qulonglong))
+			return false;
+
+		entry.ids.resize(count);
+		memcpy(entry.ids.data(), payload, count * sizeof(qulonglong));
+		return true;
+	}
+	case ListJournal::SetDisplayModeRecord:
+		entry.ids.resize(1);
+		return takeValue(payload, end, entry.ids[0]) && takeValue(payload, end, entry.displayMode);
+	case ListJournal::CommitRecord:
+		return payload == end;
+	case ListJournal::CompactionRecord:
+		return takeValue(payload, end, entry.listChecksum) && payload == end;
+	case ListJournal::SetParamsRecord:
+		return takeRecord(payload, end, recordSize, entry.record) && payload == end;
+	case ListJournal::SetSourcesRecord:
+	{
+		quint32 count = 0;
+		if (!takeValue(payload, end, count))
+			return false;
+
+		for (quint32 i = 0; i < count; ++i)
+		{
+			quint32 length = 0;
+			if (!takeValue(payload, end, length) || (size_t)(end - payload) < length)
+				return false;
+
+			entry.sources.push_back(QString::fromUtf8(payload, (int)length));
+			payload += length;
+		}
+
+		return payload == end;
+	}
+	default:
+		return false;
+	}
+}
+
+std::vector<char> entryPayload(const ListJournal::Entry& entry)
+{
+	std::vector<char> payload;
+	switch (entry.type)
+	{
+	case ListJournal::AddRecord:
+	{
+		const QByteArray utf8Path = entry.filePath.toUtf8();
+		appendValue(payload, entry.record);
+		payload.insert(payload.end(), utf8Path.constData(), utf8Path.constData() + utf8Path.size());
+		break;
+	}
+	case ListJournal::RemoveRecord:
+		appendValue(payload, (quint32)entry.ids.size());
+		for (qulonglong id: entry.ids)
+			appendValue(payload, id);
+		break;
+	case ListJournal::SetDisplayModeRecord:
+		appendValue(payload, entry.ids.front());
+		appendValue(payload, entry.displayMode);
+		break;
+	case ListJournal::CommitRecord:
+		break;
+	case ListJournal::CompactionRecord:
+		appendValue(payload, entry.listChecksum);
+		break;
+	case ListJournal::SetParamsRecord:
+		appendValue(payload, entry.record);
+		break;
+	case ListJournal::SetSourcesRecord:
+		appendValue(payload, (quint32)entry.sources.size());
+		for (const QString& source: entry.sources)
+		{
+			const QByteArray utf8Path = source.toUtf8();
+			appendValue(payload, (quint32)utf8Path.size());
+			payload.insert(payload.end(), utf8Path.constData(), utf8Path.constData() + utf8Path.size());
+		}
+		break;
+	}
+
+	return payload;
+}
+
+// [size][type][payload][CRC]
+void appendFramedRecord(std::vector<char>& buffer, quint8 type, const std::vector<char>& payload)
+{
+	const size_t recordStart = buffer.size();
+	buffer.reserve(recordStart + payload.size() + recordOverhead);
+	appendValue(buffer, (quint32)payload.size());
+	appendValue(buffer, type);
+	buffer.insert(buffer.end(), payload.begin(), payload.end());
+	appendValue(buffer, ListFile::crc32(buffer.data() + recordStart + sizeof(quint32), buffer.size() - recordStart - sizeof(quint32)));
+}
+
+}
+
+ListJournal::ListJournal() :
+	_lastCommitEnd(0),
+	_grouping(false),
+	_compactionDone(false),
+	_compactionSucceeded(false),
+	_compactedListChecksum(0),
+	_compactionStartOffset(0)
+{
+}
+
+ListJournal::~ListJournal()
+{
+	close();
+}
+
+QString ListJournal::journalPath(const QString& listPath)
+{
+	return listPath + ".journal";
+}
+
+bool ListJournal::open(const QString& listPath, quint32 listChecksum, std::vector<Entry>& entries)
+{
+	close();
+	entries.clear();
+	_listPath = listPath;
+
+	QFile existingJournal(journalPath(listPath));
+	if (!existingJournal.open(QIODevice::ReadOnly))
+		return createJournal(listChecksum, nullptr, 0);
+
+	const QByteArray contents = existingJournal.readAll();
+	existingJournal.close();
+
+	JournalHeader header;
+	if ((size_t)contents.size() < sizeof(header))
+		return createJournal(listChecksum, nullptr, 0);
+
+	memcpy(&header, contents.constData(), sizeof(header));
+	const bool legacyVersion = header.version == legacyJournalVersion;
+	// The journal of the previous list file, which is only of use if a compaction into this one has been interrupted (legacy journals predate the compaction mark)
+	const bool previousListJournal = header.listChecksum != listChecksum;
+	if (memcmp(header.signature, journalSignature, sizeof(journalSignature)) != 0 || (header.version != journalVersion && !legacyVersion) || (previousListJournal && legacyVersion))
+	{
+		qDebug() << "Discarding stale journal" << journalPath(listPath);
+		return createJournal(listChecksum, nullptr, 0);
+	}
+
+	// Reading up to the first torn or corrupt record
+	const char* const begin = contents.constData();
+	const char* const end = begin + contents.size();
+	const char* position = begin + sizeof(header);
+	qint64 lastCommitEnd = sizeof(header);
+	const size_t recordSize = legacyVersion ? ListFile::minRecordSize : sizeof(ListFile::Record);
+	// The records of a legacy journal rewritten in the current format
+	std::vector<char> upgradedRecords;
+	qint64 upgradedLastCommitEnd = sizeof(header);
+	// Where the records that belong to this list file start in the previous list file's journal, if the compaction mark is there
+	qint64 carriedOverStart = 0;
+	for (;;)
+	{
+		const char* record = position;
+		quint32 payloadSize = 0;
+		quint8 type = 0;
+		if (!takeValue(record, end, payloadSize) || (size_t)(end - record) < payloadSize + sizeof(quint8) + sizeof(quint32))
+			break;
+
+		const quint32 crc = ListFile::crc32(record, payloadSize + sizeof(quint8));
+		takeValue(record, end, type);
+		const char* payload = record;
+		record += payloadSize;
+
+		quint32 storedCrc = 0;
+		takeValue(record, end, storedCrc);
+
+		Entry entry;
+		if (crc != storedCrc || !parseEntry(type, payload, payload + payloadSize, recordSize, entry))
+			break;
+
+		position = record;
+		if (legacyVersion)
+			appendFramedRecord(upgradedRecords, type, entryPayload(entry));
+
+		if (type == CommitRecord || type == CompactionRecord)
+		{
+			// The compaction starts right after a commit, nothing past the mark is committed yet
+			lastCommitEnd = position - begin;
+			upgradedLastCommitEnd = (qint64)(sizeof(header) + upgradedRecords.size());
+		}
+		else
+			entries.push_back(entry);
+
+		if (type == CompactionRecord && previousListJournal && entry.listChecksum == listChecksum)
+		{
+			// Everything up to here is in the list file already
+			carriedOverStart = position - begin;
+			entries.clear();
+		}
+	}
+
+	if (position != end)
+		qDebug() << "Journal" << journalPath(listPath) << "has" << (end - position) << "bytes of damaged data at the end, dropping them";
+
+	if (previousListJournal)
+	{
+		if (carriedOverStart == 0)
+		{
+			qDebug() << "Discarding stale journal" << journalPath(listPath);
+			entries.clear();
+			return createJournal(listChecksum, nullptr, 0);
+		}
+
+		qDebug() << "Completing the interrupted compaction of" << listPath;
+		if (!createJournal(listChecksum, begin + carriedOverStart, (size_t)((position - begin) - carriedOverStart)))
+		{
+			entries.clear();
+			return false;
+		}
+
+		_lastCommitEnd = (qint64)sizeof(JournalHeader) + std::max<qint64>(0, lastCommitEnd - carriedOverStart);
+		return true;
+	}
+
+	if (legacyVersion)
+	{
+		if (!createJournal(listChecksum, upgradedRecords.data(), upgradedRecords.size()))
+		{
+			entries.clear();
+			return false;
+		}
+
+		_lastCommitEnd = upgradedLastCommitEnd;
+		return true;
+	}
+
+	_file.setFileName(journalPath(listPath));
+	if (!_file.open(QIODevice::ReadWrite) || !_file.resize(position - begin) || !_file.seek(position - begin))
+	{
+		qDebug() << "Failed to open journal" << _file.fileName() << ":" << _file.errorString();
+		_file.close();
+		entries.clear();
+		return false;
+	}
+
+	_lastCommitEnd = lastCommitEnd;
+	return true;
+}
+
+void ListJournal::close()
+{
+	finishCompaction(true);
+	_file.close();
+	_listPath.clear();
+	_lastCommitEnd = 0;
+	_grouping = false;
+	_groupRecords.clear();
+}
+
+bool ListJournal::isOpen() const
+{
+	return _file.isOpen();
+}
+
+const QString& ListJournal::listPath() const
+{
+	return _listPath;
+}
+
+void ListJournal::appendAdd(const ListFile::Record& record, const QString& filePath)
+{
+	Entry entry;
+	entry.type = AddRecord;
+	entry.record = record;
+	entry.filePath = filePath;
+	appendRecord(AddRecord, entryPayload(entry));
+}
+
+void ListJournal::appendRemove(const std::vector<qulonglong>& ids)
+{
+	Entry entry;
+	entry.type = RemoveRecord;
+	entry.ids = ids;
+	appendRecord(RemoveRecord, entryPayload(entry));
+}
+
+void ListJournal::appendSetDisplayMode(qulonglong id, quint8 displayMode)
+{
+	Entry entry;
+	entry.type = SetDisplayModeRecord;
+	entry.ids.push_back(id);
+	entry.displayMode = displayMode;
+	appendRecord(SetDisplayModeRecord, entryPayload(entry));
+}
+
+void ListJournal::appendSetParams(const ListFile::Record& record)
+{
+	Entry entry;
+	entry.type = SetParamsRecord;
+	entry.record = record;
+	appendRecord(SetParamsRecord, entryPayload(entry));
+}
+
+void ListJournal::appendSetSources(const std::vector<QString>& sources)
+{
+	Entry entry;
+	entry.type = SetSourcesRecord;
+	entry.sources = sources;
+	appendRecord(SetSourcesRecord, entryPayload(entry));
+}
+
+bool ListJournal::commit()
+{
+	if (!appendRecord(CommitRecord, std::vector<char>()))
+		return false;
+
+	_lastCommitEnd = _file.size();
+	return true;
+}
+
+void ListJournal::beginGroup()
+{
+	_grouping = true;
+}
+
+bool ListJournal::endGroup(bool write)
+{
+	_grouping = false;
+
+	std::vector<char> records;
+	records.swap(_groupRecords);
+	return !write || records.empty() || writeRecords(records);
+}
+
+bool ListJournal::hasUncommittedChanges() const
+{
+	return isOpen() && _file.size() > _lastCommitEnd;
+}
+
+void ListJournal::discardUncommittedChanges()
+{
+	if (!isOpen())
+		return;
+
+	if (!_file.resize(_lastCommitEnd) || !_file.seek(_lastCommitEnd))
+		qDebug() << "Failed to discard the uncommitted changes from" << _file.fileName() << ":" << _file.errorString();
+}
+
+bool ListJournal::needsCompaction(quint64 listFileSize) const
+{
+	return isOpen() && !_compactionThread.joinable() && _file.size() > std::max(minCompactionJournalSize, (qint64)(listFileSize / 4));
+}
+
+void ListJournal::startCompaction(std::vector<char>&& listFileContents, quint32 listChecksum)
+{
+	finishCompaction(true);
+
+	// Once the new list file is in place this journal is stale, the mark lets the records appended after it be recovered anyway should the application die
+	// before finishCompaction() has started the journal over
+	Entry mark;
+	mark.type = CompactionRecord;
+	mark.listChecksum = listChecksum;
+	std::vector<char> markRecord;
+	appendFramedRecord(markRecord, CompactionRecord, entryPayload(mark));
+	if (!writeRecords(markRecord))
+		return; // Without the mark the records appended during the compaction could be lost, the list file is left as it is
+
+	_lastCommitEnd = _file.size();
+	_compactionStartOffset = _file.size();
+	_compactedListChecksum = listChecksum;
+	_compactionSucceeded = false;
+	_compactionDone = false;
+	_compactionThread = std::thread(&ListJournal::writeListFile, this, std::move(listFileContents));
+}
+
+void ListJournal::finishCompaction(bool wait)
+{
+	if (!_compactionThread.joinable() || (!wait && !_compactionDone))
+		return;
+
+	_compactionThread.join();
+	if (!_compactionSucceeded)
+		return; // The old list file is still in place, and so is its journal
+
+	// Carrying over what's been appended while the list file was being written
+	std::vector<char> newRecords((size_t)(_file.size() - _compactionStartOffset));
+	_file.seek(_compactionStartOffset);
+	_file.read(newRecords.data(), (qint64)newRecords.size());
+
+	const qint64 lastCommitEnd = _lastCommitEnd;
+	if (createJournal(_compactedListChecksum, newRecords.data(), newRecords.size()))
+		_lastCommitEnd = (qint64)sizeof(JournalHeader) + std::max<qint64>(0, lastCommitEnd - _compactionStartOffset);
+}
+
+bool ListJournal::appendRecord(RecordType type, const std::vector<char>& payload)
+{
+	if (!isOpen())
+		return false;
+
+	std::vector<char> singleRecord;
+	std::vector<char>& record = _grouping ? _groupRecords : singleRecord;
+	appendFramedRecord(record, (quint8)type, payload);
+
+	return _grouping || writeRecords(record);
+}
+
+bool ListJournal::writeRecords(const std::vector<char>& records)
+{
+	finishCompaction(false);
+
+	if (_file.write(records.data(), (qint64)records.size()) != (qint64)records.size() || !_file.flush())
+	{
+		qDebug() << "Failed to write to journal" << _file.fileName() << ":" << _file.errorString();
+		return false;
+	}
+
+	return true;
+}
+
+bool ListJournal::createJournal(quint32 listChecksum, const char* records, size_t recordsSize)
+{
+	JournalHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.signature, journalSignature, sizeof(journalSignature));
+	header.version = journalVersion;
+	header.listChecksum = listChecksum;
+
+	_file.close();
+	_lastCommitEnd = sizeof(header);
+
+	const QString path = journalPath(_listPath);
+	QSaveFile newJournal(path);
+	const bool created = newJournal.open(QIODevice::WriteOnly) &&
+		newJournal.write((const char*)&header, sizeof(header)) == (qint64)sizeof(header) &&
+		(recordsSize == 0 || newJournal.write(records, (qint64)recordsSize) == (qint64)recordsSize) &&
+		newJournal.commit();
+
+	if (!created)
+		qDebug() << "Failed to create journal" << path << ":" << newJournal.errorString();
+
+	_file.setFileName(path);
+	if (!_file.open(QIODevice::ReadWrite) || !_file.seek(_file.size()))
+	{
+		qDebug() << "Failed to open journal" << path << ":" << _file.errorString();
+		_file.close();
+		return false;
+	}
+
+	return created;
+}
+
+void ListJournal::writeListFile(std::vector<char> contents)
+{
+	QSaveFile file(_listPath);
+	_compactionSucceeded = file.open(QIODevice::WriteOnly) && file.write(contents.data(), (qint64)contents.size()) == (qint64)contents.size() && file.commit();
+	if (!_compactionSucceeded)
+		qDebug() << "Failed to compact the journal into" << _listPath << ":" << file.errorString();
+
+	_compactionDone = true;
+}
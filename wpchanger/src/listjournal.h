@@ -0,0 +1,101 @@
+#pragma once
+
+#include "listfileformat.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QFile>
+#include <QString>
+RESTORE_COMPILER_WARNINGS
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Append-only log of the changes made to an image list since its file was last written in full. Lives next to the list file (<list>.journal).
+// Every change is appended as it happens, so it survives a crash; saving the list only appends a commit mark, making the save cost independent of the list size.
+// The journal is periodically folded into the list file by a background compaction.
+//
+// File layout: [JournalHeader] followed by records of [uint32 payload size][uint8 type][payload][uint32 CRC-32 of type and payload].
+// The header ties the journal to a particular list file contents by the list file checksum; a journal that doesn't match its list file is stale and ignored.
+// The exception is a compaction interrupted right after the new list file has replaced the old one: the compaction mark records the new file's checksum,
+// and the records following it are carried over into a journal for the new file on opening.
+// A torn record at the end (the application died while writing it) ends the replay and is cut off.
+class ListJournal
+{
+public:
+	enum RecordType : quint8 {AddRecord = 1, RemoveRecord = 2, SetDisplayModeRecord = 3, CommitRecord = 4, SetParamsRecord = 5, SetSourcesRecord = 6, CompactionRecord = 7};
+
+	struct Entry
+	{
+		RecordType type;
+		// AddRecord, SetParamsRecord
+		ListFile::Record record;
+		QString filePath;
+		// RemoveRecord; SetDisplayModeRecord uses the first one
+		std::vector<qulonglong> ids;
+		quint8 displayMode;
+		// SetSourcesRecord: the complete new set
+		std::vector<QString> sources;
+		// CompactionRecord: the checksum of the list file being written
+		quint32 listChecksum;
+	};
+
+	ListJournal();
+	~ListJournal();
+
+	static QString journalPath(const QString& listPath);
+
+	// Opens the journal of the list file whose contents have the given checksum, creating a new one if there is none or it's stale.
+	// The changes found in the existing journal are returned for replaying, in order; hasUncommittedChanges() tells if there are any past the last commit.
+	bool open(const QString& listPath, quint32 listChecksum, std::vector<Entry>& entries);
+	void close();
+	bool isOpen() const;
+	const QString& listPath() const;
+
+	void appendAdd(const ListFile::Record& record, const QString& filePath);
+	void appendRemove(const std::vector<qulonglong>& ids);
+	void appendSetDisplayMode(qulonglong id, quint8 displayMode);
+	void appendSetParams(const ListFile::Record& record);
+	void appendSetSources(const std::vector<QString>& sources);
+	bool commit();
+
+	// Between beginGroup() and endGroup() the records are collected in memory, then written with a single write - or dropped, with write = false.
+	// A group must not span a commit().
+	void beginGroup();
+	bool endGroup(bool write);
+
+	bool hasUncommittedChanges() const;
+	// Cuts off everything since the last commit
+	void discardUncommittedChanges();
+
+	// Whether the journal has grown large enough relative to the list to be worth folding into the list file
+	bool needsCompaction(quint64 listFileSize) const;
+	// Writes the new list file contents in the background; the records appended from now on are carried over into the journal of the new list file.
+	// Must be called right after commit(), with the list contents matching the committed state. Marks the point in the journal first, see CompactionRecord.
+	void startCompaction(std::vector<char>&& listFileContents, quint32 listChecksum);
+	// Completes a finished compaction by starting the journal over for the new list file. With wait = true, waits for a compaction in progress first.
+	void finishCompaction(bool wait);
+
+private:
+	bool appendRecord(RecordType type, const std::vector<char>& payload);
+	bool writeRecords(const std::vector<char>& records);
+	// Replaces the journal file with a new one for the given list contents, containing the given records
+	bool createJournal(quint32 listChecksum, const char* records, size_t recordsSize);
+	// Runs on the compaction thread
+	void writeListFile(std::vector<char> contents);
+
+private:
+	QFile   _file;
+	QString _listPath;
+	qint64  _lastCommitEnd;
+
+	bool              _grouping;
+	std::vector<char> _groupRecords;
+
+	std::thread       _compactionThread;
+	std::atomic<bool> _compactionDone;
+	bool              _compactionSucceeded;
+	quint32           _compactedListChecksum;
+	// Journal size when the compaction started - the records past this point belong to the new list file
+	qint64            _compactionStartOffset;
+};
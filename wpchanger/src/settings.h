@@ -9,10 +9,26 @@
 #define SETTINGS_RANDOMIZE "Randomize"
 #define SETTINGS_DEFAULT_RANDOMIZE true
 
+// In random order, favour some images over the others by their statistics (favourites up, frequently skipped ones down) instead of showing every image once per round
+#define SETTINGS_WEIGHTED_RANDOM "WeightedRandom"
+#define SETTINGS_DEFAULT_WEIGHTED_RANDOM false
+
 // Start switching when the program starts
 #define SETTINGS_START_SWITCHING_ON_STARTUP "AutostartSwitching"
 #define SETTINGS_DEFAULT_AUTOSTART true
 
+// Memory budget for decoded images (previews, thumbnails, wallpapers) kept in RAM
+#define SETTINGS_DECODED_IMAGE_CACHE_SIZE "DecodedImageCacheSizeMb"
+#define SETTINGS_DEFAULT_DECODED_IMAGE_CACHE_SIZE 256 // MiB
+
+// Keep the list in sync with the files in its folders as they're added, removed, renamed or modified
+#define SETTINGS_WATCH_FOLDERS "WatchFolders"
+#define SETTINGS_DEFAULT_WATCH_FOLDERS true
+
+// Upper limit for the number of folders watched; the ones with the most images in the list are watched first
+#define SETTINGS_MAX_WATCHED_FOLDERS "MaxWatchedFolders"
+#define SETTINGS_DEFAULT_MAX_WATCHED_FOLDERS 1024
+
 // Path to the active image list file
 #define SETTINGS_IMAGE_LIST_FILE "ActiveImageList"
 
@@ -0,0 +1,258 @@
+#include "shufflebag.h"
+#include "imagelist.h"
+#include "listfileformat.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+RESTORE_COMPILER_WARNINGS
+
+#include <algorithm>
+#include <random>
+#include <string.h>
+
+#if defined _MSC_VER && defined _M_X64
+#include <intrin.h>
+#endif
+
+namespace {
+
+// The bag file: signature, version, the generator state, the number of IDs, the IDs, and the CRC-32 of all that. Little-endian like the list file.
+const char bagSignature[4] = {'W', 'S', 'B', '\0'};
+const quint32 bagVersion = 1;
+const size_t bagHeaderSize = sizeof(bagSignature) + sizeof(quint32) + 4 * sizeof(quint64) + sizeof(quint64);
+
+inline quint64 rotl(quint64 x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+// The full 128-bit product of a and b
+inline void multiply(quint64 a, quint64 b, quint64& high, quint64& low)
+{
+#if defined _MSC_VER && defined _M_X64
+	low = _umul128(a, b, &high);
+#elif defined __SIZEOF_INT128__
+	__extension__ typedef unsigned __int128 uint128;
+	const uint128 product = (uint128)a * b;
+	high = (quint64)(product >> 64);
+	low = (quint64)product;
+#else
+	const quint64 aLow = a & 0xFFFFFFFFu, aHigh = a >> 32, bLow = b & 0xFFFFFFFFu, bHigh = b >> 32;
+	const quint64 lowLow = aLow * bLow, highLow = aHigh * bLow, lowHigh = aLow * bHigh;
+	const quint64 middle = (lowLow >> 32) + (highLow & 0xFFFFFFFFu) + lowHigh;
+	high = aHigh * bHigh + (highLow >> 32) + (middle >> 32);
+	low = (middle << 32) | (lowLow & 0xFFFFFFFFu);
+#endif
+}
+
+template <typename T>
+void appendValue(std::vector<char>& buffer, T value)
+{
+	const size_t offset = buffer.size();
+	buffer.resize(offset + sizeof(value));
+	memcpy(buffer.data() + offset, &value, sizeof(value));
+}
+
+template <typename T>
+T valueAt(const char* data)
+{
+	T value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+}
+
+Xoshiro256::Xoshiro256()
+{
+	std::random_device device;
+	do
+	{
+		for (quint64& word: _s)
+			word = ((quint64)device() << 32) ^ device();
+	} while ((_s[0] | _s[1] | _s[2] | _s[3]) == 0);
+}
+
+quint64 Xoshiro256::next()
+{
+	const quint64 result = rotl(_s[1] * 5, 7) * 9;
+	const quint64 t = _s[1] << 17;
+
+	_s[2] ^= _s[0];
+	_s[3] ^= _s[1];
+	_s[1] ^= _s[2];
+	_s[0] ^= _s[3];
+	_s[2] ^= t;
+	_s[3] = rotl(_s[3], 45);
+
+	return result;
+}
+
+quint64 Xoshiro256::bounded(quint64 range)
+{
+	// The high half of random * range is uniform in [0, range) once the few values of the low half that make it uneven are rejected.
+	// The division that finds them is only needed when the low half is small enough to be one of them, i. e. almost never.
+	quint64 high, low;
+	multiply(next(), range, high, low);
+	if (low < range)
+	{
+		const quint64 threshold = (0 - range) % range;
+		while (low < threshold)
+			multiply(next(), range, high, low);
+	}
+
+	return high;
+}
+
+double Xoshiro256::real()
+{
+	// The top 53 bits, as many as a double's mantissa holds
+	return (double)(next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void Xoshiro256::setState(const quint64 state[4])
+{
+	for (size_t i = 0; i < 4; ++i)
+		_s[i] = state[i];
+}
+
+size_t ShuffleBag::size() const
+{
+	return _ids.size();
+}
+
+bool ShuffleBag::contains(qulonglong id) const
+{
+	return _positions.count(id) != 0;
+}
+
+qulonglong ShuffleBag::draw(const std::vector<qulonglong>& allIds, qulonglong previous)
+{
+	if (_ids.empty())
+	{
+		_ids.reserve(allIds.size());
+		_positions.reserve(allIds.size());
+		for (qulonglong id: allIds)
+		{
+			if (id != previous || allIds.size() == 1)
+				insert(id);
+		}
+
+		if (_ids.empty())
+			return invalid_id;
+	}
+
+	const size_t position = (size_t)_random.bounded(_ids.size());
+	const qulonglong id = _ids[position];
+	removeAt(position);
+	return id;
+}
+
+void ShuffleBag::insert(qulonglong id)
+{
+	if (_positions.emplace(id, _ids.size()).second)
+		_ids.push_back(id);
+}
+
+void ShuffleBag::remove(qulonglong id)
+{
+	const auto position = _positions.find(id);
+	if (position != _positions.end())
+		removeAt(position->second);
+}
+
+void ShuffleBag::clear()
+{
+	_ids.clear();
+	_positions.clear();
+}
+
+void ShuffleBag::removeAt(size_t position)
+{
+	// The last ID takes the place of the removed one
+	_positions.erase(_ids[position]);
+	if (position != _ids.size() - 1)
+	{
+		_ids[position] = _ids.back();
+		_positions[_ids[position]] = position;
+	}
+
+	_ids.pop_back();
+}
+
+QString ShuffleBag::bagPath(const QString& listPath)
+{
+	return listPath + ".shuffle";
+}
+
+bool ShuffleBag::save(const QString& filePath, const std::vector<qulonglong>& returnedIds) const
+{
+	std::vector<qulonglong> ids(_ids);
+	for (qulonglong id: returnedIds)
+	{
+		if (!contains(id) && std::find(ids.begin() + (std::ptrdiff_t)_ids.size(), ids.end(), id) == ids.end())
+			ids.push_back(id);
+	}
+
+	std::vector<char> contents;
+	contents.reserve(bagHeaderSize + ids.size() * sizeof(quint64) + sizeof(quint32));
+	contents.insert(contents.end(), bagSignature, bagSignature + sizeof(bagSignature));
+	appendValue(contents, bagVersion);
+	for (size_t i = 0; i < 4; ++i)
+		appendValue(contents, _random.state()[i]);
+	appendValue(contents, (quint64)ids.size());
+	for (qulonglong id: ids)
+		appendValue(contents, (quint64)id);
+	appendValue(contents, ListFile::crc32(contents.data(), contents.size()));
+
+	QSaveFile file(filePath);
+	if (!file.open(QIODevice::WriteOnly) || file.write(contents.data(), (qint64)contents.size()) != (qint64)contents.size() || !file.commit())
+	{
+		qDebug() << "Failed to save the shuffle state to" << filePath << ":" << file.errorString();
+		return false;
+	}
+
+	return true;
+}
+
+bool ShuffleBag::load(const QString& filePath, const std::function<bool (qulonglong)>& isValidId)
+{
+	QFile file(filePath);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	const QByteArray contents = file.readAll();
+	const char* data = contents.constData();
+	const size_t size = (size_t)contents.size();
+	if (size < bagHeaderSize + sizeof(quint32) || memcmp(data, bagSignature, sizeof(bagSignature)) != 0 || valueAt<quint32>(data + sizeof(bagSignature)) != bagVersion)
+		return false;
+
+	const quint64 numIds = valueAt<quint64>(data + bagHeaderSize - sizeof(quint64));
+	if (numIds != (size - bagHeaderSize - sizeof(quint32)) / sizeof(quint64) || bagHeaderSize + numIds * sizeof(quint64) + sizeof(quint32) != size
+		|| ListFile::crc32(data, size - sizeof(quint32)) != valueAt<quint32>(data + size - sizeof(quint32)))
+	{
+		qDebug() << "Discarding corrupt shuffle state" << filePath;
+		return false;
+	}
+
+	quint64 state[4];
+	for (size_t i = 0; i < 4; ++i)
+		state[i] = valueAt<quint64>(data + sizeof(bagSignature) + sizeof(quint32) + i * sizeof(quint64));
+	if ((state[0] | state[1] | state[2] | state[3]) == 0)
+		return false;
+
+	_random.setState(state);
+	clear();
+	_ids.reserve((size_t)numIds);
+	_positions.reserve((size_t)numIds);
+	for (size_t i = 0; i < numIds; ++i)
+	{
+		const qulonglong id = valueAt<quint64>(data + bagHeaderSize + i * sizeof(quint64));
+		if (isValidId(id))
+			insert(id);
+	}
+
+	return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "compiler/compiler_warnings_control.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QString>
+RESTORE_COMPILER_WARNINGS
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+// xoshiro256** by Blackman and Vigna: fast, 256 bits of state, passes all the usual statistical tests
+class Xoshiro256
+{
+public:
+	// Seeded from std::random_device
+	Xoshiro256();
+
+	quint64 next();
+	// Uniform in [0, range), without the modulo bias (Lemire's multiply-and-reject); range must not be 0
+	quint64 bounded(quint64 range);
+	// Uniform in [0, 1)
+	double real();
+
+	const quint64* state() const { return _s; }
+	// The state must not be all zeros
+	void setState(const quint64 state[4]);
+
+private:
+	quint64 _s[4];
+};
+
+// Random order without repeats: every ID is drawn once before any is drawn again.
+// The IDs left in the current cycle are kept in a vector, a draw swaps a random one to the back and pops it, and a map of their positions
+// lets the list edits go straight into the bag (a new ID joins the current cycle, a removed one is taken out) in O(1) as well.
+// The bag and the generator state can be saved next to the list file, so that a restart resumes the cycle where it was.
+class ShuffleBag
+{
+public:
+	size_t size() const;
+	bool contains(qulonglong id) const;
+
+	// Takes a random ID out of the bag. An empty bag is refilled with allIds first, except for 'previous' (the ID drawn or shown last, if any),
+	// so that the same wallpaper doesn't come twice in a row across cycles either. invalid_id if allIds is empty.
+	qulonglong draw(const std::vector<qulonglong>& allIds, qulonglong previous);
+
+	// Puts the ID into the current cycle if it isn't there already
+	void insert(qulonglong id);
+	void remove(qulonglong id);
+	void clear();
+
+	// <list>.shuffle
+	static QString bagPath(const QString& listPath);
+	// returnedIds: drawn, but not used yet (queued in advance); they're saved as if they were still in the bag
+	bool save(const QString& filePath, const std::vector<qulonglong>& returnedIds) const;
+	// Restores the bag and the generator saved earlier, dropping the IDs that aren't valid any more. Leaves the bag as it was and returns false if there's no valid file.
+	bool load(const QString& filePath, const std::function<bool (qulonglong)>& isValidId);
+
+private:
+	void removeAt(size_t position);
+
+private:
+	Xoshiro256                              _random;
+	// The IDs not drawn yet in the current cycle, in no particular order
+	std::vector<qulonglong>                 _ids;
+	std::unordered_map<qulonglong, size_t>  _positions;
+};
@@ -1,17 +1,22 @@
 #include "wallpaperchanger.h"
+#include "appsettings.h"
+#include "decodedimagecache.h"
+#include "imageprobe.h"
 #include "settings.h"
-#include "settings/csettings.h"
 
 DISABLE_COMPILER_WARNINGS
 #include <QCoreApplication>
 #include <QDebug>
+#include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QSet>
 #include <QSettings>
 #include <QStringList>
 RESTORE_COMPILER_WARNINGS
 
 #include <algorithm>
+#include <limits>
 #include <time.h>
 
 #ifdef _WIN32
@@ -19,23 +24,93 @@ RESTORE_COMPILER_WARNINGS
 #pragma comment(lib, "user32.lib")
 #endif
 
-#define TIMER_INTERVAL 1000
+// Longest single wait of the switch timer, in milliseconds. The timer's clock may stand still while the system is suspended,
+// the deadline's doesn't; waking up at least this often bounds how late a switch comes after a resume.
+#define MAX_SWITCH_TIMER_WAIT (10 * 60 * 1000)
+// Number of wallpapers chosen (and decoded) in advance
+#define LOOK_AHEAD_DEPTH 3
+// Delay between the last change to the list and updating the set of watched folders
+#define WATCHED_FOLDERS_UPDATE_DELAY 2000
+// How long the cached file stats are trusted, in milliseconds
+#define FILE_STAT_MAX_AGE 60000
+// Delay between a change to the shuffle bag or the image statistics and saving them, so that a quick series of switches is saved once
+#define LIST_STATE_SAVE_DELAY 10000
+
+// Records what the file is like now, so that a rescan can tell whether it has changed since (see ImageImporter)
+static void setFingerprint(const QString& filePath, ImgParams& params)
+{
+	const FileStat stat = statFile(filePath);
+	params._modificationTime = stat.modificationTime;
+	params._inode = stat.inode;
+	params._device = stat.device;
+}
+
+// Milliseconds on a clock that never goes back and keeps running while the system is suspended
+static qint64 monotonicTimeMs()
+{
+#if defined _WIN32
+	return (qint64)GetTickCount64();
+#elif defined __APPLE__
+	// Unlike on Linux, CLOCK_MONOTONIC includes the time asleep
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (qint64)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+#elif defined CLOCK_BOOTTIME
+	timespec t;
+	clock_gettime(CLOCK_BOOTTIME, &t);
+	return (qint64)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+#else
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (qint64)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+#endif
+}
 
 WallpaperChanger::WallpaperChanger():
 	_currentWPId(invalid_id),
-	_bUpdatesEnabled(true)
+	_prefetcher(_renderCache),
+	_shownId(invalid_id),
+	_shuffleBagInUse(AppSettings::instance().randomize() && !AppSettings::instance().weightedRandom()),
+	_switching(false),
+	_switchIntervalMs((qint64)interval() * 1000),
+	_lastSwitchTime(monotonicTimeMs())
 {
-	_qTimer.setInterval(TIMER_INTERVAL);
-	_qTimer.setSingleShot(false);
-	QObject::connect(&_qTimer, &QTimer::timeout, [this]() {
-		onTimeout();
+	_switchTimer.setSingleShot(true);
+	QObject::connect(&_switchTimer, &QTimer::timeout, [this]() {
+		onSwitchTimer();
 	});
 
-	srand((unsigned int)time(nullptr));
+	_listStateSaveTimer.setInterval(LIST_STATE_SAVE_DELAY);
+	_listStateSaveTimer.setSingleShot(true);
+	QObject::connect(&_listStateSaveTimer, &QTimer::timeout, [this]() {
+		saveListState();
+	});
 
-	invokeCallback(&WallpaperWatcher::timeToNextSwitch, interval() - 1);
+	// The instance outlives the application object
+	if (QCoreApplication::instance())
+		QObject::connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, [this]() {
+			if (_listStateSaveTimer.isActive())
+				saveListState();
+		});
+
+	DecodedImageCache::instance().setBudget(AppSettings::instance().decodedImageCacheSizeMb() * 1024 * 1024);
+	AppSettings::instance().addSubscriber(this);
 
 	_imageList.addSubscriber(this);
+
+	_watchedFoldersUpdateTimer.setInterval(WATCHED_FOLDERS_UPDATE_DELAY);
+	_watchedFoldersUpdateTimer.setSingleShot(true);
+	QObject::connect(&_watchedFoldersUpdateTimer, &QTimer::timeout, [this]() {
+		updateWatchedFolders();
+	});
+
+	_importer.addSubscriber(this);
+
+	if (AppSettings::instance().watchFolders())
+	{
+		_folderWatcher = FolderWatcher::create();
+		_folderWatcher->addSubscriber(this);
+	}
 }
 
 WallpaperChanger& WallpaperChanger::instance()
@@ -47,20 +122,14 @@ WallpaperChanger& WallpaperChanger::instance()
 
 size_t WallpaperChanger::indexByID(qulonglong id) const
 {
-	assert_and_return_r(_indexById.count(id) > 0, invalid_index);
-	return _indexById.at(id);
+	const size_t index = _idIndex.indexOf(id);
+	assert_and_return_r(index != invalid_index, invalid_index);
+	return index;
 }
 
 qulonglong WallpaperChanger::idByIndex(size_t index) const
 {
-	for (auto it = _indexById.begin(); it != _indexById.end(); ++it)
-	{
-		if (it->second == index)
-			return it->first;
-	}
-
-	return invalid_index;
-
+	return _idIndex.idAt(index);
 }
 
 void WallpaperChanger::setCurrentWpIndex(size_t index)
@@ -83,30 +152,108 @@ bool WallpaperChanger::addImage(const QString &filename, ImgParams params /* = I
 		return false;
 }
 
+void WallpaperChanger::importImages(const QStringList& paths)
+{
+	std::vector<QString> sources;
+	for (const QString& path: paths)
+	{
+		const QFileInfo info(path);
+		if (info.isDir() || (info.isFile() && isSupportedImageFile(path)))
+			sources.push_back(QDir::cleanPath(info.absoluteFilePath()));
+	}
+
+	_imageList.addSources(sources);
+	_importer.start(paths, knownFiles());
+}
+
+bool WallpaperChanger::rescanSources()
+{
+	QStringList paths;
+	for (const QString& source: _imageList.sources())
+		paths.push_back(source);
+
+	if (paths.empty())
+		return false;
+
+	_importer.start(paths, knownFiles(), true);
+	return true;
+}
+
+void WallpaperChanger::cancelImport()
+{
+	_importer.cancel();
+}
+
+bool WallpaperChanger::importInProgress() const
+{
+	return _importer.running();
+}
+
 QImage WallpaperChanger::createQImage( size_t idx ) const
 {
 	if (idx < _imageList.size ())
-		return _imageList[idx].constructQImageObject();
+		return DecodedImageCache::instance().image(_imageList[idx]);
 	else
 		return QImage();
 }
 
-const Image& WallpaperChanger::image( size_t idx ) const
+Image WallpaperChanger::image( size_t idx ) const
 {
 	return _imageList[idx];
 }
 
+void WallpaperChanger::setStretchMode(size_t idx, WPOPTIONS mode)
+{
+	_imageList.setStretchMode(idx, mode);
+}
+
+std::vector<quint64> WallpaperChanger::perceptualHashes() const
+{
+	std::vector<quint64> hashes;
+	hashes.reserve(numImages());
+	for (size_t index = 0, numEntries = numImages(); index < numEntries; ++index)
+		hashes.push_back(_imageList.perceptualHash(index));
+
+	return hashes;
+}
+
+void WallpaperChanger::setPerceptualHashes(const std::vector<ComputedHash>& hashes)
+{
+	for (const ComputedHash& hash: hashes)
+	{
+		const size_t index = _idIndex.indexOf(hash.id);
+		if (index == invalid_index)
+			continue;
+
+		// The modification time isn't known for the entries of old lists that haven't been rescanned
+		const ImgParams& params = _imageList.params(index);
+		if ((quint64)params._fileSize == hash.file.size && (params._modificationTime == 0 || params._modificationTime == hash.file.modificationTime))
+			_imageList.setPerceptualHash(index, hash.hash);
+	}
+}
+
 bool WallpaperChanger::setWallpaper( size_t idx, bool addToHistory /*= true*/ )
 {
 	const bool succ = setWallpaperImpl(idx);
 
 	if (succ)
 	{
-		// Reset timer
-		_qTime.restart();
-		_qTime.start();
+		// The interval counts from the last switch, whatever set the wallpaper
+		_lastSwitchTime = monotonicTimeMs();
+		if (_switching)
+			armSwitchTimer();
 
-		_currentWPId = _imageList[idx].id();
+		const qulonglong id = _imageList.id(idx);
+		if (id != _shownId)
+		{
+			creditDisplayTime();
+			_shownId = id;
+			_stats.recordShown(id);
+			updateWeight(id);
+			scheduleListStateSave();
+		}
+
+		_currentWPId = id;
 		if (addToHistory)
 			_previousWallPapers.addLatest(_currentWPId);
 	}
@@ -122,18 +269,16 @@ void WallpaperChanger::deleteImagesFromDisk(const std::vector<qulonglong> &batch
 	std::vector<size_t> batchIndexes;
 	for (auto id = batchIDs.begin(); id != batchIDs.end(); ++id)
 	{
-		auto index = _indexById.find(*id);
-		if (index != _indexById.end())
-			batchIndexes.push_back(index->second);
+		const size_t index = _idIndex.indexOf(*id);
+		if (index != invalid_index)
+			batchIndexes.push_back(index);
 	}
 
+	for (qulonglong id: batchIDs)
+		DecodedImageCache::instance().remove(id);
+
+	// The history and the current wallpaper are adjusted by imagesRemoved()
 	_imageList.deleteFilesFromDisk(batchIndexes);
-	adjustHistoryForObsoleteImages();
-	if (std::find(batchIDs.begin(), batchIDs.end(), _currentWPId) != batchIDs.end())
-	{
-		_currentWPId = invalid_id;
-		invokeCallback(&WallpaperWatcher::wallpaperChanged, invalid_index);
-	}
 }
 
 // Remove batch of images from the list by their IDs
@@ -142,18 +287,23 @@ void WallpaperChanger::removeImages(const std::vector<qulonglong> &batchIDs)
 	std::vector<size_t> batchIndexes;
 	for (auto id = batchIDs.begin(); id != batchIDs.end(); ++id)
 	{
-		auto index = _indexById.find(*id);
-		if (index != _indexById.end())
-			batchIndexes.push_back(index->second);
+		const size_t index = _idIndex.indexOf(*id);
+		if (index != invalid_index)
+			batchIndexes.push_back(index);
 	}
 
+	for (qulonglong id: batchIDs)
+		DecodedImageCache::instance().remove(id);
+
+	// The history and the current wallpaper are adjusted by imagesRemoved()
 	_imageList.removeImages(batchIndexes);
-	adjustHistoryForObsoleteImages();
 }
 
 // Remove non-existent entries from list
 void WallpaperChanger::removeNonexistentEntries()
 {
+	refreshFileStats();
+
 	std::vector<size_t> toRemove;
 	for (size_t i = 0; i < numImages(); ++i)
 		if (!imageExists(i))
@@ -170,97 +320,391 @@ size_t WallpaperChanger::numImages() const
 // Returns true if image physically exists on disk
 bool WallpaperChanger::imageExists(size_t index) const
 {
-	return index < numImages() && QFileInfo(_imageList[index].imageFilePath()).exists();
+	return index < numImages() && fileStat(index).exists;
+}
+
+FileStat WallpaperChanger::fileStat(size_t index) const
+{
+	const qulonglong id = _imageList.id(index);
+	FileStat stat;
+	if (!_fileStats.find(id, FILE_STAT_MAX_AGE, stat))
+	{
+		stat = statFile(_imageList.filePath(index));
+		_fileStats.insert(id, stat);
+	}
+
+	return stat;
 }
 
-bool WallpaperChanger::saveList(const QString &filename) const
+void WallpaperChanger::refreshFileStats(size_t first /* = 0 */, size_t count /* = invalid_index */) const
 {
-	return _imageList.saveList(filename);
+	const size_t end = first + std::min(count, numImages() - std::min(first, numImages()));
+
+	ImagePaths files;
+	FileStat stat;
+	for (size_t index = first; index < end; ++index)
+	{
+		if (!_fileStats.find(_imageList.id(index), FILE_STAT_MAX_AGE, stat))
+			files.emplace_back(_imageList.id(index), _imageList.filePath(index));
+	}
+
+	refreshFileStats(files);
+}
+
+WallpaperChanger::ImagePaths WallpaperChanger::imagePaths() const
+{
+	ImagePaths paths;
+	paths.reserve(numImages());
+	for (size_t index = 0, numEntries = numImages(); index < numEntries; ++index)
+		paths.emplace_back(_imageList.id(index), _imageList.filePath(index));
+
+	return paths;
+}
+
+std::vector<FileStat> WallpaperChanger::refreshFileStats(const ImagePaths& files, const FileStatProgress& progress /* = FileStatProgress() */) const
+{
+	std::vector<QString> paths;
+	paths.reserve(files.size());
+	for (const auto& file: files)
+		paths.push_back(file.second);
+
+	const std::vector<FileStat> stats = statFiles(paths, progress);
+	for (size_t i = 0; i < files.size(); ++i)
+		_fileStats.insert(files[i].first, stats[i]);
+
+	return stats;
+}
+
+bool WallpaperChanger::saveList(const QString &filename)
+{
+	if (!_imageList.saveList(filename))
+		return false;
+
+	_listFilePath = filename;
+	saveListState();
+	return true;
 }
 
 bool WallpaperChanger::loadList(const QString &filename)
 {
-	if (_qTimer.isActive())
+	if (_switching)
 		startSwitching();
 
-	return _imageList.loadList(filename);
+	// The shuffle state of the list being replaced
+	if (_listStateSaveTimer.isActive())
+		saveListState();
+
+	_listFilePath.clear();
+	if (!_imageList.loadList(filename))
+		return false;
+
+	// Resuming the random cycle where it was; the bag has been filled with the whole list otherwise
+	_listFilePath = filename;
+	const auto isInList = [this](qulonglong id) {
+		return _idIndex.contains(id);
+	};
+	_shuffleBag.load(ShuffleBag::bagPath(filename), isInList);
+
+	if (_stats.load(ImageStatistics::statsPath(filename), isInList))
+	{
+		std::vector<std::pair<qulonglong, double>> weights;
+		weights.reserve(_idIndex.size());
+		for (qulonglong id: _idIndex.ids())
+			weights.emplace_back(id, ImageStatistics::weight(_stats.stats(id)));
+		_weightedSampler.assign(weights);
+	}
+
+	return true;
+}
+
+bool WallpaperChanger::hasUncommittedChanges() const
+{
+	return _imageList.hasUncommittedChanges();
+}
+
+void WallpaperChanger::discardUncommittedChanges()
+{
+	_imageList.discardUncommittedChanges();
 }
 
 void WallpaperChanger::setInterval(int seconds)
 {
-	CSettings().setValue(SETTINGS_INTERVAL, seconds);
+	AppSettings::instance().setInterval(seconds);
 }
 
 
 int WallpaperChanger::interval()
 {
-	return CSettings().value(SETTINGS_INTERVAL, SETTINGS_DEFAULT_INTERVAL).toInt();
+	return AppSettings::instance().interval();
 }
 
 
 int WallpaperChanger::timeLeft() const
 {
-	const int t = interval() - _qTime.elapsed() / 1000;
-	return t >= 0 ? t : 0;
+	if (!_switching)
+		return (int)(_switchIntervalMs / 1000);
+
+	// Rounded up, so that 0 only shows once the switch is due
+	const qint64 msLeft = _lastSwitchTime + _switchIntervalMs - monotonicTimeMs();
+	return msLeft > 0 ? (int)((msLeft + 999) / 1000) : 0;
 }
 
 // Index of the currently set wallpaper (size_t_max if none from the list is set)
 size_t WallpaperChanger::currentWallpaper() const
 {
-	return _indexById.count(_currentWPId) > 0 ? _indexById.at(_currentWPId) : invalid_index;
+	return _idIndex.indexOf(_currentWPId);
 }
 
 bool WallpaperChanger::stopped() const
 {
-	return _qTimer.isActive();
+	return !_switching;
 }
 
-void WallpaperChanger::enableListUpdateCallbacks(bool enable /* = true*/)
+void WallpaperChanger::beginBatch(size_t expectedInsertions /* = 0 */)
 {
-	_bUpdatesEnabled = enable;
+	_imageList.beginBatch(expectedInsertions);
 }
 
-// Signal that image list has changed
-void WallpaperChanger::listChanged(size_t /*index*/)
+void WallpaperChanger::commitBatch()
 {
-	_currentWPId = invalid_id;
+	_imageList.commitBatch();
+}
+
+void WallpaperChanger::rollbackBatch()
+{
+	_imageList.rollbackBatch();
+}
+
+void WallpaperChanger::imagesInserted(size_t first, size_t count)
+{
+	// New entries are always appended. A batch reports its removals first, and the map rebuilt for those already holds the entries the batch has added.
+	const bool mapConsistent = first <= _idIndex.size() && _idIndex.size() <= first + count;
+	assert_r(mapConsistent);
+	if (mapConsistent)
+	{
+		for (size_t index = _idIndex.size(); index < first + count; ++index)
+			_idIndex.append(_imageList.id(index));
+	}
+	else
+		rebuildIdIndex();
+
+	// New images join the current random cycle, the moved ones have been in it all along
+	for (size_t index = first; index < first + count; ++index)
+	{
+		const qulonglong id = _imageList.id(index);
+		if (_movedIds.erase(id) == 0)
+			_shuffleBag.insert(id);
+		updateWeight(id);
+	}
+	_movedIds.clear();
+	scheduleListStateSave();
+
+	scheduleWatchedFoldersUpdate();
+	invokeCallback(&WallpaperWatcher::imagesInserted, first, count);
+}
+
+void WallpaperChanger::imagesRemoved(std::vector<qulonglong> ids)
+{
+	// The entries past the first removed one have moved; the removal has been linear in the list size anyway.
+	// Maps the list as it is now, including the entries a batch has added and is going to report next (see imagesInserted()).
+	rebuildIdIndex();
+
+	for (qulonglong id: ids)
+	{
+		_fileStats.remove(id);
+
+		// Removed and added back under the same ID by the same batch, i. e. renamed: the statistics and the place in the random cycle stay
+		if (_idIndex.contains(id))
+		{
+			_movedIds.insert(id);
+			continue;
+		}
+
+		_shuffleBag.remove(id);
+		_stats.remove(id);
+		_weightedSampler.remove(id);
+	}
+	scheduleListStateSave();
+
 	adjustHistoryForObsoleteImages();
-	for (size_t index = 0; index < _imageList.size(); ++index)
+
+	// Drop the queued wallpapers that are no longer in the list; the queue is topped up on the next switch
+	const size_t queueLength = _upcomingIds.size();
+	_upcomingIds.erase(std::remove_if(_upcomingIds.begin(), _upcomingIds.end(), [this](qulonglong id) {
+		return !_idIndex.contains(id);
+	}), _upcomingIds.end());
+
+	if (_upcomingIds.size() != queueLength)
+		_prefetcher.cancel();
+
+	scheduleWatchedFoldersUpdate();
+
+	const bool currentRemoved = _currentWPId != invalid_id && !_idIndex.contains(_currentWPId);
+	if (currentRemoved)
+		_currentWPId = invalid_id;
+
+	invokeCallback(&WallpaperWatcher::imagesRemoved, ids);
+
+	if (currentRemoved)
+		invokeCallback(&WallpaperWatcher::wallpaperChanged, invalid_index);
+}
+
+void WallpaperChanger::imagesUpdated(std::vector<qulonglong> ids, unsigned fields)
+{
+	if (fields & FileParamsField)
 	{
-		_indexById[_imageList[index].id()] = index;
+		for (qulonglong id: ids)
+			_fileStats.remove(id);
 	}
 
-	if (_bUpdatesEnabled)
-		invokeCallback(&WallpaperWatcher::listChanged, invalid_index);
+	invokeCallback(&WallpaperWatcher::imagesUpdated, ids, fields);
 }
 
 // Signal that image list has been cleared
 void WallpaperChanger::listCleared()
 {
-	_indexById.clear();
+	DecodedImageCache::instance().clear();
+	_fileStats.clear();
+	_idIndex.clear();
+	_upcomingIds.clear();
+	_shuffleBag.clear();
+	_movedIds.clear();
+	_stats.clear();
+	_weightedSampler.clear();
+	_prefetcher.cancel();
 	_currentWPId = invalid_id;
+	scheduleWatchedFoldersUpdate();
+
+	invokeCallback(&WallpaperWatcher::listCleared);
+}
+
+void WallpaperChanger::folderEvents(std::vector<FolderEvent> events)
+{
+	// Looking all the paths up at once, two per event
+	std::vector<QString> paths;
+	paths.reserve(2 * events.size());
+	for (const FolderEvent& event: events)
+	{
+		paths.push_back(event.path);
+		paths.push_back(event.previousPath);
+	}
+
+	const std::vector<size_t> indexes = _imageList.indexesOf(paths);
+
+	std::vector<size_t> removedIndexes;
+	std::vector<Image> renamedImages;
+	QStringList newFiles;
+
+	ImageListBatch<ImageList> batch(_imageList);
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		const FolderEvent& event = events[i];
+		const size_t index = indexes[2 * i], previousIndex = indexes[2 * i + 1];
+		switch (event.type)
+		{
+		case FolderEvent::Removed:
+			if (index != invalid_index)
+				removedIndexes.push_back(index);
+			break;
+		case FolderEvent::Created:
+		case FolderEvent::Modified:
+			if (index != invalid_index)
+			{
+				// Overwritten in place
+				ImgParams fileParams;
+				if (probeImage(event.path, fileParams))
+				{
+					setFingerprint(event.path, fileParams);
+					_imageList.updateFileParams(index, fileParams);
+				}
+
+				DecodedImageCache::instance().remove(_imageList.id(index));
+				_fileStats.remove(_imageList.id(index));
+			}
+			else if (previousIndex != invalid_index)
+			{
+				// Renamed: the entry keeps its ID, and with it its settings and its place in the history
+				renamedImages.push_back(Image(event.path, _imageList.params(previousIndex), _imageList.id(previousIndex)));
+				removedIndexes.push_back(previousIndex);
+			}
+			else if (isSupportedImageFile(event.path))
+				newFiles.push_back(event.path);
+			break;
+		case FolderEvent::FolderChanged:
+			// There's no telling a new file from one that has been removed from the list on purpose, so only the missing files are dealt with
+			findMissingFiles(event.path, removedIndexes);
+			break;
+		}
+	}
+
+	if (!removedIndexes.empty())
+		_imageList.removeImages(removedIndexes);
+
+	for (const Image& image: renamedImages)
+		_imageList.addImage(image);
+
+	const std::vector<ImgParams> newFileParams = probeImages(newFiles);
+	for (int i = 0; i < newFiles.size(); ++i)
+	{
+		ImgParams params = newFileParams[(size_t)i];
+		if (params != ImgParams())
+			setFingerprint(newFiles[i], params);
+
+		addImage(newFiles[i], params);
+	}
+
+	batch.commit();
+}
+
+void WallpaperChanger::onSwitchTimer()
+{
+	// Either the deadline has come, or this is one of the intermediate wake-ups of a long wait
+	if (monotonicTimeMs() >= _lastSwitchTime + _switchIntervalMs)
+	{
+		while (!showNextWallpaper());
+		// The list may be empty, in which case nothing has been set; the next attempt is still an interval away
+		_lastSwitchTime = monotonicTimeMs();
+	}
 
-	if (_bUpdatesEnabled)
-		invokeCallback(&WallpaperWatcher::listCleared);
+	armSwitchTimer();
 }
 
-void WallpaperChanger::onTimeout()
+void WallpaperChanger::settingChanged(const QString& key)
 {
-	int t = interval() - _qTime.elapsed() / 1000;
-	if (t <= 0)
+	if (key == SETTINGS_INTERVAL)
+	{
+		// The next switch comes the new interval after the last one
+		_switchIntervalMs = (qint64)interval() * 1000;
+		if (_switching)
+			armSwitchTimer();
+	}
+	else if (key == SETTINGS_RANDOMIZE || key == SETTINGS_WEIGHTED_RANDOM)
 	{
-		_qTime.restart();
-		t = 0;
-		while (!nextWallpaper());
+		// The wallpapers chosen in advance were picked the other way. If they were drawn from the shuffle bag, they go back into it.
+		if (_shuffleBagInUse)
+		{
+			for (qulonglong id: _upcomingIds)
+				_shuffleBag.insert(id);
+		}
+
+		_shuffleBagInUse = AppSettings::instance().randomize() && !AppSettings::instance().weightedRandom();
+		_upcomingIds.clear();
+		fillUpcomingQueue();
 	}
+}
 
-	invokeCallback(&WallpaperWatcher::timeToNextSwitch, t);
+void WallpaperChanger::armSwitchTimer()
+{
+	const qint64 msLeft = std::max<qint64>(_lastSwitchTime + _switchIntervalMs - monotonicTimeMs(), 0);
+	_switchTimer.start((int)std::min<qint64>(msLeft, MAX_SWITCH_TIMER_WAIT));
 }
 
 // Sets the image as a wallpaper
 bool WallpaperChanger::setWallpaperImpl(size_t idx)
 {
-	const QString normPath = normalizeFileName(image(idx).imageFilePath());
+	// Unless the OS is left to present the image its own way, it gets a screen-sized bitmap that doesn't need any scaling
+	const Image wallpaper = image(idx);
+	const QString normPath = normalizeFileName(_renderCache.renderedWallpaperPath(wallpaper, WallpaperRenderCache::screenSize()));
 
 #ifdef _WIN32
 	{
@@ -270,7 +714,7 @@ bool WallpaperChanger::setWallpaperImpl(size_t idx)
 			Sleep(100);
 			settings.setValue("TileWallpaper", "0");
 		}
-		settings.setValue("WallpaperStyle", image(idx).stretchMode() == CENTERED ? "0" : "6");
+		settings.setValue("WallpaperStyle", wallpaper.stretchMode() == SYSTEM_DEFAULT ? "6" : "0");
 	}
 
 	const BOOL succ =  SystemParametersInfoW(SPI_SETDESKWALLPAPER, 1, (void*)normPath.utf16(), SPIF_UPDATEINIFILE | SPIF_SENDCHANGE);
@@ -288,19 +732,203 @@ bool WallpaperChanger::setWallpaperImpl(size_t idx)
 #endif
 }
 
+void WallpaperChanger::imagesImported(std::vector<Image> images, std::vector<Image> renamedImages)
+{
+	// Renamed: the entry keeps its ID, and with it its settings and its place in the history, as with a rename seen by the folder watcher.
+	// The ones removed from the list while the import was running stay removed.
+	std::vector<size_t> movedIndexes;
+	std::vector<Image> movedImages;
+	for (const Image& image: renamedImages)
+	{
+		const size_t index = _idIndex.indexOf(image.id());
+		if (index != invalid_index)
+		{
+			movedIndexes.push_back(index);
+			movedImages.push_back(image);
+		}
+	}
+
+	const std::unordered_set<size_t> movedIndexSet(movedIndexes.begin(), movedIndexes.end());
+
+	// The files that are in the list already (imported again, or changed since) are updated in place rather than added twice
+	std::vector<QString> paths;
+	paths.reserve(images.size());
+	for (const Image& image: images)
+		paths.push_back(image.imageFilePath());
+
+	const std::vector<size_t> indexes = _imageList.indexesOf(paths);
+	QSet<QString> addedPaths;
+
+	ImageListBatch<ImageList> batch(_imageList, images.size() + movedImages.size());
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		// A new file where a renamed one used to be is new
+		if (indexes[i] == invalid_index || movedIndexSet.count(indexes[i]) > 0)
+		{
+			if (!addedPaths.contains(paths[i]))
+			{
+				addedPaths.insert(paths[i]);
+				_imageList.addImage(images[i]);
+			}
+
+			continue;
+		}
+
+		const ImgParams previousParams = _imageList.params(indexes[i]);
+		_imageList.updateFileParams(indexes[i], images[i].params());
+		if (_imageList.params(indexes[i]) != previousParams)
+			DecodedImageCache::instance().remove(_imageList.id(indexes[i]));
+	}
+
+	if (!movedIndexes.empty())
+		_imageList.removeImages(movedIndexes);
+
+	for (const Image& image: movedImages)
+		_imageList.addImage(image);
+
+	batch.commit();
+}
+
+void WallpaperChanger::importProgress(size_t numFilesFound, size_t numFilesProcessed, size_t numFilesFailed, bool finished)
+{
+	invokeCallback(&WallpaperWatcher::importProgress, numFilesFound, numFilesProcessed, numFilesFailed, finished);
+}
+
+void WallpaperChanger::knownFilesMissing(std::vector<QString> filePaths)
+{
+	// Some of them may just be in folders that couldn't be read; only the files that are really gone are removed
+	const std::vector<FileStat> stats = statFiles(filePaths);
+	const std::vector<size_t> indexes = _imageList.indexesOf(filePaths);
+
+	std::vector<size_t> missingIndexes;
+	for (size_t i = 0; i < filePaths.size(); ++i)
+	{
+		if (!stats[i].exists && indexes[i] != invalid_index)
+		{
+			missingIndexes.push_back(indexes[i]);
+			DecodedImageCache::instance().remove(_imageList.id(indexes[i]));
+		}
+	}
+
+	if (!missingIndexes.empty())
+		_imageList.removeImages(missingIndexes);
+}
+
+void WallpaperChanger::scheduleListStateSave()
+{
+	if (!_listFilePath.isEmpty() && !_listStateSaveTimer.isActive())
+		_listStateSaveTimer.start();
+}
+
+void WallpaperChanger::saveListState()
+{
+	_listStateSaveTimer.stop();
+	if (_listFilePath.isEmpty())
+		return;
+
+	// The wallpapers queued in advance haven't been shown yet
+	std::vector<qulonglong> queuedIds;
+	if (_shuffleBagInUse)
+		queuedIds.assign(_upcomingIds.begin(), _upcomingIds.end());
+
+	_shuffleBag.save(ShuffleBag::bagPath(_listFilePath), queuedIds);
+
+	creditDisplayTime();
+	_stats.save(ImageStatistics::statsPath(_listFilePath));
+}
+
+void WallpaperChanger::creditDisplayTime()
+{
+	if (_shownTimer.isValid() && _shownId != invalid_id && _idIndex.contains(_shownId))
+	{
+		const qint64 seconds = _shownTimer.elapsed() / 1000;
+		if (seconds > 0)
+			_stats.addSecondsShown(_shownId, (quint32)std::min<qint64>(seconds, std::numeric_limits<quint32>::max()));
+	}
+
+	_shownTimer.start();
+}
+
+bool WallpaperChanger::isFavourite(qulonglong id) const
+{
+	return _stats.stats(id).favourite;
+}
+
+void WallpaperChanger::setFavourite(const std::vector<qulonglong>& ids, bool favourite)
+{
+	for (qulonglong id: ids)
+	{
+		if (!_idIndex.contains(id))
+			continue;
+
+		_stats.setFavourite(id, favourite);
+		updateWeight(id);
+	}
+
+	scheduleListStateSave();
+}
+
+void WallpaperChanger::updateWeight(qulonglong id)
+{
+	_weightedSampler.setWeight(id, ImageStatistics::weight(_stats.stats(id)));
+}
+
+void WallpaperChanger::updateWatchedFolders()
+{
+	if (_folderWatcher)
+		_folderWatcher->setFolders(_imageList.foldersByImageCount(), AppSettings::instance().maxWatchedFolders());
+}
+
+void WallpaperChanger::scheduleWatchedFoldersUpdate()
+{
+	if (_folderWatcher)
+		_watchedFoldersUpdateTimer.start();
+}
+
+std::shared_ptr<const ImageImporter::KnownFiles> WallpaperChanger::knownFiles() const
+{
+	std::shared_ptr<ImageImporter::KnownFiles> files = std::make_shared<ImageImporter::KnownFiles>();
+	files->reserve(numImages());
+	for (size_t index = 0, numEntries = numImages(); index < numEntries; ++index)
+	{
+		const ImageImporter::KnownFile file = {_imageList.filePath(index), _imageList.params(index), _imageList.id(index)};
+		files->push_back(file);
+	}
+
+	return files;
+}
+
+void WallpaperChanger::findMissingFiles(const QString& folder, std::vector<size_t>& missingIndexes) const
+{
+	const QStringList files = QDir(folder).entryList(QDir::Files | QDir::Hidden | QDir::System);
+	const QSet<QString> existingFiles = QSet<QString>::fromList(files);
+	for (size_t index: _imageList.indexesInFolder(folder))
+	{
+		if (!existingFiles.contains(_imageList.fileName(index)))
+			missingIndexes.push_back(index);
+	}
+}
+
+void WallpaperChanger::rebuildIdIndex()
+{
+	std::vector<qulonglong> ids;
+	ids.reserve(_imageList.size());
+	for (size_t index = 0; index < _imageList.size(); ++index)
+		ids.push_back(_imageList.id(index));
+
+	_idIndex.assign(ids);
+}
+
 // Check if any of the images from a list provided are in history, adjust history if so (to prevent invalid history record)
 void WallpaperChanger::adjustHistoryForObsoleteImages()
 {
+	// Relies on _idIndex being up to date
 	decltype(_previousWallPapers) newHistory;
 	for (size_t i = 0; i < _previousWallPapers.size(); ++i)
 	{
 		// If image is no longer present - delete it from history
-		for (size_t imageIndex = 0; imageIndex < _imageList.size(); ++imageIndex)
-			if (_imageList[imageIndex].id() == _previousWallPapers[i])
-			{
-				newHistory.addLatest(_previousWallPapers[i]);
-				break;
-			}
+		if (_idIndex.contains(_previousWallPapers[i]))
+			newHistory.addLatest(_previousWallPapers[i]);
 	}
 
 	_previousWallPapers = newHistory;
@@ -317,57 +945,54 @@ QString WallpaperChanger::normalizeFileName( QString filename )
 
 bool WallpaperChanger::isSupportedImageFile( const QString& file )
 {
-	bool supported = false;
-	QString fileToLower (file.toLower());
-	if (fileToLower.contains(".jpg")  ||
-		fileToLower.contains(".jpeg") ||
-		fileToLower.contains(".bmp")  ||
-		fileToLower.contains(".png")  ||
-		fileToLower.contains(".gif") ||
-		fileToLower.contains(".tif")  ||
-		fileToLower.contains(".tiff")
-		)
-	{
-		supported = true;
-	}
-
-	return supported;
+	return ImageImporter::hasSupportedSuffix(file);
 }
 
 //Switching
 void WallpaperChanger::startSwitching ()
 {
-	_qTime.restart();
-	_qTime.start();
-	_qTimer.start();
+	_switching = true;
+	_switchIntervalMs = (qint64)interval() * 1000;
+	_lastSwitchTime = monotonicTimeMs();
+	armSwitchTimer();
 }
 
 void WallpaperChanger::stopSwitching ()
 {
-	_qTimer.stop();
+	_switching = false;
+	_switchTimer.stop();
 }
 
 bool WallpaperChanger::nextWallpaper()
+{
+	// Asked for by the user before the interval is up: the wallpaper being replaced counts as skipped
+	if (_currentWPId != invalid_id && _idIndex.contains(_currentWPId))
+	{
+		_stats.recordSkipped(_currentWPId);
+		updateWeight(_currentWPId);
+		scheduleListStateSave();
+	}
+
+	return showNextWallpaper();
+}
+
+bool WallpaperChanger::showNextWallpaper()
 {
 	if (numImages() <= 0)
 		return true;
 
 	if (_previousWallPapers.empty() || _previousWallPapers.isAtEnd())
 	{
-		// Choosing new wallpaper
-		const bool randomize = CSettings().value(SETTINGS_RANDOMIZE, SETTINGS_DEFAULT_RANDOMIZE).toBool();
-		size_t newWpIndex = invalid_index;
-		if (randomize)
-		{
-			newWpIndex = (((size_t)rand() << 16) | rand()) % _imageList.size();
-		}
-		else
-		{
-			size_t currentWpIndex = indexByID(_currentWPId);
-			newWpIndex = currentWpIndex < _imageList.size() - 1 ? currentWpIndex + 1 : 0;
-		}
-		_previousWallPapers.addLatest(_imageList[newWpIndex].id());
-		return setWallpaper(newWpIndex, false);
+		// Taking the next wallpaper from the look-ahead queue
+		if (_upcomingIds.empty())
+			fillUpcomingQueue();
+
+		const size_t newWpIndex = indexByID(_upcomingIds.front());
+		_upcomingIds.pop_front();
+		_previousWallPapers.addLatest(_imageList.id(newWpIndex));
+		const bool succ = setWallpaper(newWpIndex, false);
+		fillUpcomingQueue();
+		return succ;
 	}
 	else
 	{
@@ -377,6 +1002,60 @@ bool WallpaperChanger::nextWallpaper()
 	}
 }
 
+std::vector<size_t> WallpaperChanger::upcomingWallpapers()
+{
+	fillUpcomingQueue();
+
+	std::vector<size_t> indexes;
+	for (qulonglong id: _upcomingIds)
+		indexes.push_back(indexByID(id));
+
+	return indexes;
+}
+
+void WallpaperChanger::fillUpcomingQueue()
+{
+	if (_imageList.empty())
+		return;
+
+	const bool wasFull = _upcomingIds.size() >= LOOK_AHEAD_DEPTH;
+	while (_upcomingIds.size() < LOOK_AHEAD_DEPTH)
+		_upcomingIds.push_back(_imageList.id(pickNextIndex(_upcomingIds.empty() ? _currentWPId : _upcomingIds.back())));
+
+	if (wasFull)
+		return;
+
+	std::vector<Image> images;
+	for (qulonglong id: _upcomingIds)
+		images.push_back(_imageList[indexByID(id)]);
+
+	_prefetcher.prefetch(images, WallpaperRenderCache::screenSize());
+}
+
+size_t WallpaperChanger::pickNextIndex(qulonglong previousId)
+{
+	if (AppSettings::instance().randomize() && AppSettings::instance().weightedRandom())
+	{
+		// A few more tries keep the same wallpaper from coming twice in a row, unless it's (nearly) all there is
+		qulonglong id = _weightedSampler.sample(_random);
+		for (int attempt = 0; id == previousId && _idIndex.size() > 1 && attempt < 8; ++attempt)
+			id = _weightedSampler.sample(_random);
+
+		return _idIndex.indexOf(id);
+	}
+	else if (AppSettings::instance().randomize())
+	{
+		scheduleListStateSave();
+		return _idIndex.indexOf(_shuffleBag.draw(_idIndex.ids(), previousId));
+	}
+
+	const size_t previous = _idIndex.indexOf(previousId);
+	if (previous == invalid_index)
+		return 0;
+
+	return previous < _imageList.size() - 1 ? previous + 1 : 0;
+}
+
 void WallpaperChanger::previousWallpaper()
 {
 	if (!_previousWallPapers.empty() && !_previousWallPapers.isAtBeginning())
@@ -3,26 +3,42 @@
 
 #include "compiler/compiler_warnings_control.h"
 
+#include "aliassampler.h"
+#include "appsettings.h"
+#include "filestats.h"
+#include "folderwatcher.h"
+#include "idindexmap.h"
+#include "imageimporter.h"
 #include "imagelist.h"
+#include "imageprefetcher.h"
+#include "imagestats.h"
+#include "shufflebag.h"
+#include "wallpaperrendercache.h"
 #include "historylist/chistorylist.h"
 
 DISABLE_COMPILER_WARNINGS
+#include <QElapsedTimer>
 #include <QString>
-#include <QTime>
 #include <QTimer>
 RESTORE_COMPILER_WARNINGS
 
-#include <map>
+#include <deque>
+#include <memory>
+#include <unordered_set>
 
+// The list notifications mirror ImageListWatcher
 struct WallpaperWatcher {
 	virtual void wallpaperChanged(size_t) = 0;
 	virtual void wallpaperAdded(size_t) = 0;
-	virtual void timeToNextSwitch(size_t) = 0;
-	virtual void listChanged(size_t) = 0;
+	virtual void imagesInserted(size_t first, size_t count) = 0;
+	virtual void imagesRemoved(std::vector<qulonglong> ids) = 0;
+	virtual void imagesUpdated(std::vector<qulonglong> ids, unsigned fields) = 0;
 	virtual void listCleared() = 0;
+	// See ImageImporterListener
+	virtual void importProgress(size_t numFilesFound, size_t numFilesProcessed, size_t numFilesFailed, bool finished) = 0;
 };
 
-class WallpaperChanger : public ImageListWatcher, public CallbackCaller<WallpaperWatcher>
+class WallpaperChanger : public ImageListWatcher, public FolderWatcherListener, public ImageImporterListener, public SettingsWatcher, public CallbackCaller<WallpaperWatcher>
 {
 private:
 	WallpaperChanger();
@@ -38,10 +54,30 @@ public:
 
 	// Adds the file to image list
 	bool addImage(const QString& filename, ImgParams params = ImgParams());
+	// Adds the image files and the contents of the folders (recursively) in the background, see ImageImporter.
+	// The paths are remembered as the list's sources; the files already in the list are only updated, and only if they have changed.
+	void importImages(const QStringList& paths);
+	// Imports the list's sources again: adds the new files, probes the changed ones again and removes the ones that are gone.
+	// Only the files whose size, modification time or inode differs are opened. Returns false if the list has no sources recorded.
+	bool rescanSources();
+	void cancelImport();
+	bool importInProgress() const;
 	// Returns QImage by its index in the list
 	QImage createQImage(size_t idx) const;
 	// Returns Image by its index in the list
-	const Image &image(size_t idx) const;
+	Image image(size_t idx) const;
+	void setStretchMode(size_t idx, WPOPTIONS mode);
+	// The perceptual hashes of all the entries in index order, 0 for the ones not computed yet (see perceptualhash.h)
+	std::vector<quint64> perceptualHashes() const;
+	struct ComputedHash
+	{
+		qulonglong id;
+		quint64    hash;
+		// The file as it was when it was hashed
+		FileStat   file;
+	};
+	// Stores the hashes computed elsewhere, e. g. on a worker thread. Those of the entries that are gone or whose file isn't the one hashed any more are dropped.
+	void setPerceptualHashes(const std::vector<ComputedHash>& hashes);
 	// Sets the image as a wallpaper
 	bool setWallpaper(size_t idx, bool addToHistory = true);
 	// Delete images from disk by IDs
@@ -55,9 +91,24 @@ public:
 	size_t numImages() const;
 	// Returns true if image physically exists on disk
 	bool imageExists(size_t index) const;
-
-	bool saveList(const QString& filename) const;
+	// Existence, size and modification time of the image file; cached for a while
+	FileStat fileStat(size_t index) const;
+	// Checks the files of the entries [first, first + count) whose cached stats are out of date in one parallel batch,
+	// so that the following imageExists / fileStat calls are served from the cache
+	void refreshFileStats(size_t first = 0, size_t count = invalid_index) const;
+
+	typedef std::vector<std::pair<qulonglong /*id*/, QString /*path*/>> ImagePaths;
+	// A copy of the IDs and paths of all the entries. The list may only be used on the main thread, a worker thread gets this copy instead.
+	ImagePaths imagePaths() const;
+	// Checks the given files in one parallel batch and caches the results, which are also returned in the same order.
+	// Only touches the cache, so it's safe to call from any thread. progress is called on the calling thread.
+	std::vector<FileStat> refreshFileStats(const ImagePaths& files, const FileStatProgress& progress = FileStatProgress()) const;
+
+	bool saveList(const QString& filename);
 	bool loadList(const QString& filename);
+	// See ImageList::hasUncommittedChanges / discardUncommittedChanges
+	bool hasUncommittedChanges() const;
+	void discardUncommittedChanges();
 
 
 // Settings
@@ -70,45 +121,123 @@ public:
 // Switching
 	void startSwitching();
 	void stopSwitching();
+	// For the user skipping the current wallpaper, which its statistics record
 	bool nextWallpaper();
 	void previousWallpaper();
-	// Time left to next switch
+	// Time left to next switch, in seconds. Computed when asked, nothing ticks in between switches.
 	int timeLeft() const;
 	// Index of the currently set wallpaper (size_t_max if none from the list is set)
 	size_t currentWallpaper() const;
+	// Indexes of the wallpapers that nextWallpaper() is going to set, in order
+	std::vector<size_t> upcomingWallpapers();
 
 	bool stopped() const;
 
-// Notifications
-	void enableListUpdateCallbacks(bool enable = true);
+// Image statistics, see ImageStatistics
+	bool isFavourite(qulonglong id) const;
+	// Favourites come up more often in weighted random order
+	void setFavourite(const std::vector<qulonglong>& ids, bool favourite);
+
+// Batches of list changes, see ImageList::beginBatch and ImageListBatch
+	void beginBatch(size_t expectedInsertions = 0);
+	void commitBatch();
+	void rollbackBatch();
 
 // Listeners
-	// Signal that image list has changed
-	void listChanged(size_t index) override;
+	void imagesInserted(size_t first, size_t count) override;
+	void imagesRemoved(std::vector<qulonglong> ids) override;
+	void imagesUpdated(std::vector<qulonglong> ids, unsigned fields) override;
 	// Signal that image list has been cleared
 	void listCleared() override;
+	// Changes to the files in the list's folders
+	void folderEvents(std::vector<FolderEvent> events) override;
+	void imagesImported(std::vector<Image> images, std::vector<Image> renamedImages) override;
+	void importProgress(size_t numFilesFound, size_t numFilesProcessed, size_t numFilesFailed, bool finished) override;
+	void knownFilesMissing(std::vector<QString> filePaths) override;
+	void settingChanged(const QString& key) override;
 
 private:
-	void onTimeout();
+	void onSwitchTimer();
+	// Moves on to the next wallpaper, from the history or from the look-ahead queue
+	bool showNextWallpaper();
+	// Sets the switch timer off at the deadline, or earlier for a long wait (see MAX_SWITCH_TIMER_WAIT)
+	void armSwitchTimer();
 
 	// Sets the image as a wallpaper
 	bool setWallpaperImpl (size_t idx);
 
+	// Tops the look-ahead queue up to its full depth and schedules decoding of the queued images
+	void fillUpcomingQueue();
+	// Chooses the wallpaper to follow the one with the given ID
+	size_t pickNextIndex(qulonglong previousId);
+	// The shuffle bag and the image statistics are saved next to the list file, a few seconds after they have changed
+	void scheduleListStateSave();
+	void saveListState();
+	// Adds the time the shown wallpaper has been up (since it was set, or since the last call) to its statistics
+	void creditDisplayTime();
+	// Follows a change to the image's statistics in weighted random order
+	void updateWeight(qulonglong id);
+
+	// Points the folder watcher at the list's folders, the ones with the most images first
+	void updateWatchedFolders();
+	void scheduleWatchedFoldersUpdate();
+	// The list's files and their parameters, for the importer to skip the unchanged ones
+	std::shared_ptr<const ImageImporter::KnownFiles> knownFiles() const;
+	// Collects the entries of the folder whose files are gone
+	void findMissingFiles(const QString& folder, std::vector<size_t>& missingIndexes) const;
+
+	// Maps all the entries of the list afresh
+	void rebuildIdIndex();
+
 	// Check if any of the images from a list provided are in history, adjust history if so (to prevent invalid history record)
 	void adjustHistoryForObsoleteImages ();
 
 private:
 	ImageList    _imageList;
 	qulonglong   _currentWPId;
-	std::map<qulonglong /*id*/, size_t /*index*/> _indexById;
-	bool         _bUpdatesEnabled;
+	IdIndexMap   _idIndex;
+
+	// IDs of the wallpapers chosen in advance, nextWallpaper() takes them from the front
+	std::deque<qulonglong> _upcomingIds;
+	// Random order without repeats
+	ShuffleBag             _shuffleBag;
+	// Reported removed by a batch that has added them back (renamed files), until the batch reports the insertion
+	std::unordered_set<qulonglong> _movedIds;
+	// Where the shuffle bag and the statistics go; empty for a list that has never been saved
+	QString                _listFilePath;
+	QTimer                 _listStateSaveTimer;
+	WallpaperRenderCache   _renderCache;
+	ImagePrefetcher        _prefetcher;
+
+	ImageStatistics        _stats;
+	// The wallpaper the statistics are counting the display time of, and since when
+	qulonglong             _shownId;
+	QElapsedTimer          _shownTimer;
+	// Weighted random order, the images weighted by their statistics
+	AliasSampler           _weightedSampler;
+	Xoshiro256             _random;
+	// Whether the look-ahead queue has been drawn from the shuffle bag
+	bool                   _shuffleBagInUse;
+
+	mutable FileStatCache          _fileStats;
+
+	ImageImporter                  _importer;
+
+	// Null if the folder watching is turned off
+	std::unique_ptr<FolderWatcher> _folderWatcher;
+	// The set of folders is only updated once the list has stopped changing for a while
+	QTimer                         _watchedFoldersUpdateTimer;
 
 // Time
 	// List of previously active wallpapers for back/forth navigation
 	CHistoryList<qulonglong> _previousWallPapers;
-	QTimer                   _qTimer;
-	// Time since last switch
-	QTime                    _qTime;
+	// Single shot, armed for the next switch only while switching
+	QTimer                   _switchTimer;
+	bool                     _switching;
+	// The interval as of the last time it was read from the settings
+	qint64                   _switchIntervalMs;
+	// On the monotonic clock, see monotonicTimeMs()
+	qint64                   _lastSwitchTime;
 
 private:
 	static QString normalizeFileName(QString filename);
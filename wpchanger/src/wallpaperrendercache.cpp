@@ -0,0 +1,102 @@
+#include "wallpaperrendercache.h"
+#include "decodedimagecache.h"
+#include "wallpaperrenderer.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QSaveFile>
+#include <QScreen>
+#include <QStandardPaths>
+RESTORE_COMPILER_WARNINGS
+
+// A handful of bitmaps at 4K, a couple of dozen at 1080p; the file just rendered is kept even if it's bigger than that on its own
+static const qint64 maxRenderedBytes = 128 * 1024 * 1024;
+
+WallpaperRenderCache::WallpaperRenderCache() :
+	_directory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/rendered")
+{
+}
+
+QString WallpaperRenderCache::renderedWallpaperPath(const Image& image, const QSize& screenSize)
+{
+	if (image.stretchMode() == SYSTEM_DEFAULT || screenSize.isEmpty())
+		return image.imageFilePath();
+
+	// A file in the cache is complete (see render()), so it can be taken without locking anything
+	const QString renderedPath = cacheFilePath(image, screenSize);
+	if (QFileInfo(renderedPath).exists())
+		return renderedPath;
+
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_renderFinished.wait(lock, [this, &renderedPath]() {return !_pendingRenders.contains(renderedPath);});
+		if (QFileInfo(renderedPath).exists())
+			return renderedPath;
+
+		_pendingRenders.insert(renderedPath);
+	}
+
+	// The lock is only held for the bookkeeping, a render of another file doesn't hold this one up
+	const bool rendered = render(image, screenSize, renderedPath);
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_pendingRenders.remove(renderedPath);
+	}
+
+	_renderFinished.notify_all();
+	if (rendered)
+		prune();
+
+	return rendered ? renderedPath : image.imageFilePath();
+}
+
+QSize WallpaperRenderCache::screenSize()
+{
+	const QScreen* screen = QGuiApplication::primaryScreen();
+	return screen ? screen->size() * screen->devicePixelRatio() : QSize();
+}
+
+QString WallpaperRenderCache::cacheFilePath(const Image& image, const QSize& screenSize) const
+{
+	const qint64 modificationTime = QFileInfo(image.imageFilePath()).lastModified().toMSecsSinceEpoch();
+	return QString("%1/%2_%3_%4x%5_%6.bmp").arg(_directory).arg(image.id(), 16, 16, QChar('0')).arg(modificationTime)
+		.arg(screenSize.width()).arg(screenSize.height()).arg((int)image.stretchMode());
+}
+
+bool WallpaperRenderCache::render(const Image& image, const QSize& screenSize, const QString& renderedPath) const
+{
+	const QImage rendered = renderWallpaper(DecodedImageCache::instance().image(image), screenSize, image.stretchMode());
+	if (rendered.isNull())
+	{
+		qDebug() << "Failed to render" << image.imageFilePath();
+		return false;
+	}
+
+	// Written under a temporary name and renamed when complete, so a half-written file is never picked up
+	QSaveFile file(renderedPath);
+	if (!QDir().mkpath(_directory) || !file.open(QIODevice::WriteOnly) || !rendered.save(&file, "BMP") || !file.commit())
+	{
+		qDebug() << "Failed to save rendered wallpaper" << renderedPath << ":" << file.errorString();
+		return false;
+	}
+
+	return true;
+}
+
+void WallpaperRenderCache::prune()
+{
+	// Newest first
+	const QFileInfoList files = QDir(_directory).entryInfoList(QStringList() << "*.bmp", QDir::Files, QDir::Time);
+	qint64 totalSize = 0;
+	for (int i = 0; i < files.size(); ++i)
+	{
+		totalSize += files[i].size();
+		if (i > 0 && totalSize > maxRenderedBytes)
+			QFile::remove(files[i].absoluteFilePath());
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "image.h"
+
+DISABLE_COMPILER_WARNINGS
+#include <QSet>
+#include <QSize>
+#include <QString>
+RESTORE_COMPILER_WARNINGS
+
+#include <condition_variable>
+#include <mutex>
+
+// Disk cache of wallpapers rendered for the screen (see renderWallpaper).
+// A rendered file is identified by (image ID, file modification time, screen size, display mode), so editing the image or changing the resolution or the mode
+// simply produces a new file. The most recently rendered files are kept, up to a total size (uncompressed bitmaps are big at 4K).
+class WallpaperRenderCache
+{
+public:
+	WallpaperRenderCache();
+
+	// Path to the file to hand over to the OS: the rendered one, rendering it first if necessary.
+	// Returns the original image path for SYSTEM_DEFAULT mode and if rendering fails.
+	// Thread-safe. Different files are rendered concurrently; asking for a file that another thread is rendering waits for that render.
+	QString renderedWallpaperPath(const Image& image, const QSize& screenSize);
+
+	// Primary screen size in physical pixels. Must be called on the GUI thread.
+	static QSize screenSize();
+
+private:
+	QString cacheFilePath(const Image& image, const QSize& screenSize) const;
+	// Renders the image and writes it to the cache file; returns false on failure
+	bool render(const Image& image, const QSize& screenSize, const QString& renderedPath) const;
+	// Deletes the least recently rendered files over the size limit
+	void prune();
+
+private:
+	QString                 _directory;
+	std::mutex              _mutex;
+	std::condition_variable _renderFinished;
+	// The files being rendered
+	QSet<QString>           _pendingRenders;
+};
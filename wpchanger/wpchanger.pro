@@ -39,11 +39,36 @@ RCC_DIR     = ../build/$${OUTPUT_DIR}/$${TARGET}
 HEADERS += \
 	src/wallpaperchanger.h \
 	src/settings.h \
-	src/imagelist.h
+	src/aliassampler.h \
+	src/appsettings.h \
+	src/imagelist.h \
+	src/listfileformat.h \
+	src/listjournal.h \
+	src/bktree.h \
+	src/filestats.h \
+	src/folderwatcher.h \
+	src/idindexmap.h \
+	src/imageimporter.h \
+	src/imageprefetcher.h \
+	src/imagestats.h \
+	src/shufflebag.h \
+	src/wallpaperrendercache.h
 
 SOURCES += \
 	src/wallpaperchanger.cpp \
-	src/imagelist.cpp
+	src/aliassampler.cpp \
+	src/appsettings.cpp \
+	src/imagelist.cpp \
+	src/listfileformat.cpp \
+	src/listjournal.cpp \
+	src/filestats.cpp \
+	src/folderwatcher.cpp \
+	src/idindexmap.cpp \
+	src/imageimporter.cpp \
+	src/imageprefetcher.cpp \
+	src/imagestats.cpp \
+	src/shufflebag.cpp \
+	src/wallpaperrendercache.cpp
 
 INCLUDEPATH += \
 	../image/src \
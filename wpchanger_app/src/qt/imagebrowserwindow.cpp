@@ -1,4 +1,5 @@
 #include "imagebrowserwindow.h"
+#include "decodedimagecache.h"
 #include "imagelist.h"
 #include "wallpaperchanger.h"
 #include "system/ctimeelapsed.h"
@@ -52,19 +53,23 @@ bool ImageBrowserWindow::populate()
 	ui->_thumbnailBrowser->clear();
 
 	std::vector<QListWidgetItem*> items(_wpChanger.numImages(), nullptr);
+	_wpChanger.refreshFileStats();
 
+	// The thumbnails are decoded in parallel already, each one is downscaled on the thread that has decoded it
 #pragma omp parallel for schedule(static,50)
 	for (int i = 0; i < (int)_wpChanger.numImages(); ++i)
 	{
 		if (_wpChanger.imageExists(i))
 		{
-			items[i] = new QListWidgetItem(QIcon(QPixmap::fromImage(_wpChanger.image(i).constructQImageObject().scaled(maxThumbSize, Qt::KeepAspectRatio, Qt::SmoothTransformation))),
-										   _wpChanger.image(i).imageFileName() + QString (" (%1x%2)").arg(_wpChanger.image(i).params()._width).arg(_wpChanger.image(i).params()._height));
-			items[i]->setData(Qt::UserRole, _wpChanger.image(i).imageFilePath());
+			const Image image = _wpChanger.image(i);
+			items[i] = new QListWidgetItem(QIcon(QPixmap::fromImage(DecodedImageCache::instance().image(image, maxThumbSize, 1))),
+										   image.imageFileName() + QString (" (%1x%2)").arg(image.params()._width).arg(image.params()._height));
+			items[i]->setData(Qt::UserRole, image.imageFilePath());
 		}
 	}
 
 	qDebug() << "Creating" << items.size() << "items took" << stopWatch.elapsed() / 1000.0f << "seconds";
+	qDebug() << "Decoded image cache:" << DecodedImageCache::instance().hits() << "hits," << DecodedImageCache::instance().misses() << "misses";
 	stopWatch.start();
 
 	for (QListWidgetItem* item: items)
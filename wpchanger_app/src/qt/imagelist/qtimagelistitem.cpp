@@ -2,6 +2,7 @@
 
 #include <QTreeWidgetItem>
 #include <assert.h>
+#include <limits>
 
 static const unsigned char currentWpMarkSymbol[] = {
 	0xB6, // ▶
@@ -28,10 +29,12 @@ QtImageListItem::QtImageListItem(const Image& img, bool currentlySetWallpaper/*
 	setText(FileSizeColumn, QString("%1").arg(img.params()._fileSize / 1024) + " KB");
 	setData(FileSizeColumn, Qt::UserRole, img.params()._fileSize / 1024);	// This wallpaper's file size
 
-	setText(DisplayModeColumn, QString(img.params()._wpDisplayMode == CENTERED ? "Centered" : img.params()._wpDisplayMode == SYSTEM_DEFAULT ? "Default" : "Stretched"));
+	setDisplayMode(img.params()._wpDisplayMode);
 
 	setText(FolderColumn, img.imageFileFolder());
 
+	setSimilarityGroup(0);
+
 	QString format;
 	switch (img.params()._fmt)
 	{
@@ -63,7 +66,7 @@ QtImageListItem::QtImageListItem(const Image& img, bool currentlySetWallpaper/*
 
 bool QtImageListItem::operator<( const QTreeWidgetItem &other ) const
 {
-	if (treeWidget()->sortColumn() == DimensionsColumn || treeWidget()->sortColumn() == FileSizeColumn)
+	if (treeWidget()->sortColumn() == DimensionsColumn || treeWidget()->sortColumn() == FileSizeColumn || treeWidget()->sortColumn() == SimilarityGroupColumn)
 		return data(treeWidget()->sortColumn(), Qt::UserRole).toUInt() < other.data(treeWidget()->sortColumn(), Qt::UserRole).toUInt();
 	else
 		return QTreeWidgetItem::operator<(other);
@@ -73,3 +76,37 @@ void QtImageListItem::setCurrent( bool current /*= true*/ )
 {
 	setText(MarkerColumn, current ? QString::fromUtf16((const ushort*)currentWpMarkSymbol) : QString());
 }
+
+void QtImageListItem::setSimilarityGroup(int group)
+{
+	setText(SimilarityGroupColumn, group > 0 ? QString::number(group) : QString());
+	setData(SimilarityGroupColumn, Qt::UserRole, group > 0 ? (uint)group : std::numeric_limits<uint>::max()); // Ungrouped items sort last
+}
+
+void QtImageListItem::setDisplayMode(WPOPTIONS mode)
+{
+	QString displayMode;
+	switch (mode)
+	{
+	case CENTERED:
+		displayMode = "Centered";
+		break;
+	case STRETCHED:
+		displayMode = "Stretched";
+		break;
+	case FILL:
+		displayMode = "Fill";
+		break;
+	case FIT:
+		displayMode = "Fit";
+		break;
+	case TILE:
+		displayMode = "Tile";
+		break;
+	default:
+		displayMode = "Default";
+		break;
+	}
+
+	setText(DisplayModeColumn, displayMode);
+}
@@ -19,6 +19,7 @@ enum {
 	FileSizeColumn,
 	DisplayModeColumn,
 	ImageFormatColumn,
+	SimilarityGroupColumn,
 	FolderColumn
 };
 
@@ -30,6 +31,9 @@ public:
 	virtual bool operator<(const QTreeWidgetItem &other) const;
 
 	void setCurrent(bool current = true);
+	void setDisplayMode(WPOPTIONS mode);
+	// Marks the item as a member of a group of similar images, 0 = no group
+	void setSimilarityGroup(int group);
 };
 
 #endif // IMAGELISTITEM_H
@@ -1,8 +1,11 @@
 #include "mainwindow.h"
 #include "aboutdialog/caboutdialog.h"
+#include "bktree.h"
+#include "perceptualhash.h"
 
 #include "imagelist/qtimagelistitem.h"
 #include "settingsdialog.h"
+#include "appsettings.h"
 #include "settings.h"
 #include "settings/csettings.h"
 #include "system/ctimeelapsed.h"
@@ -26,6 +29,8 @@ DISABLE_COMPILER_WARNINGS
 #include <QStandardPaths>
 RESTORE_COMPILER_WARNINGS
 
+#include <algorithm>
+#include <numeric>
 #include <thread>
 
 #ifdef WIN32
@@ -38,9 +43,10 @@ MainWindow::MainWindow(QWidget *parent) :
 	ui(new Ui::MainWindow),
 	_trayIcon(QApplication::style()->standardIcon(QStyle::SP_MediaStop), this),
 	_wpChanger(WallpaperChanger::instance()),
-	_timeToSwitch(0),
 	_bListSaved(true),
-	_previousListSize(0)
+	_previousListSize(0),
+	_bImageListWidgetOutdated(false),
+	_bImageListWidgetCleared(false)
 {
 	ui->setupUi(this);
 
@@ -72,6 +78,8 @@ MainWindow::MainWindow(QWidget *parent) :
 	connect(ui->actionSearch_images_by_file_name, SIGNAL(triggered()), SLOT(search()));
 	connect(ui->actionFind_duplicate_files_on_disk, SIGNAL(triggered()), SLOT(findDuplicateFiles()));
 	connect(ui->actionFind_duplicate_list_entries, SIGNAL(triggered()), SLOT(selectDuplicateEntries()));
+	connect(ui->actionFind_similar_images, SIGNAL(triggered()), SLOT(findSimilarImages()));
+	connect(ui->actionRescan_Sources, SIGNAL(triggered()), SLOT(rescanSources()));
 	connect(ui->actionRemove_Non_Existent_Entries, SIGNAL(triggered()), SLOT(removeNonExistingEntries()));
 	connect(ui->actionExit, SIGNAL(triggered()), qApp, SLOT(quit()));
 	connect(ui->action_About, SIGNAL(triggered()), SLOT(onActionAboutTriggered()));
@@ -85,7 +93,7 @@ MainWindow::MainWindow(QWidget *parent) :
 	connect(ui->actionDelete_Current_Wallpaper_From_Disk, SIGNAL(triggered()), SLOT(deleteCurrentWp()));
 	connect(ui->actionDelete_Current_Wallpaper_And_Switch_To_Next, &QAction::triggered, this, &MainWindow::deleteCurrentAndSwitchToNext);
 
-	ui->actionStart_switching->setChecked(CSettings().value(SETTINGS_START_SWITCHING_ON_STARTUP, SETTINGS_DEFAULT_AUTOSTART).toBool());
+	ui->actionStart_switching->setChecked(AppSettings::instance().startSwitchingOnStartup());
 
 	_imageListFilterDialog.setParent(ui->_imageList);
 	_imageListFilterDialog.hide();
@@ -94,17 +102,22 @@ MainWindow::MainWindow(QWidget *parent) :
 	setAcceptDrops(true);
 
 	_wpChanger.addSubscriber(this);
-	timeToNextSwitch(_wpChanger.interval());
+	updateTimeToSwitchLabel();
+	// The countdown is only refreshed while there's someone to see it
+	_timeToSwitchLabelTimer.setInterval(1000);
+	connect(&_timeToSwitchLabelTimer, SIGNAL(timeout()), SLOT(updateTimeToSwitchLabel()));
 
 	connect(ui->_imageList, SIGNAL(customContextMenuRequested(const QPoint&)), SLOT(showImageListContextMenu(const QPoint&)));
 
-	const QString listFileName(CSettings().value(SETTINGS_IMAGE_LIST_FILE).toString());
+	const QString listFileName(AppSettings::instance().imageListFile());
 	if (!listFileName.isEmpty())
 	{
 		if (_wpChanger.loadList(listFileName))
 		{
 			_currentListFileName = listFileName;
-			if (CSettings().value(SETTINGS_START_SWITCHING_ON_STARTUP, SETTINGS_DEFAULT_AUTOSTART).toBool())
+			// Changes recovered from the journal after the application didn't exit normally
+			_bListSaved = !_wpChanger.hasUncommittedChanges();
+			if (AppSettings::instance().startSwitchingOnStartup())
 				_wpChanger.startSwitching();
 
 			updateWindowTitle();
@@ -113,13 +126,16 @@ MainWindow::MainWindow(QWidget *parent) :
 	else
 		_statusBarMsgLabel.setText("Start by dragging and dropping images");
 
-	const size_t wpIndex = (size_t)CSettings().value(SETTINGS_CURRENT_WALLPAPER, std::numeric_limits<uint>().max()).toUInt();
+	const size_t wpIndex = (size_t)AppSettings::instance().currentWallpaper();
 	if (wpIndex < std::numeric_limits<uint>().max())
 		_wpChanger.setCurrentWpIndex(wpIndex);
 
 	_previousListSize = _wpChanger.numImages();
 
 	connect(this, SIGNAL(signalUpdateProgress(int,bool,QString)), SLOT(updateProgress(int,bool,QString)), Qt::QueuedConnection);
+	connect(this, SIGNAL(signalSimilarImagesFound()), SLOT(displaySimilarImageGroups()), Qt::QueuedConnection);
+	connect(this, SIGNAL(signalDuplicateFilesFound()), SLOT(selectDuplicateFiles()), Qt::QueuedConnection);
+	connect(this, SIGNAL(signalFileStatsRefreshed()), SLOT(removeCheckedNonExistingEntries()), Qt::QueuedConnection);
 
 	_progressBar.setVisible(false);
 	ui->statusBar->addWidget(&_progressBar);
@@ -142,15 +158,7 @@ void MainWindow::updateImageList(bool totalUpdate)
 	disconnect(ui->_imageList, SIGNAL(currentItemChanged(QTreeWidgetItem*,QTreeWidgetItem*)), this, SLOT(onImgSelected(QTreeWidgetItem*,QTreeWidgetItem*)));
 	CTimeElapsed stopWatch(true);
 
-	if (_wpChanger.numImages() > 0 && _previousListSize != 0)
-	{
-		if (_bListSaved && _previousListSize != _wpChanger.numImages())
-		{
-			_bListSaved = false;
-			updateWindowTitle();
-		}
-		_previousListSize = _wpChanger.numImages();
-	}
+	trackListSize();
 
 	if (totalUpdate)
 	{
@@ -162,6 +170,9 @@ void MainWindow::updateImageList(bool totalUpdate)
 		_imageListWidgetItems.clear();
 	}
 
+	// Every new item checks whether its file exists
+	_wpChanger.refreshFileStats();
+
 	decltype(_imageListWidgetItems) newImageListWidgetItems;
 	for (size_t i = 0; i < _wpChanger.numImages(); ++i)
 	{
@@ -169,22 +180,16 @@ void MainWindow::updateImageList(bool totalUpdate)
 		const auto imageListItem = _imageListWidgetItems.find(id);
 		if (imageListItem == _imageListWidgetItems.end()) // This image is not yet in the widget, adding
 		{
-			QtImageListItem * item =  new QtImageListItem(_wpChanger.image(i), _wpChanger.currentWallpaper() == i);
-			if (!_wpChanger.imageExists(i))
-			{
-				for (int coulmn = 0; coulmn < ui->_imageList->columnCount(); ++coulmn)
-				{
-					item->setBackgroundColor(coulmn, QColor(Qt::red));
-					item->setTextColor(coulmn, QColor(Qt::white));
-				}
-			}
-
+			QtImageListItem * item = createImageListItem(i);
 			newImageListWidgetItems[id] = item;
 			ui->_imageList->addTopLevelItem(item);
 		}
-		else // An entry for this image has already been added, no need to re-create it
+		else // An entry for this image has already been added, no need to re-create it - unless the image has changed while the window was hidden
 		{
-			imageListItem->second->setCurrent(false);
+			if (_postponedUpdatedIds.count(id) > 0)
+				recreateImageListItem(imageListItem->second, i);
+			else
+				imageListItem->second->setCurrent(false);
 			newImageListWidgetItems[imageListItem->first] = imageListItem->second;
 			_imageListWidgetItems.erase(imageListItem);
 		}
@@ -203,6 +208,7 @@ void MainWindow::updateImageList(bool totalUpdate)
 
 	// Updating the list
 	_imageListWidgetItems = newImageListWidgetItems;
+	_postponedUpdatedIds.clear();
 
 	const int topLevelItemCount = ui->_imageList->topLevelItemCount();
 	assert_r(_imageListWidgetItems.size() == (size_t)topLevelItemCount);
@@ -217,33 +223,59 @@ void MainWindow::updateImageList(bool totalUpdate)
 	qDebug() << "Updating list of " << _wpChanger.numImages() << " items took " << stopWatch.elapsed() / 1000.0f <<"sec";
 }
 
-void MainWindow::addImagesFromDirecoryRecursively(const QString& path)
+QtImageListItem * MainWindow::createImageListItem(size_t index) const
 {
-	const QFileInfo info(path);
-	if (info.exists())
+	QtImageListItem * item = new QtImageListItem(_wpChanger.image(index), _wpChanger.currentWallpaper() == index);
+	if (!_wpChanger.imageExists(index))
 	{
-		if (info.isDir())
+		for (int coulmn = 0; coulmn < ui->_imageList->columnCount(); ++coulmn)
 		{
-			const QDir dir(path);
-			const QFileInfoList entries = dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot);
-			for (int i = 0; i < entries.size(); ++i)
-			{
-				addImagesFromDirecoryRecursively(entries[i].absoluteFilePath());
-			}
+			item->setBackgroundColor(coulmn, QColor(Qt::red));
+			item->setTextColor(coulmn, QColor(Qt::white));
 		}
-		else if (info.isFile() && WallpaperChanger::isSupportedImageFile(path))
+	}
+
+	return item;
+}
+
+void MainWindow::recreateImageListItem(QtImageListItem*& item, size_t index)
+{
+	const int position = ui->_imageList->indexOfTopLevelItem(item);
+	delete item;
+	item = createImageListItem(index);
+	ui->_imageList->insertTopLevelItem(position, item);
+}
+
+void MainWindow::trackListSize()
+{
+	if (_wpChanger.numImages() > 0 && _previousListSize != 0)
+	{
+		if (_bListSaved && _previousListSize != _wpChanger.numImages())
 		{
-			//Attempt to add and indicate the result
-			if (!_wpChanger.addImage(path))
-				setStatusBarMessage(path + " : " + "failed to open as image");
+			_bListSaved = false;
+			updateWindowTitle();
 		}
+		_previousListSize = _wpChanger.numImages();
 	}
 }
 
+bool MainWindow::postponeImageListUpdate(bool cleared /* = false */)
+{
+	// Filling the widget needs every file name, which would be wasted on a window that's sitting in the tray
+	if (isVisible())
+		return false;
+
+	_bImageListWidgetOutdated = true;
+	_bImageListWidgetCleared = _bImageListWidgetCleared || cleared;
+	return true;
+}
+
 void MainWindow::promptToSaveList()
 {
 	if (QMessageBox::question(this, "Save changes?", "The image list was modified, do you want to save changes?", QMessageBox::Save | QMessageBox::No) == QMessageBox::Save)
 		saveImageList();
+	else
+		_wpChanger.discardUncommittedChanges();
 }
 
 //Deletes all the items of the tree, freeing the memory
@@ -284,6 +316,20 @@ bool MainWindow::event(QEvent * event)
 		firstShown = false;
 		QTimer::singleShot(0, this, SLOT(hide()));
 	}
+	else if (event->type() == QEvent::Show && _bImageListWidgetOutdated)
+	{
+		updateImageList(_bImageListWidgetCleared);
+		_bImageListWidgetOutdated = false;
+		_bImageListWidgetCleared = false;
+	}
+
+	if (event->type() == QEvent::Show)
+	{
+		updateTimeToSwitchLabel();
+		_timeToSwitchLabelTimer.start();
+	}
+	else if (event->type() == QEvent::Hide)
+		_timeToSwitchLabelTimer.stop();
 
 	return QWidget::event(event);
 }
@@ -363,7 +409,8 @@ void MainWindow::selectDuplicateEntries()
 // Find and select duplicate files on disk
 void MainWindow::findDuplicateFiles()
 {
-	std::thread([this]() {
+	// The worker thread gets a copy of the paths, the list itself may change in the meantime
+	std::thread([this](const WallpaperChanger::ImagePaths& files) {
 		struct ImageContentsHash {
 			ImageContentsHash(qulonglong contentsHash_, qulonglong id_): contentsHash(contentsHash_), id(id_) {}
 			bool operator<(const ImageContentsHash& other) const {return contentsHash < other.contentsHash;}
@@ -373,29 +420,181 @@ void MainWindow::findDuplicateFiles()
 			qulonglong id;
 		};
 
-		emit signalUpdateProgress(0, true, QString("Scanning files (0/%1)...").arg(_wpChanger.numImages()));
+		const std::vector<FileStat> stats = _wpChanger.refreshFileStats(files, [this](size_t done, size_t total) {
+			emit signalUpdateProgress((int)(100 * done / std::max<size_t>(total, 1)), true, QString("Checking files (%1/%2)...").arg(done).arg(total));
+		});
+
+		emit signalUpdateProgress(0, true, QString("Scanning files (0/%1)...").arg(files.size()));
 		std::vector<ImageContentsHash> imageHashes;
-		for (size_t i = 0; i < _wpChanger.numImages(); ++i)
-			if (_wpChanger.imageExists(i))
+		for (size_t i = 0; i < files.size(); ++i)
+			if (stats[i].exists)
 			{
-				imageHashes.emplace_back(ImageContentsHash(_wpChanger.image(i).contentsHash(), _wpChanger.image(i).id()));
-				emit signalUpdateProgress(100 * i / _wpChanger.numImages(), true, QString("Scanning files (%1/%2)...").arg(i).arg(_wpChanger.numImages()));
+				imageHashes.emplace_back(ImageContentsHash(Image(files[i].second, ImgParams(), files[i].first).contentsHash(), files[i].first));
+				emit signalUpdateProgress((int)(100 * i / files.size()), true, QString("Scanning files (%1/%2)...").arg(i).arg(files.size()));
 			}
 
 			std::sort(imageHashes.begin(), imageHashes.end());
 
+			std::vector<qulonglong> duplicateIds;
 			auto it = std::adjacent_find(imageHashes.begin(), imageHashes.end());
 			while(it != imageHashes.end())
 			{
-				selectImage(it->id);
+				duplicateIds.push_back(it->id);
 				it = std::adjacent_find(it+1, imageHashes.end());
 			}
 
+			{
+				std::lock_guard<std::mutex> lock(_workerResultsMutex);
+				_duplicateFileIds.swap(duplicateIds);
+			}
+
 			emit signalUpdateProgress(100, false, QString());
-	}).detach();
+			emit signalDuplicateFilesFound();
+	}, _wpChanger.imagePaths()).detach();
+}
+
+// Selects the files found by findDuplicateFiles
+void MainWindow::selectDuplicateFiles()
+{
+	std::vector<qulonglong> ids;
+	{
+		std::lock_guard<std::mutex> lock(_workerResultsMutex);
+		ids.swap(_duplicateFileIds);
+	}
+
+	for (qulonglong id: ids)
+		selectImage(id);
+}
+
+// Find visually similar images (the same picture at another resolution or compression level) and mark them as groups
+void MainWindow::findSimilarImages()
+{
+	// Max. number of differing perceptual hash bits for two images to be considered the same picture
+	static const int similarityThreshold = 10;
+
+	// The hashes computed earlier are handed over along with the paths; the new ones are stored back into the list on the GUI thread
+	std::thread([this](const WallpaperChanger::ImagePaths& files, const std::vector<quint64>& knownHashes) {
+		const std::vector<FileStat> stats = _wpChanger.refreshFileStats(files, [this](size_t done, size_t total) {
+			emit signalUpdateProgress((int)(100 * done / std::max<size_t>(total, 1)), true, QString("Checking files (%1/%2)...").arg(done).arg(total));
+		});
+
+		emit signalUpdateProgress(0, true, QString("Hashing images (0/%1)...").arg(files.size()));
+
+		HammingBkTree<size_t /*index in hashes*/> hashTree;
+		std::vector<std::pair<quint64 /*hash*/, qulonglong /*id*/>> hashes;
+		std::vector<WallpaperChanger::ComputedHash> newHashes;
+		for (size_t i = 0; i < files.size(); ++i)
+			if (stats[i].exists)
+			{
+				quint64 hash = knownHashes[i];
+				if (hash == 0)
+				{
+					hash = perceptualHash(files[i].second);
+					if (hash != 0)
+					{
+						const WallpaperChanger::ComputedHash newHash = {files[i].first, hash, stats[i]};
+						newHashes.push_back(newHash);
+					}
+				}
+
+				if (hash != 0)
+				{
+					hashTree.insert(hash, hashes.size());
+					hashes.emplace_back(hash, files[i].first);
+				}
+				emit signalUpdateProgress((int)(100 * i / files.size()), true, QString("Hashing images (%1/%2)...").arg(i).arg(files.size()));
+			}
+
+		// Union-find over the "within threshold" relation, so that chains of similar images end up in one group
+		std::vector<size_t> parent(hashes.size());
+		std::iota(parent.begin(), parent.end(), 0);
+		const auto root = [&parent](size_t i) {
+			while (parent[i] != i)
+				i = parent[i] = parent[parent[i]];
+			return i;
+		};
+
+		for (size_t i = 0; i < hashes.size(); ++i)
+			hashTree.findWithin(hashes[i].first, similarityThreshold, [&](quint64, size_t j, int) {
+				parent[root(j)] = root(i);
+			});
+
+		std::map<size_t /*root*/, std::vector<qulonglong>> groupsByRoot;
+		for (size_t i = 0; i < hashes.size(); ++i)
+			groupsByRoot[root(i)].push_back(hashes[i].second);
+
+		std::vector<std::vector<qulonglong>> groups;
+		for (auto& group: groupsByRoot)
+			if (group.second.size() > 1)
+				groups.push_back(std::move(group.second));
+
+		{
+			std::lock_guard<std::mutex> lock(_workerResultsMutex);
+			_similarImageGroups.swap(groups);
+			_newPerceptualHashes.swap(newHashes);
+		}
+
+		emit signalUpdateProgress(100, false, QString());
+		emit signalSimilarImagesFound();
+	}, _wpChanger.imagePaths(), _wpChanger.perceptualHashes()).detach();
+}
+
+// Marks and selects the groups found by findSimilarImages
+void MainWindow::displaySimilarImageGroups()
+{
+	std::vector<std::vector<qulonglong>> groups;
+	std::vector<WallpaperChanger::ComputedHash> newHashes;
+	{
+		std::lock_guard<std::mutex> lock(_workerResultsMutex);
+		groups.swap(_similarImageGroups);
+		newHashes.swap(_newPerceptualHashes);
+	}
+
+	// So that the next search doesn't have to decode the images again
+	_wpChanger.setPerceptualHashes(newHashes);
+
+	ui->_imageList->clearSelection();
+	for (auto& item: _imageListWidgetItems)
+		item.second->setSimilarityGroup(0);
+
+	for (size_t group = 0; group < groups.size(); ++group)
+		for (const qulonglong id: groups[group])
+		{
+			const auto item = _imageListWidgetItems.find(id);
+			if (item != _imageListWidgetItems.end())
+			{
+				item->second->setSimilarityGroup((int)group + 1);
+				item->second->setSelected(true);
+			}
+		}
+
+	if (!groups.empty())
+		ui->_imageList->sortByColumn(SimilarityGroupColumn, Qt::AscendingOrder);
+
+	ui->_imageList->resizeColumnToContents(SimilarityGroupColumn);
+	setStatusBarMessage(QString("Found %1 groups of similar images").arg(groups.size()));
+}
+
+void MainWindow::rescanSources()
+{
+	if (!_wpChanger.rescanSources())
+		setStatusBarMessage("The list doesn't know where its images have come from; add the folders to it again to make it rescannable");
 }
 
 void MainWindow::removeNonExistingEntries()
+{
+	// The files are checked on a worker thread, then removeNonexistentEntries() finds the results in the cache
+	std::thread([this](const WallpaperChanger::ImagePaths& files) {
+		_wpChanger.refreshFileStats(files, [this](size_t done, size_t total) {
+			emit signalUpdateProgress((int)(100 * done / std::max<size_t>(total, 1)), true, QString("Checking files (%1/%2)...").arg(done).arg(total));
+		});
+
+		emit signalUpdateProgress(100, false, QString());
+		emit signalFileStatsRefreshed();
+	}, _wpChanger.imagePaths()).detach();
+}
+
+void MainWindow::removeCheckedNonExistingEntries()
 {
 	_wpChanger.removeNonexistentEntries();
 }
@@ -441,18 +640,9 @@ void MainWindow::onAddImagesTriggered()
 
 	if (! (images.empty() ))
 	{
-		CTimeElapsed stopWatch(true);
-		QStringList::const_iterator it = images.begin();
-		for (; it != images.end(); ++it)
-		{
-			if (WallpaperChanger::isSupportedImageFile(*it))
-				if (!_wpChanger.addImage(*it))
-					setStatusBarMessage(*it + " : " + "failed to open as image");
-		}
+		_wpChanger.importImages(images);
 		ui->ImageThumbWidget->displayImage(images.back());
 		ui->ImageThumbWidget->update();
-
-		qDebug() << "Opening " << images.size() << "items took " << stopWatch.elapsed() / 1000.0f <<"secs";
 	}
 }
 
@@ -471,9 +661,8 @@ void MainWindow::onImgSelected(QTreeWidgetItem* current, QTreeWidgetItem* /*prev
 
 void MainWindow::dropEvent(QDropEvent * de)
 {
-	CTimeElapsed stopWatch(true);
 	const QMimeData * mimeData = de->mimeData();
-	_wpChanger.enableListUpdateCallbacks(false);
+	QStringList paths;
 
 	//For every dropped file
 	for (int urlIndex = 0; urlIndex < mimeData->urls().size(); ++urlIndex)
@@ -486,20 +675,19 @@ void MainWindow::dropEvent(QDropEvent * de)
 			if (_wpChanger.loadList(mimeData->urls().at(0).path()))
 			{
 				_currentListFileName = mimeData->urls().at(0).path();
-				CSettings().setValue(SETTINGS_IMAGE_LIST_FILE, _currentListFileName);
+				AppSettings::instance().setImageListFile(_currentListFileName);
 				updateWindowTitle();
 			}
 
 			break;
 		}
 		else
-			addImagesFromDirecoryRecursively(filename);
+			paths.push_back(filename);
 	}
 
-	_wpChanger.enableListUpdateCallbacks(true);
-	updateImageList(false);
-
-	qDebug() << "Dropping " << mimeData->urls().size() << "Items took " << stopWatch.elapsed() / 1000.0f <<"secs";
+	// Files and whole folder trees are scanned and probed in the background, the images are added as they come
+	if (!paths.empty())
+		_wpChanger.importImages(paths);
 }
 
 void MainWindow::dragEnterEvent(QDragEnterEvent *event)
@@ -523,7 +711,7 @@ void MainWindow::onWPDblClick( QModelIndex )
 //Wallpaper display mode changed
 void MainWindow::displayModeChanged (int mode)
 {
-	assert_r(mode >= 0 && mode <= SYSTEM_DEFAULT);
+	assert_r(mode >= 0 && mode <= TILE);
 
 	_bListSaved = false;
 	QList<QTreeWidgetItem*> selected = ui->_imageList->selectedItems();
@@ -531,10 +719,9 @@ void MainWindow::displayModeChanged (int mode)
 	for (int i = 0; i < numSelected; ++i)
 	{
 		const size_t itemIdx = (size_t)_wpChanger.indexByID(selected[i]->data(0, IdRole).toULongLong());
-		_wpChanger.image(itemIdx).setStretchMode(WPOPTIONS(mode));
+		_wpChanger.setStretchMode(itemIdx, WPOPTIONS(mode));
 	}
 
-	updateImageList(true);
 	updateWindowTitle();
 }
 
@@ -555,6 +742,10 @@ void MainWindow::showImageListContextMenu(const QPoint& pos)
 	QAction * deleteFromDisk = menu.addAction("Delete from disk");
 	QAction * view           = menu.addAction("View");
 	QAction * openFolder     = menu.addAction("Open folder for browsing");
+	menu.addSeparator();
+	QAction * favourite      = menu.addAction("Favourite");
+	favourite->setCheckable(true);
+	favourite->setChecked(ui->_imageList->currentItem() && _wpChanger.isFavourite(ui->_imageList->currentItem()->data(0, IdRole).toULongLong()));
 
 	QAction * selectedItem = menu.exec(globalPos);
 	if (selectedItem == deleteFromDisk)
@@ -572,6 +763,13 @@ void MainWindow::showImageListContextMenu(const QPoint& pos)
 		if (ui->_imageList->currentItem())
 			QDesktopServices::openUrl(QUrl::fromLocalFile(_wpChanger.image(_wpChanger.indexByID(ui->_imageList->currentItem()->data(0, IdRole).toULongLong())).imageFileFolder()));
 	}
+	else if (selectedItem == favourite)
+	{
+		std::vector<qulonglong> ids;
+		for (const QTreeWidgetItem * item: ui->_imageList->selectedItems())
+			ids.push_back(item->data(0, IdRole).toULongLong());
+		_wpChanger.setFavourite(ids, favourite->isChecked());
+	}
 	else if (selectedItem)
 	{
 		assert_unconditional_r("Unhandled menu item activated");
@@ -580,12 +778,13 @@ void MainWindow::showImageListContextMenu(const QPoint& pos)
 
 void MainWindow::openSettings()
 {
-	SettingsDialog().exec();
+	if (SettingsDialog().exec() == QDialog::Accepted)
+		updateTimeToSwitchLabel();
 }
 
 void MainWindow::displayImageInfo (size_t imageIndex)
 {
-	const Image& img = _wpChanger.image(imageIndex);
+	const Image img = _wpChanger.image(imageIndex);
 	ui->_filePathIndicator->setText(img.imageFileFolder());
 	ui->_imageDimensionsIndicatorLabel->setText(QString("%1x%2").arg(img.params()._width).arg(img.params()._height));
 	ui->_imageSizeIndicatorLabel->setText(QString("%1 KB").arg(img.params()._fileSize / 1024));
@@ -609,7 +808,7 @@ void MainWindow::saveImageListAs()
 	else
 	{
 		_bListSaved = true;
-		CSettings().setValue(SETTINGS_IMAGE_LIST_FILE, _currentListFileName);
+		AppSettings::instance().setImageListFile(_currentListFileName);
 		updateWindowTitle();
 	}
 }
@@ -647,9 +846,9 @@ void MainWindow::loadImageList()
 		else
 		{
 			_currentListFileName = filename;
-			_bListSaved = true;
+			_bListSaved = !_wpChanger.hasUncommittedChanges();
 			_previousListSize = _wpChanger.numImages();
-			CSettings().setValue(SETTINGS_IMAGE_LIST_FILE, _currentListFileName);
+			AppSettings::instance().setImageListFile(_currentListFileName);
 			updateWindowTitle();
 		}
 	}
@@ -669,11 +868,13 @@ void MainWindow::previousWallpaper()
 void MainWindow::stopSwitching()
 {
 	_wpChanger.stopSwitching();
+	updateTimeToSwitchLabel();
 }
 
 void MainWindow::resumeSwitching()
 {
 	_wpChanger.startSwitching();
+	updateTimeToSwitchLabel();
 }
 
 void MainWindow::trayIconActivated(QSystemTrayIcon::ActivationReason reason)
@@ -685,6 +886,12 @@ void MainWindow::trayIconActivated(QSystemTrayIcon::ActivationReason reason)
 		QMenu menu;
 		menu.addAction(ui->actionNext_wallpaper);
 		menu.addAction(ui->actionPrevious_Wallpaper);
+
+		QMenu* upNextMenu = menu.addMenu(tr("Up next"));
+		for (size_t index: _wpChanger.upcomingWallpapers())
+			upNextMenu->addAction(_wpChanger.image(index).imageFileName())->setEnabled(false);
+		upNextMenu->setEnabled(!upNextMenu->isEmpty());
+
 		menu.addSeparator();
 		menu.addAction(ui->actionDelete_Current_Wallpaper_From_Disk);
 		menu.addSeparator();
@@ -705,6 +912,12 @@ void MainWindow::restoreWindow()
 //Key pressed
 void MainWindow::keyPressEvent(QKeyEvent *e)
 {
+	if (e->type() == QKeyEvent::KeyPress && e->key() == Qt::Key_Escape && _wpChanger.importInProgress())
+	{
+		_wpChanger.cancelImport();
+		return;
+	}
+
 	if (e->type() == QKeyEvent::KeyPress && ui->_imageList->hasFocus())
 	{
 		switch (e->key())
@@ -784,28 +997,109 @@ void MainWindow::updateWindowTitle()
 	setWindowTitle(title);
 }
 
-void MainWindow::listChanged(size_t /*index*/)
+void MainWindow::imagesInserted(size_t first, size_t count)
+{
+	trackListSize();
+	if (postponeImageListUpdate())
+		return;
+
+	// Every new item checks whether its file exists; one parallel batch instead of a stat per item
+	_wpChanger.refreshFileStats(first, count);
+
+	for (size_t i = first; i < first + count; ++i)
+	{
+		QtImageListItem * item = createImageListItem(i);
+		_imageListWidgetItems[_wpChanger.image(i).id()] = item;
+		ui->_imageList->addTopLevelItem(item);
+	}
+
+	for (int column = 0; column < ui->_imageList->columnCount(); ++column)
+		ui->_imageList->resizeColumnToContents(column);
+
+	_statusBarNumImages.setText(QString ("%1 images in the list").arg(_wpChanger.numImages()));
+}
+
+void MainWindow::imagesRemoved(std::vector<qulonglong> ids)
+{
+	trackListSize();
+	if (postponeImageListUpdate())
+		return;
+
+	for (qulonglong id: ids)
+	{
+		const auto item = _imageListWidgetItems.find(id);
+		if (item != _imageListWidgetItems.end())
+		{
+			delete item->second; // This both deletes the item and removes it from the widget
+			_imageListWidgetItems.erase(item);
+		}
+	}
+
+	_statusBarNumImages.setText(QString ("%1 images in the list").arg(_wpChanger.numImages()));
+}
+
+void MainWindow::imagesUpdated(std::vector<qulonglong> ids, unsigned fields)
+{
+	if (postponeImageListUpdate())
+	{
+		_postponedUpdatedIds.insert(ids.begin(), ids.end());
+		return;
+	}
+
+	// The files that have changed are checked again, all at once, for the recreated items
+	if (fields & FileParamsField)
+	{
+		WallpaperChanger::ImagePaths changedFiles;
+		for (qulonglong id: ids)
+		{
+			if (_imageListWidgetItems.count(id) > 0)
+				changedFiles.emplace_back(id, _wpChanger.image(_wpChanger.indexByID(id)).imageFilePath());
+		}
+
+		_wpChanger.refreshFileStats(changedFiles);
+	}
+
+	for (qulonglong id: ids)
+	{
+		const auto item = _imageListWidgetItems.find(id);
+		if (item == _imageListWidgetItems.end())
+			continue;
+
+		const size_t index = _wpChanger.indexByID(id);
+		if (fields & FileParamsField)
+			recreateImageListItem(item->second, index); // The file has changed on disk - its size, dimensions and all
+		else if (fields & DisplayModeField)
+			item->second->setDisplayMode(_wpChanger.image(index).params()._wpDisplayMode);
+	}
+}
+
+void MainWindow::importProgress(size_t numFilesFound, size_t numFilesProcessed, size_t numFilesFailed, bool finished)
 {
-	updateImageList(false);
+	updateProgress((int)(100 * numFilesProcessed / std::max<size_t>(numFilesFound, 1)), !finished, QString("Importing images (%1/%2, Esc to cancel)...").arg(numFilesProcessed).arg(numFilesFound));
+	if (finished && numFilesFailed > 0)
+		setStatusBarMessage(QString("%1 files couldn't be opened as images").arg(numFilesFailed));
 }
 
 // Image list was cleared
 void MainWindow::listCleared()
 {
-	updateImageList(true);
+	if (!postponeImageListUpdate(true))
+		updateImageList(true);
 }
 
 void MainWindow::wallpaperChanged(size_t index)
 {
-	CSettings().setValue(SETTINGS_CURRENT_WALLPAPER, (uint)index);
-	_trayIcon.setToolTip(_wpChanger.image(index).imageFileName());
+	AppSettings::instance().setCurrentWallpaper((uint)index);
+	updateTimeToSwitchLabel();
+	_trayIcon.setToolTip(index < invalid_index ? _wpChanger.image(index).imageFileName() : QString());
+	const qulonglong currentId = index < invalid_index ? _wpChanger.image(index).id() : invalid_id;
 	for (int i = 0; i < ui->_imageList->topLevelItemCount(); ++i)
 	{
 		QtImageListItem * item = dynamic_cast<QtImageListItem*>(ui->_imageList->topLevelItem(i));
 		if (!item)
 			continue;
 
-		if (index < invalid_index && _wpChanger.image(index).id() == item->data(0, IdRole).toULongLong())
+		if (currentId != invalid_id && currentId == item->data(0, IdRole).toULongLong())
 		{
 			item->setCurrent();
 		}
@@ -816,14 +1110,14 @@ void MainWindow::wallpaperChanged(size_t index)
 	ui->_imageList->resizeColumnToContents(MarkerColumn);
 }
 
-void MainWindow::timeToNextSwitch(size_t seconds)
+void MainWindow::updateTimeToSwitchLabel()
 {
-	_timeToSwitch = seconds;
+	int seconds = _wpChanger.timeLeft();
 	const int sec = seconds % 60;
 	seconds -= sec;
 	const int min = ( seconds / 60 ) % 60;
 	seconds -= min * 60;
-	const int hr = int (seconds / 3600);
+	const int hr = seconds / 3600;
 	_statusBarTimeToSwitchLabel.setText(QString("%1:%2:%3").arg(hr, 2, 10, QChar('0') ).arg(min, 2, 10, QChar('0')).arg(sec, 2, 10, QChar('0')));
 }
 
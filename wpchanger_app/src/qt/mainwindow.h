@@ -15,10 +15,13 @@ DISABLE_COMPILER_WARNINGS
 #include <QMainWindow>
 #include <QProgressBar>
 #include <QSystemTrayIcon>
+#include <QTimer>
 RESTORE_COMPILER_WARNINGS
 
-#include <vector>
 #include <map>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
 
 namespace Ui {
 	class MainWindow;
@@ -52,8 +55,18 @@ private slots:
 	void selectDuplicateEntries();
 	// Find and select duplicate files on disk
 	void findDuplicateFiles();
+	// Selects the files found by findDuplicateFiles
+	void selectDuplicateFiles();
+	// Find visually similar images (the same picture at another resolution or compression level) and mark them as groups
+	void findSimilarImages();
+	// Marks and selects the groups found by findSimilarImages
+	void displaySimilarImageGroups();
+	// Brings the list up to date with the folders it has been imported from
+	void rescanSources();
 	// Remove non-existent images from list
 	void removeNonExistingEntries();
+	// Second half of removeNonExistingEntries, once the files have been checked
+	void removeCheckedNonExistingEntries();
 	// Removes current wallpaper from list
 	void removeCurrentWp();
 	// Deletes current wallpaper from disk
@@ -92,6 +105,8 @@ private slots:
 	void previousWallpaper();
 	void stopSwitching();
 	void resumeSwitching();
+	// Shows the time until the next switch
+	void updateTimeToSwitchLabel();
 
 // Interface
 	void trayIconActivated(QSystemTrayIcon::ActivationReason reason);
@@ -106,14 +121,16 @@ private slots:
 
 // Slots
 	// Image list was updated
-	void listChanged(size_t index) override;
+	void imagesInserted(size_t first, size_t count) override;
+	void imagesRemoved(std::vector<qulonglong> ids) override;
+	void imagesUpdated(std::vector<qulonglong> ids, unsigned fields) override;
 	// Image list was cleared
 	void listCleared() override;
 	// Current wallpaper changed
 	void wallpaperChanged(size_t index) override;
-	// Time until next switch
-	void timeToNextSwitch(size_t seconds) override;
 	void wallpaperAdded(size_t) override;
+	// Progress of adding files and folders in the background
+	void importProgress(size_t numFilesFound, size_t numFilesProcessed, size_t numFilesFailed, bool finished) override;
 
 private:
 	void selectImage (qulonglong id);
@@ -134,8 +151,14 @@ private:
 
 	//Updates the contents of image list control according to _wpChanger::_imageList
 	void updateImageList(bool totalUpdate);
-
-	void addImagesFromDirecoryRecursively(const QString& dir);
+	// Creates the list widget item for the image at the given index
+	QtImageListItem * createImageListItem(size_t index) const;
+	// Replaces the item with a new one for the image at the given index, in the same place in the widget
+	void recreateImageListItem(QtImageListItem*& item, size_t index);
+	// Marks the list as unsaved if the number of images has changed since the last check
+	void trackListSize();
+	// Returns true (and remembers to refill the list widget later) if the window is hidden
+	bool postponeImageListUpdate(bool cleared = false);
 
 	void promptToSaveList();
 
@@ -144,6 +167,9 @@ private:
 signals:
 	// To update UI from within worker threads
 	void signalUpdateProgress(int percent, bool show, QString text);
+	void signalSimilarImagesFound();
+	void signalDuplicateFilesFound();
+	void signalFileStatsRefreshed();
 
 
 private:
@@ -162,12 +188,25 @@ private:
 	QProgressBar                  _progressBar;
 	QLabel                        _statusBarNumImages;
 
-	size_t                        _timeToSwitch;
+	// Runs only while the window is visible
+	QTimer                        _timeToSwitchLabelTimer;
 
 	bool                          _bListSaved;
 	size_t                        _previousListSize; // Is used to determine that the list was edited
+	// The list widget isn't kept up to date while the window is hidden, it's refilled when the window is shown
+	bool                          _bImageListWidgetOutdated;
+	bool                          _bImageListWidgetCleared;
+	// The images that have changed meanwhile; their items are recreated rather than kept when the list widget is refilled
+	std::unordered_set<qulonglong> _postponedUpdatedIds;
 
 	std::map<qulonglong /*id*/, QtImageListItem* /*item*/> _imageListWidgetItems;
+
+	// Results of the last similar images and duplicate files searches, handed over from the worker threads
+	std::vector<std::vector<qulonglong /*id*/>> _similarImageGroups;
+	// The perceptual hashes the similar images search has computed, to be stored in the list
+	std::vector<WallpaperChanger::ComputedHash> _newPerceptualHashes;
+	std::vector<qulonglong /*id*/> _duplicateFileIds;
+	std::mutex                    _workerResultsMutex;
 };
 
 #endif // MAINWINDOW_H
@@ -1,7 +1,6 @@
 #include "settingsdialog.h"
 
-#include "settings.h"
-#include "settings/csettings.h"
+#include "appsettings.h"
 
 DISABLE_COMPILER_WARNINGS
 #include "ui_settingsdialog.h"
@@ -12,9 +11,11 @@ SettingsDialog::SettingsDialog(QWidget *parent) :
 	ui(new Ui::SettingsDialog)
 {
 	ui->setupUi(this);
-	ui->_spSwitchInterval->setValue(CSettings().value(SETTINGS_INTERVAL, SETTINGS_DEFAULT_INTERVAL).toInt());
-	ui->_cbRandomize->setChecked(CSettings().value(SETTINGS_RANDOMIZE, SETTINGS_DEFAULT_RANDOMIZE).toBool());
-	ui->_cbAutostartSwitching->setChecked(CSettings().value(SETTINGS_START_SWITCHING_ON_STARTUP, SETTINGS_DEFAULT_AUTOSTART).toBool());
+	const AppSettings& settings = AppSettings::instance();
+	ui->_spSwitchInterval->setValue(settings.interval());
+	ui->_cbRandomize->setChecked(settings.randomize());
+	ui->_cbWeightedRandom->setChecked(settings.weightedRandom());
+	ui->_cbAutostartSwitching->setChecked(settings.startSwitchingOnStartup());
 }
 
 SettingsDialog::~SettingsDialog()
@@ -24,8 +25,12 @@ SettingsDialog::~SettingsDialog()
 
 void SettingsDialog::accept()
 {
-	CSettings s;
-	s.setValue(SETTINGS_INTERVAL, ui->_spSwitchInterval->value());
-	s.setValue(SETTINGS_RANDOMIZE, ui->_cbRandomize->isChecked());
-	s.setValue(SETTINGS_START_SWITCHING_ON_STARTUP, ui->_cbAutostartSwitching->isChecked());
+	// The subscribers (the wallpaper changer rescheduling the next switch, for one) are notified right away, the settings storage is written in the background
+	AppSettings& settings = AppSettings::instance();
+	settings.setInterval(ui->_spSwitchInterval->value());
+	settings.setRandomize(ui->_cbRandomize->isChecked());
+	settings.setWeightedRandom(ui->_cbWeightedRandom->isChecked());
+	settings.setStartSwitchingOnStartup(ui->_cbAutostartSwitching->isChecked());
+
+	QDialog::accept();
 }
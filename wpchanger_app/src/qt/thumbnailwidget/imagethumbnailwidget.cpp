@@ -1,9 +1,11 @@
 #include "imagethumbnailwidget.h"
-#include "image.h"
+#include "decodedimagecache.h"
+#include "resampler.h"
 
 DISABLE_COMPILER_WARNINGS
 #include <QPainter>
 #include <QImage>
+#include <QResizeEvent>
 #include <QDebug>
 RESTORE_COMPILER_WARNINGS
 
@@ -26,7 +28,9 @@ bool ImageThumbnailWidget::displayImage(const Image& image)
 	if (!image.isValidImage())
 		return false;
 
-	_imgDrawer = _resize ? image.constructQImageObject().scaled(width(), height(), Qt::KeepAspectRatio, Qt::SmoothTransformation) : image.constructQImageObject();
+	_image = image;
+	_imgDrawer = DecodedImageCache::instance().image(image, size());
+	_scaledImage = QImage();
 	update();
 	return true;
 }
@@ -34,7 +38,31 @@ bool ImageThumbnailWidget::displayImage(const Image& image)
 void ImageThumbnailWidget::paintEvent(QPaintEvent* /*e*/)
 {
 	if (_imgDrawer.isNull()) return;
-	QPainter(this).drawImage(0, 0, _resize ? _imgDrawer : _imgDrawer.scaled(width(), height(), Qt::KeepAspectRatio, Qt::SmoothTransformation));
+
+	if (_resize)
+	{
+		QPainter(this).drawImage(0, 0, _imgDrawer);
+		return;
+	}
+
+	const QSize fittedSize = _imgDrawer.size().scaled(size(), Qt::KeepAspectRatio);
+	if (_scaledImage.size() != fittedSize)
+		_scaledImage = fittedSize == _imgDrawer.size() ? _imgDrawer : resampleImage(_imgDrawer, fittedSize);
+
+	QPainter(this).drawImage(0, 0, _scaledImage);
 
 	//	qDebug() << __FUNCTION__ << " " << stop-start << " ms";
 }
+
+void ImageThumbnailWidget::resizeEvent(QResizeEvent* e)
+{
+	QWidget::resizeEvent(e);
+
+	// The image was decoded for a smaller widget and no longer fills it in either dimension - decode again unless it's already at full size
+	if (!_resize && !_imgDrawer.isNull() && _imgDrawer.width() < width() && _imgDrawer.height() < height() && _imgDrawer.width() < _image.params()._width)
+	{
+		_imgDrawer = DecodedImageCache::instance().image(_image, size());
+		_scaledImage = QImage();
+		update();
+	}
+}
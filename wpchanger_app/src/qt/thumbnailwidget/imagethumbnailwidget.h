@@ -2,14 +2,13 @@
 #define IMAGETHUMBNAILWIDGET_H
 
 #include "compiler/compiler_warnings_control.h"
+#include "image.h"
 
 DISABLE_COMPILER_WARNINGS
 #include <QImage>
 #include <QWidget>
 RESTORE_COMPILER_WARNINGS
 
-class Image;
-
 class ImageThumbnailWidget : public QWidget
 {
 public:
@@ -22,10 +21,15 @@ public:
 
 protected:
 	void paintEvent  (QPaintEvent* e) override;
+	void resizeEvent (QResizeEvent* e) override;
 
 private:
-	//The image for which to draw a thumbnail
+	// The image being displayed, kept for decoding again at a larger size if the widget grows
+	Image  _image;
+	// The image decoded at (about) the widget size
 	QImage _imgDrawer;
+	// _imgDrawer fitted to the current widget size, rebuilt only when the size changes rather than on every repaint
+	QImage _scaledImage;
 	bool   _resize;
 };
 